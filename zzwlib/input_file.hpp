@@ -0,0 +1,139 @@
+
+//
+// read only input file.
+//
+// regular files are memory mapped (madvise SEQUENTIAL, the kernel reads ahead
+// aggressively and drops pages behind us), the data is used in place without a
+// copy to the heap. pipes, character devices and files which can not be mapped
+// are read into a buffer. either way the content is one contiguous span.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <span>
+#include <vector>
+
+#include "unique_handle.hpp"
+
+namespace zzwlib {
+
+class input_file final {
+public:
+    input_file() = default;
+
+    ~input_file() {
+        clear();
+    }
+
+    input_file(input_file&& other) {
+        *this = std::move(other);
+    }
+
+    input_file& operator=(input_file&& other) {
+        if (this != &other) {
+            clear();
+            m_map = other.m_map;
+            m_map_len = other.m_map_len;
+            m_buffer = std::move(other.m_buffer);
+            m_data = other.m_data;
+            other.m_map = MAP_FAILED;
+            other.m_map_len = 0;
+            other.m_data = {};
+        }
+        return *this;
+    }
+
+    input_file(const input_file&) = delete;
+    input_file& operator=(const input_file&) = delete;
+
+    // path "-" is stdin.
+    // return: 0 on success, -1 on error (errno is set).
+    int open(const char *path) {
+        clear();
+
+        if (strcmp(path, "-") == 0) {
+            return read_all(STDIN_FILENO);
+        }
+
+        auto close_fd = [](int fd) { ::close(fd); };
+        unique_handle<decltype(close_fd)> fd(::open(path, O_RDONLY | O_CLOEXEC), close_fd);
+        if (!fd) {
+            return -1;
+        }
+
+        struct stat st;
+        if (fstat(fd.get(), &st) != 0) {
+            return -1;
+        }
+        if (S_ISREG(st.st_mode) && st.st_size > 0) {
+            void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd.get(), 0);
+            if (map != MAP_FAILED) {
+                madvise(map, st.st_size, MADV_SEQUENTIAL);
+                m_map = map;
+                m_map_len = st.st_size;
+                m_data = std::span<const uint8_t>(static_cast<const uint8_t *>(map), m_map_len);
+                return 0;
+            }
+        }
+        // not a regular file or mmap refused it
+        return read_all(fd.get());
+    }
+
+    std::span<const uint8_t> data() const { return m_data; }
+    size_t size() const { return m_data.size(); }
+
+    // true if the data is mapped from the page cache, false if it was read into a buffer
+    bool mapped() const { return m_map != MAP_FAILED; }
+
+    void clear() {
+        if (m_map != MAP_FAILED) {
+            munmap(m_map, m_map_len);
+            m_map = MAP_FAILED;
+            m_map_len = 0;
+        }
+        m_buffer.clear();
+        m_data = {};
+    }
+
+private:
+    int read_all(int fd) {
+        const size_t chunk = 64 * 1024;
+        size_t len = 0;
+        while (true) {
+            if (m_buffer.size() < len + chunk) {
+                m_buffer.resize(m_buffer.size() * 2 > len + chunk ? m_buffer.size() * 2 : len + chunk);
+            }
+            ssize_t n = ::read(fd, m_buffer.data() + len, chunk);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                m_buffer.clear();
+                return -1;
+            }
+            if (n == 0) {
+                break;
+            }
+            len += n;
+        }
+        m_buffer.resize(len);
+        m_data = std::span<const uint8_t>(m_buffer.data(), len);
+        return 0;
+    }
+
+    void *m_map = MAP_FAILED;
+    size_t m_map_len = 0;
+    std::vector<uint8_t> m_buffer;
+    std::span<const uint8_t> m_data;
+};
+
+};
@@ -0,0 +1,160 @@
+
+#include <algorithm>
+#include <chrono>
+
+#include "batch_decoder.hpp"
+#include "../logger.hpp"
+
+zzwlib::logger  batch_logger("jpeg_batch", zzwlib::loglevel::log_info_level);
+
+namespace zzwlib{
+    namespace jpeg {
+
+static inline uint64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+batch_decoder::batch_decoder(int threads)
+{
+    if (threads <= 0) {
+        threads = std::max(1, (int)std::thread::hardware_concurrency());
+    }
+    for (int i = 0; i < threads; i++) {
+        auto ctx = std::make_unique<worker_context>();
+        // parallelism comes from the images, not from the restart intervals
+        ctx->decoder.set_decode_threads(1);
+        m_workers.push_back(std::move(ctx));
+    }
+    for (int i = 0; i < threads; i++) {
+        m_workers[i]->thread = std::thread(&batch_decoder::worker_loop, this, i);
+    }
+    LOGI(batch_logger, "%d workers", threads);
+}
+
+batch_decoder::~batch_decoder()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_work_cv.notify_all();
+    for (auto &ctx : m_workers) {
+        ctx->thread.join();
+    }
+}
+
+void batch_decoder::decode_one(worker_context &ctx, int worker, const jpeg_input &input, decoded_image &out)
+{
+    uint64_t begin = now_ns();
+    out.status = ctx.decoder.decode(input.data, (int)input.len);
+    out.worker = worker;
+    if (out.status == 0) {
+        out.width = ctx.decoder.width();
+        out.height = ctx.decoder.height();
+        out.components = ctx.decoder.components();
+        for (int c = 0; c < out.components; c++) {
+            ctx.decoder.swap_plane(c, out.planes[c]);
+        }
+    } else {
+        out.width = 0;
+        out.height = 0;
+        out.components = 0;
+    }
+    out.latency_ns = now_ns() - begin;
+}
+
+void batch_decoder::worker_loop(int index)
+{
+    worker_context &ctx = *m_workers[index];
+    uint64_t seen_generation = 0;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_work_cv.wait(lock, [&] { return m_stop || m_generation != seen_generation; });
+            if (m_stop) {
+                return;
+            }
+            seen_generation = m_generation;
+        }
+
+        // images are handed out one at a time, small and large ones balance out
+        for (size_t i = m_next++; i < m_inputs.size(); i = m_next++) {
+            decode_one(ctx, index, m_inputs[i], m_outputs[i]);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (--m_busy_workers == 0) {
+                m_done_cv.notify_one();
+            }
+        }
+    }
+}
+
+int batch_decoder::decode(std::span<const jpeg_input> inputs, std::vector<decoded_image> &outputs,
+                          batch_stats *stats)
+{
+    // keep the planes of earlier batches, they become the decoders' buffers
+    outputs.resize(inputs.size());
+
+    uint64_t begin = now_ns();
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_inputs = inputs;
+        m_outputs = outputs.data();
+        m_next = 0;
+        m_busy_workers = (int)m_workers.size();
+        m_generation++;
+        m_work_cv.notify_all();
+        m_done_cv.wait(lock, [&] { return m_busy_workers == 0; });
+        m_inputs = {};
+        m_outputs = nullptr;
+    }
+    uint64_t wall_ns = now_ns() - begin;
+
+    int failed = 0;
+    for (auto &out : outputs) {
+        if (out.status != 0) {
+            failed++;
+        }
+    }
+
+    if (stats != nullptr) {
+        *stats = batch_stats();
+        stats->images = (int)outputs.size();
+        stats->failed = failed;
+        stats->wall_ns = wall_ns;
+        if (!outputs.empty()) {
+            std::vector<uint64_t> latency;
+            uint64_t total_latency = 0;
+            uint64_t pixels = 0;
+            latency.reserve(outputs.size());
+            for (auto &out : outputs) {
+                latency.push_back(out.latency_ns);
+                total_latency += out.latency_ns;
+                pixels += (uint64_t)out.width * out.height;
+            }
+            std::sort(latency.begin(), latency.end());
+            stats->latency_min_ns = latency.front();
+            stats->latency_max_ns = latency.back();
+            stats->latency_avg_ns = total_latency / latency.size();
+            stats->latency_p50_ns = latency[latency.size() / 2];
+            stats->latency_p99_ns = latency[std::min(latency.size() - 1, latency.size() * 99 / 100)];
+            double seconds = wall_ns > 0 ? wall_ns / 1e9 : 1e-9;
+            stats->images_per_sec = outputs.size() / seconds;
+            stats->megapixels_per_sec = pixels / 1e6 / seconds;
+        }
+    }
+
+    if (failed > 0) {
+        LOGW(batch_logger, "%d of %d images failed", failed, (int)outputs.size());
+        return -1;
+    }
+    return 0;
+}
+
+    } // namespace jpeg
+} // namespace zzwlib
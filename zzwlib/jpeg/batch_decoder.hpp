@@ -0,0 +1,99 @@
+
+//
+// batch jpeg decoding on a fixed pool of worker threads.
+//
+// every worker keeps its own jpeg_decoder for the lifetime of the pool, so
+// tables, scratch state and plane buffers stay warm from one image to the next.
+// decoded planes are swapped out of the worker's decoder into the output slot:
+// when the caller passes the same outputs vector again, the buffers of the last
+// batch go back to the decoders and steady state decoding allocates nothing.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <span>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+
+#include "jpeg.hpp"
+
+namespace zzwlib{
+    namespace jpeg {
+
+struct jpeg_input {
+    const uint8_t *data;
+    size_t len;
+};
+
+struct decoded_image {
+    int status = -1;            // 0: decoded, -1: decode failed (bad headers, corrupt or truncated data)
+    int width = 0;
+    int height = 0;
+    int components = 0;
+    image_plane planes[4];
+    uint64_t latency_ns = 0;    // decode time of this image on its worker
+    int worker = -1;            // worker which decoded the image
+};
+
+struct batch_stats {
+    int images = 0;
+    int failed = 0;
+    uint64_t wall_ns = 0;       // first image start to last image done
+    uint64_t latency_min_ns = 0;
+    uint64_t latency_avg_ns = 0;
+    uint64_t latency_p50_ns = 0;
+    uint64_t latency_p99_ns = 0;
+    uint64_t latency_max_ns = 0;
+    double images_per_sec = 0;
+    double megapixels_per_sec = 0;
+};
+
+class batch_decoder final {
+public:
+    // threads: # of workers, 0: one per cpu
+    explicit batch_decoder(int threads = 0);
+    ~batch_decoder();
+
+    batch_decoder(const batch_decoder&) = delete;
+    batch_decoder& operator=(const batch_decoder&) = delete;
+
+    int threads() const { return (int)m_workers.size(); }
+
+    // decode all inputs, outputs[i] gets inputs[i]. blocks until the batch is done,
+    // one batch at a time per batch_decoder.
+    // return: 0 if every image was decoded, -1 if any failed (see decoded_image::status).
+    int decode(std::span<const jpeg_input> inputs, std::vector<decoded_image> &outputs,
+               batch_stats *stats = nullptr);
+
+private:
+    struct worker_context {
+        std::thread thread;
+        jpeg_decoder decoder;
+    };
+
+    void worker_loop(int index);
+    void decode_one(worker_context &ctx, int worker, const jpeg_input &input, decoded_image &out);
+
+    std::vector<std::unique_ptr<worker_context>> m_workers;
+
+    std::mutex m_mutex;
+    std::condition_variable m_work_cv;      // a new batch or stop
+    std::condition_variable m_done_cv;      // all workers finished the batch
+    uint64_t m_generation = 0;              // incremented per batch
+    int m_busy_workers = 0;
+    bool m_stop = false;
+
+    // current batch
+    std::span<const jpeg_input> m_inputs;
+    decoded_image *m_outputs = nullptr;
+    std::atomic<size_t> m_next{0};
+};
+
+    } // namespace jpeg
+} // namespace zzwlib
@@ -0,0 +1,198 @@
+
+//
+// bit reader over entropy coded scan data.
+//
+// reads straight from the input buffer into a 64 bit bit buffer (msb = next bit).
+// 0xFF00 unstuffing and marker detection are done while refilling:
+// 1. 8 bytes without 0xFF are loaded as one big endian word;
+// 2. otherwise bytes are taken one by one, 0xFF00 becomes 0xFF, and a marker
+//    (RSTn, EOI, ...) stops the refill. after that the buffer is fed with 0 bits,
+//    the decoder checks marker() at restart / scan boundaries.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+namespace zzwlib{
+    namespace jpeg {
+
+class bit_reader final {
+public:
+    bit_reader() = default;
+
+    bit_reader(const uint8_t *data, size_t len) {
+        reset(data, len);
+    }
+
+    void reset(const uint8_t *data, size_t len) {
+        m_data = data;
+        m_len = len;
+        m_pos = 0;
+        m_buf = 0;
+        m_bits_left = 0;
+        m_marker = 0;
+        m_fake_bytes = 0;
+    }
+
+    // continue on a new buffer, data[0] is the byte at position() of the old one.
+    // used when the input arrives in pieces: zero bytes fed past the old end are
+    // dropped again (they were not consumed, see overrun()), the real bits stay.
+    void rebase(const uint8_t *data, size_t len) {
+        if (m_marker == 0 && m_fake_bytes > 0) {
+            m_bits_left -= 8 * (int)m_fake_bytes;
+            m_buf = m_bits_left > 0 ? m_buf & (~0ULL << (64 - m_bits_left)) : 0;
+            m_fake_bytes = 0;
+        }
+        m_data = data;
+        m_len = len;
+        m_pos = 0;
+    }
+
+    // true if bits past the end of the data were consumed: the data is incomplete,
+    // more of it may follow. (zero bits after a marker do not count, no more data
+    // comes for the scan: see exhausted())
+    bool overrun() const {
+        return m_marker == 0 && 8 * m_fake_bytes > (size_t)m_bits_left;
+    }
+
+    // true if bits past the end of the data or past a marker were consumed: a
+    // complete scan never does (its last byte is padded with 1 bits), the data
+    // is truncated or corrupt.
+    bool exhausted() const {
+        return 8 * m_fake_bytes > (size_t)m_bits_left;
+    }
+
+    // next n bits (n <= 32), not consumed
+    inline uint32_t peek(int n) {
+        if (m_bits_left < n) {
+            refill();
+        }
+        return (uint32_t)(m_buf >> (64 - n));
+    }
+
+    inline void consume(int n) {
+        m_buf <<= n;
+        m_bits_left -= n;
+    }
+
+    inline uint32_t get_bits(int n) {
+        if (n == 0) {
+            return 0;
+        }
+        uint32_t val = peek(n);
+        consume(n);
+        return val;
+    }
+
+    // jpeg spec F.2.2.1 RECEIVE + EXTEND: read s bits and convert to a signed value
+    inline int receive_extend(int s) {
+        if (s == 0) {
+            return 0;
+        }
+        int val = (int)get_bits(s);
+        return val < (1 << (s - 1)) ? val - (1 << s) + 1 : val;
+    }
+
+    // marker which stopped the refill, 0 if none found yet
+    int marker() const { return m_marker; }
+
+    // zero bytes fed after the end of data / a marker
+    size_t fake_bytes() const { return m_fake_bytes; }
+
+    // offset of the next input byte not loaded into the bit buffer.
+    // points to the 0xFF of marker() once a marker was found.
+    size_t position() const { return m_pos; }
+
+    // drop the buffered bits and move on to the next marker.
+    // return: the marker, 0 if the data ends without one.
+    int seek_marker() {
+        while (m_marker == 0 && m_pos < m_len) {
+            m_bits_left = 0;
+            load_byte();
+        }
+        m_buf = 0;
+        m_bits_left = 0;
+        m_fake_bytes = 0;
+        return m_marker;
+    }
+
+    // at the end of a restart interval: drop the remaining bits and skip RSTn.
+    // return: true if a RST marker was found and skipped.
+    bool restart() {
+        int marker = seek_marker();
+        if (marker < 0xD0 || marker > 0xD7) {
+            return false;
+        }
+        m_pos += 2;
+        m_marker = 0;
+        return true;
+    }
+
+private:
+    void refill() {
+        // fast path: a whole word without 0xFF
+        if (m_marker == 0 && m_pos + 8 <= m_len) {
+            uint64_t word;
+            memcpy(&word, m_data + m_pos, 8);
+            if (!has_ff_byte(word)) {
+                word = __builtin_bswap64(word);
+                int nbytes = (64 - m_bits_left) >> 3;
+                m_buf |= (word >> (64 - 8 * nbytes)) << (64 - m_bits_left - 8 * nbytes);
+                m_bits_left += 8 * nbytes;
+                m_pos += nbytes;
+                return;
+            }
+        }
+        while (m_bits_left <= 56) {
+            load_byte();
+        }
+    }
+
+    // append one unstuffed byte (or a 0 byte once a marker / the end is reached)
+    inline void load_byte() {
+        uint32_t byte = 0;
+        if (m_marker != 0 || m_pos >= m_len) {
+            m_fake_bytes++;
+        } else if (m_data[m_pos] != 0xFF) {
+            byte = m_data[m_pos++];
+        } else {
+            // 0xFF fill bytes may come before a marker
+            size_t next = m_pos + 1;
+            while (next < m_len && m_data[next] == 0xFF) {
+                next++;
+            }
+            if (next >= m_len) {
+                m_pos = m_len;
+                m_fake_bytes++;
+            } else if (m_data[next] == 0x00) {
+                byte = 0xFF;
+                m_pos = next + 1;
+            } else {
+                m_marker = m_data[next];
+                m_pos = next - 1;
+                m_fake_bytes++;
+            }
+        }
+        m_buf |= (uint64_t)byte << (56 - m_bits_left);
+        m_bits_left += 8;
+    }
+
+    static inline bool has_ff_byte(uint64_t word) {
+        uint64_t v = ~word;
+        return ((v - 0x0101010101010101ULL) & ~v & 0x8080808080808080ULL) != 0;
+    }
+
+    const uint8_t *m_data = nullptr;
+    size_t m_len = 0;
+    size_t m_pos = 0;
+    uint64_t m_buf = 0;
+    int m_bits_left = 0;
+    int m_marker = 0;
+    size_t m_fake_bytes = 0;
+};
+
+    } // namespace jpeg
+} // namespace zzwlib
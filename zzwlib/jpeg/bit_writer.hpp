@@ -0,0 +1,117 @@
+
+//
+// bit writer for entropy coded scan data, the counterpart of bit_reader.
+//
+// bits are collected in a 64 bit word (lsb = last bit written). a full word goes
+// out as 8 big endian bytes in one store when it has no 0xFF byte; otherwise
+// byte by byte, with a 0x00 stuffed after every 0xFF.
+// the output is appended to a std::vector, which grows as needed.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+namespace zzwlib{
+    namespace jpeg {
+
+class bit_writer final {
+public:
+    // appends to out, from out.size() on
+    explicit bit_writer(std::vector<uint8_t> &out) :
+        m_out(out),
+        m_pos(out.size()) {}
+
+    // n (<= 32) low bits of bits, msb first. bits above n must be 0.
+    inline void put_bits(uint32_t bits, int n) {
+        if (n < m_free) {
+            m_buf = (m_buf << n) | bits;
+            m_free -= n;
+            return;
+        }
+        // fill the word up and send it; the bits which did not fit stay in m_buf,
+        // the ones already sent are shifted out before the next word is complete
+        int rest = n - m_free;
+        m_buf = (m_buf << m_free) | (bits >> rest);
+        put_word(m_buf);
+        m_buf = bits;
+        m_free = 64 - rest;
+    }
+
+    // pad the last byte with 1 bits (jpeg spec F.1.2.3), e.g. before a marker
+    void flush() {
+        int pad = (8 - ((64 - m_free) & 7)) & 7;
+        if (pad > 0) {
+            put_bits((1u << pad) - 1, pad);
+        }
+        int bits = 64 - m_free;
+        reserve(16);
+        for (int shift = bits - 8; shift >= 0; shift -= 8) {
+            put_byte((uint8_t)(m_buf >> shift));
+        }
+        m_buf = 0;
+        m_free = 64;
+    }
+
+    // flush, then a marker (e.g. RSTn)
+    void put_marker(uint8_t marker) {
+        flush();
+        reserve(2);
+        m_out[m_pos++] = 0xFF;
+        m_out[m_pos++] = marker;
+    }
+
+    // bytes written so far (flushed ones), the vector is sized to them by finish()
+    size_t position() const { return m_pos; }
+
+    // flush and cut the vector to what was written
+    void finish() {
+        flush();
+        m_out.resize(m_pos);
+    }
+
+private:
+    inline void put_word(uint64_t word) {
+        reserve(16);
+        if (!has_ff_byte(word)) {
+            uint64_t be = __builtin_bswap64(word);
+            memcpy(m_out.data() + m_pos, &be, 8);
+            m_pos += 8;
+            return;
+        }
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            put_byte((uint8_t)(word >> shift));
+        }
+    }
+
+    // room for n more bytes; stuffing can double a word, so callers ask for 16
+    inline void reserve(size_t n) {
+        if (m_pos + n > m_out.size()) {
+            m_out.resize(std::max(m_out.size() * 2, m_pos + n + 4096));
+        }
+    }
+
+    inline void put_byte(uint8_t byte) {
+        m_out[m_pos++] = byte;
+        if (byte == 0xFF) {
+            m_out[m_pos++] = 0x00;
+        }
+    }
+
+    static inline bool has_ff_byte(uint64_t word) {
+        uint64_t v = ~word;
+        return ((v - 0x0101010101010101ULL) & ~v & 0x8080808080808080ULL) != 0;
+    }
+
+    std::vector<uint8_t> &m_out;
+    size_t m_pos;
+    uint64_t m_buf = 0;
+    int m_free = 64;    // bits free in m_buf
+};
+
+    } // namespace jpeg
+} // namespace zzwlib
@@ -1,80 +1,158 @@
-
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <iostream>
 #include <fstream>
 
 #include <vector>
 #include <array>
+#include <chrono>
+#include <algorithm>
 
-#include <cmath>
 #include <string>
 
+#include "rgb_convert.hpp"
+#include "bmp_converter.hpp"
+
 namespace zzwlib {
     namespace jpeg {
-        void bmp2yuv444p(std::string bmp_file, std::string yuv_file) {
-            std::ifstream bmp(bmp_file, std::ios::binary);
-            std::ofstream yuv(yuv_file, std::ios::binary);
-            if (!bmp.is_open()) {
-                std::cout << "bmp file open failed" << std::endl;
-                return;
+        int bmp2yuv444p(std::string bmp_file, std::string yuv_file, yuv_matrix matrix, yuv_range range,
+                        yuv_format output, int band_rows, int threads) {
+            // streamed in bands: memory is a few band buffers whatever the image size
+            bmp_converter converter(matrix, range, output, band_rows);
+            converter.set_threads(threads);
+            auto start = std::chrono::steady_clock::now();
+            if (converter.convert(bmp_file.c_str(), yuv_file.c_str()) != 0) {
+                std::cout << "conversion failed" << std::endl;
+                return -1;
             }
-            if (!yuv.is_open()) {
-                std::cout << "yuv file open failed" << std::endl;
-                return;
-            }
-            std::vector<char> bmp_data(54);
-            bmp.read(bmp_data.data(), 54);
-            int width = *(int*)&bmp_data[18];
-            int height = *(int*)&bmp_data[22];
-            std::cout << "width: " << width << " height: " << height << std::endl;
-            int padding = (4 - (width * 3) % 4) % 4;
-            int bytes_per_row = (width * 3) + padding;
-
-            std::cout << "padding: " << padding << " bytes_per_row: " << bytes_per_row << std::endl;
-
-            std::vector<char> bmp_pixel_data(bytes_per_row * height);
-
-            bmp.read(bmp_pixel_data.data(), bytes_per_row * height);
+            auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+            const bmp_info &info = converter.info();
+            std::cout << "width: " << info.width << " height: " << info.height << " bits: " << info.bit_count
+                      << (info.top_down ? " top-down" : " bottom-up") << std::endl;
+            std::cout << to_string(matrix) << " " << to_string(range) << " " << to_string(output)
+                      << ", " << threads << " threads, bands of " << converter.band_rows() << " rows, " << converter.buffer_bytes()
+                      << " bytes buffered, " << us << " us" << std::endl;
+            return 0;
+        }
 
-            std::vector<char> yuv_data(width * height * 3);
-            char * y_plane = yuv_data.data();
-            char * u_plane = yuv_data.data() + width * height;
-            char * v_plane = yuv_data.data() + width * height * 2;
-            for (int row = 0; row < height; row++) {
-                for (int col = 0; col < width; col++) {
-                    int bmp_index = (height - row - 1) * bytes_per_row + col * 3;
-                    int r = bmp_pixel_data[bmp_index + 2];
-                    int g = bmp_pixel_data[bmp_index + 1];
-                    int b = bmp_pixel_data[bmp_index + 0];
-                    int y = 0.299 * r + 0.587 * g + 0.114 * b;
-                    int u = -0.169 * r - 0.331 * g + 0.5 * b + 128;
-                    int v = 0.5 * r - 0.419 * g - 0.081 * b + 128;
-                    y_plane[row * width + col] = y;
-                    u_plane[row * width + col] = u;
-                    v_plane[row * width + col] = v;
+        // every SIMD kernel against the scalar reference, bit for bit.
+        // return: number of mismatching rows
+        int check_rgb_kernels(int rounds) {
+            int mismatch = 0;
+            std::vector<uint8_t> src(4 * 256 + 64);
+            std::vector<uint8_t> out_ref(3 * 256);
+            std::vector<uint8_t> out(3 * 256);
+            for (int m = 0; m < 2; m++) {
+                for (int r = 0; r < 2; r++) {
+                    auto coefs = make_rgb_to_yuv_coefs((yuv_matrix)m, (yuv_range)r);
+                    for (int f = 0; f < 2; f++) {
+                        auto ref = get_rgb_row_kernel(simd_level::scalar, (rgb_format)f);
+                        for (int level = (int)simd_level::sse2; level <= (int)detect_simd_level(); level++) {
+                            auto kernel = get_rgb_row_kernel((simd_level)level, (rgb_format)f);
+                            for (int n = 0; n < rounds; n++) {
+                                // random pixels, saturated ones (0 / 255) every third row
+                                int width = 1 + rand() % 256;
+                                for (auto &v : src) {
+                                    v = (n % 3 == 0) ? (rand() & 1) * 255 : (uint8_t)rand();
+                                }
+                                ref(src.data(), out_ref.data(), out_ref.data() + width, out_ref.data() + 2 * width, width, coefs);
+                                kernel(src.data(), out.data(), out.data() + width, out.data() + 2 * width, width, coefs);
+                                if (memcmp(out_ref.data(), out.data(), 3 * width) != 0) {
+                                    mismatch++;
+                                }
+                            }
+                        }
+                        // subsampled: both rows, one row (y1 nullptr), planar and interleaved chroma
+                        auto ref2 = get_rgb_row2_kernel(simd_level::scalar, (rgb_format)f);
+                        for (int level = (int)simd_level::sse2; level <= (int)detect_simd_level(); level++) {
+                            auto kernel2 = get_rgb_row2_kernel((simd_level)level, (rgb_format)f);
+                            for (int n = 0; n < rounds; n++) {
+                                int width = 1 + rand() % 256;
+                                for (auto &v : src) {
+                                    v = (n % 3 == 0) ? (rand() & 1) * 255 : (uint8_t)rand();
+                                }
+                                bool two_rows = n & 1;
+                                bool interleaved = n & 2;
+                                const uint8_t *src1 = two_rows ? src.data() + 4 * 16 : src.data();
+                                int cw = (width + 1) / 2;
+                                std::fill(out_ref.begin(), out_ref.end(), 0);
+                                std::fill(out.begin(), out.end(), 0);
+                                ref2(src.data(), src1, out_ref.data(), two_rows ? out_ref.data() + width : nullptr,
+                                     out_ref.data() + 2 * width, interleaved ? nullptr : out_ref.data() + 2 * width + cw,
+                                     width, coefs);
+                                kernel2(src.data(), src1, out.data(), two_rows ? out.data() + width : nullptr,
+                                        out.data() + 2 * width, interleaved ? nullptr : out.data() + 2 * width + cw,
+                                        width, coefs);
+                                if (memcmp(out_ref.data(), out.data(), 2 * width + 2 * cw) != 0) {
+                                    mismatch++;
+                                }
+                            }
+                        }
+                    }
                 }
             }
-            yuv.write(yuv_data.data(), width * height * 3);
-            yuv.close();
-            bmp.close();
+            return mismatch;
         }
     }
 }
 
 /*
- * ./bmp2yuv444.elf test.bmp test.227x198.yuv
+ * ./bmp2yuv444.elf test.bmp test.227x198.yuv [bt601|bt709] [full|limited] [yuv444p|i420|nv12|yuv422p|nv16|yuyv] [-b rows] [-t threads]
  *  ffplay -f rawvideo -pixel_format yuv444p -video_size 16x16 test.yuv
- *
+ *  (ffmpeg names: i420 yuv420p, yuyv yuyv422)
+ *  default: bt601 full range (JFIF), yuv444p, bands of 64 rows, 1 thread (0: one per cpu)
+ * ./bmp2yuv444.elf -c
+ *  checks the SIMD kernels against the scalar one
 */
 int main(int argc, char** argv) {
-    if (argc != 3) {
-        std::cout << "usage: bmp2yuv444 bmp_file yuv_file" << std::endl;
+    if (argc == 2 && strcmp(argv[1], "-c") == 0) {
+        int mismatch = zzwlib::jpeg::check_rgb_kernels(10000);
+        std::cout << "simd level " << zzwlib::jpeg::to_string(zzwlib::jpeg::detect_simd_level())
+                  << ", " << mismatch << " rows mismatch" << std::endl;
+        return mismatch == 0 ? 0 : -1;
+    }
+    if (argc < 3 || argc > 10) {
+        std::cout << "usage: bmp2yuv444 bmp_file yuv_file [bt601|bt709] [full|limited] "
+                     "[yuv444p|i420|nv12|yuv422p|nv16|yuyv] [-b rows] [-t threads]" << std::endl;
+        std::cout << "       bmp2yuv444 -c" << std::endl;
         return 0;
     }
     std::string bmp_file = argv[1];
     std::string yuv_file = argv[2];
-    zzwlib::jpeg::bmp2yuv444p(bmp_file, yuv_file);
-    return 0;
+    auto matrix = zzwlib::jpeg::yuv_matrix::bt601;
+    auto range = zzwlib::jpeg::yuv_range::full;
+    auto output = zzwlib::jpeg::yuv_format::yuv444p;
+    int band_rows = 64;
+    int threads = 1;
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            band_rows = atoi(argv[++i]);
+            continue;
+        }
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+            continue;
+        }
+        bool is_format = false;
+        for (int f = 0; f <= (int)zzwlib::jpeg::yuv_format::yuyv; f++) {
+            if (strcmp(argv[i], zzwlib::jpeg::to_string((zzwlib::jpeg::yuv_format)f)) == 0) {
+                output = (zzwlib::jpeg::yuv_format)f;
+                is_format = true;
+            }
+        }
+        if (is_format) {
+            continue;
+        }
+        if (strcmp(argv[i], "bt709") == 0) {
+            matrix = zzwlib::jpeg::yuv_matrix::bt709;
+        } else if (strcmp(argv[i], "limited") == 0) {
+            range = zzwlib::jpeg::yuv_range::limited;
+        } else if (strcmp(argv[i], "bt601") != 0 && strcmp(argv[i], "full") != 0) {
+            std::cout << "unknown option " << argv[i] << std::endl;
+            return -1;
+        }
+    }
+    return zzwlib::jpeg::bmp2yuv444p(bmp_file, yuv_file, matrix, range, output, band_rows, threads);
 }
-
@@ -0,0 +1,298 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <future>
+
+#include "bmp_converter.hpp"
+#include "../unique_handle.hpp"
+#include "../logger.hpp"
+
+zzwlib::logger  bmp_logger("bmp", zzwlib::loglevel::log_info_level);
+
+namespace zzwlib{
+    namespace jpeg {
+
+namespace {
+
+const uint32_t BI_RGB = 0;
+const uint32_t BI_BITFIELDS = 3;
+const uint32_t BI_ALPHABITFIELDS = 6;
+
+inline uint32_t read_le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+inline uint16_t read_le16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+// return: 0, -1 on error or end of file
+int pread_full(int fd, uint8_t *buf, size_t len, off_t offset)
+{
+    while (len > 0) {
+        ssize_t n = ::pread(fd, buf, len, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+int pwrite_full(int fd, const uint8_t *buf, size_t len, off_t offset)
+{
+    while (len > 0) {
+        ssize_t n = ::pwrite(fd, buf, len, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+} // namespace
+
+int probe_bmp(const uint8_t *data, size_t len, bmp_info &info)
+{
+    info = bmp_info();
+    // 14 bytes BITMAPFILEHEADER: "BM", 4 bytes - bfSize, 4 bytes - reserved, 4 bytes - bfOffBits
+    if (len < 18) {
+        return 1;
+    }
+    if (data[0] != 'B' || data[1] != 'M') {
+        LOGD(bmp_logger, "no BM signature");
+        return -1;
+    }
+    info.pixel_offset = read_le32(data + 10);
+    info.header_size = read_le32(data + 14);
+    // BITMAPCOREHEADER (12) and OS/2 headers are not supported
+    uint32_t hs = info.header_size;
+    if (hs != 40 && hs != 52 && hs != 56 && hs != 108 && hs != 124) {
+        LOGD(bmp_logger, "info header size %u not supported", hs);
+        return -1;
+    }
+    if (len < 14 + 40) {
+        return 1;
+    }
+    const uint8_t *h = data + 14;
+    int32_t width = (int32_t)read_le32(h + 4);
+    int32_t height = (int32_t)read_le32(h + 8);
+    uint16_t planes = read_le16(h + 12);
+    info.bit_count = read_le16(h + 14);
+    info.compression = read_le32(h + 16);
+    if (width <= 0 || height == 0 || height == INT32_MIN || planes != 1) {
+        LOGD(bmp_logger, "invalid size %d x %d, %d planes", width, height, planes);
+        return -1;
+    }
+    info.width = width;
+    info.height = height < 0 ? -height : height;
+    info.top_down = height < 0;
+
+    // the masks of BI_BITFIELDS are in V2+ headers, or follow a 40 byte header
+    uint32_t header_end = 14 + hs;
+    if (info.bit_count == 24 && info.compression == BI_RGB) {
+        info.format = rgb_format::bgr888;
+    } else if (info.bit_count == 32 && info.compression == BI_RGB) {
+        info.format = rgb_format::bgrx8888;
+    } else if (info.bit_count == 32 && (info.compression == BI_BITFIELDS || info.compression == BI_ALPHABITFIELDS)) {
+        if (hs == 40) {
+            header_end += info.compression == BI_BITFIELDS ? 12 : 16;
+        }
+        if (len < 14 + 40 + 12) {
+            return 1;
+        }
+        // R G B masks, the alpha mask (if any) is ignored
+        if (read_le32(data + 54) != 0x00ff0000 || read_le32(data + 58) != 0x0000ff00 ||
+            read_le32(data + 62) != 0x000000ff) {
+            LOGD(bmp_logger, "bitfields %08x %08x %08x not supported",
+                 read_le32(data + 54), read_le32(data + 58), read_le32(data + 62));
+            return -1;
+        }
+        info.format = rgb_format::bgrx8888;
+    } else {
+        LOGD(bmp_logger, "%d bit, compression %u not supported", info.bit_count, info.compression);
+        return -1;
+    }
+    if (len < header_end) {
+        return 1;
+    }
+    // a palette may sit between the headers and the pixels, bfOffBits skips it
+    if (info.pixel_offset < header_end) {
+        LOGD(bmp_logger, "bfOffBits %u inside the headers (%u bytes)", info.pixel_offset, header_end);
+        return -1;
+    }
+    info.row_bytes = ((size_t)info.width * bytes_per_pixel(info.format) + 3) & ~(size_t)3;
+    return 0;
+}
+
+bmp_converter::bmp_converter(yuv_matrix matrix, yuv_range range, yuv_format output, int band_rows) :
+    m_matrix(matrix),
+    m_range(range),
+    m_output(output),
+    m_band_request(band_rows < 2 ? 2 : (band_rows + 1) & ~1),
+    m_band_rows(m_band_request)
+{
+}
+
+size_t bmp_converter::buffer_bytes() const
+{
+    return m_in[0].size() + m_in[1].size() + m_out[0].size() + m_out[1].size();
+}
+
+int bmp_converter::convert(const char *bmp_path, const char *yuv_path)
+{
+    auto close_fd = [](int fd) { ::close(fd); };
+    unique_handle<decltype(close_fd)> in(::open(bmp_path, O_RDONLY | O_CLOEXEC), close_fd);
+    if (!in) {
+        LOGE(bmp_logger, "open %s failed, errno %d", bmp_path, errno);
+        return -1;
+    }
+    unique_handle<decltype(close_fd)> out(::open(yuv_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644), close_fd);
+    if (!out) {
+        LOGE(bmp_logger, "open %s failed, errno %d", yuv_path, errno);
+        return -1;
+    }
+    return run(in.get(), out.get());
+}
+
+int bmp_converter::run(int in_fd, int out_fd)
+{
+    struct stat st;
+    if (fstat(in_fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        LOGE(bmp_logger, "input is not a regular file");
+        return -1;
+    }
+    uint8_t header[BMP_MAX_HEADER_LEN];
+    size_t header_len = std::min((size_t)st.st_size, sizeof(header));
+    if (pread_full(in_fd, header, header_len, 0) != 0) {
+        LOGE(bmp_logger, "header read failed");
+        return -1;
+    }
+    int ret = probe_bmp(header, header_len, m_info);
+    if (ret != 0) {
+        LOGE(bmp_logger, "%s", ret > 0 ? "file ends in the headers" : "not a supported bmp");
+        return -1;
+    }
+    const bmp_info &info = m_info;
+    if ((uint64_t)info.pixel_offset + (uint64_t)info.row_bytes * info.height > (uint64_t)st.st_size) {
+        LOGE(bmp_logger, "pixel data too short for %d x %d", info.width, info.height);
+        return -1;
+    }
+    // read ahead only helps top-down files, bottom-up ones are read from the end
+    if (info.top_down) {
+        posix_fadvise(in_fd, info.pixel_offset, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    zzwlib::thread_pool &pool = zzwlib::thread_pool::shared();
+    int threads = m_threads > 0 ? std::min(m_threads, pool.concurrency()) : pool.concurrency();
+    m_band_rows = m_band_request;
+    if (threads > 1) {
+        // source row, Y and up to 2 bytes of chroma per pixel, as rgb_converter tiles
+        int tile = zzwlib::tile_rows(info.row_bytes + (size_t)info.width * 3, 2);
+        m_band_rows = std::max(m_band_rows, 2 * threads * tile);
+    }
+    int band = std::min(m_band_rows, info.height);
+    for (int i = 0; i < 2; i++) {
+        m_in[i].resize(info.row_bytes * band);
+        m_out[i].resize(yuv_output_size(info.width, band, m_output));
+    }
+
+    // offsets of the planes in the output file, the strides do not depend on the height
+    int plane_count = yuv_plane_count(m_output);
+    yuv_output layout = make_yuv_output(m_out[0].data(), info.width, band, m_output);
+    off_t plane_offset[3] = {0, 0, 0};
+    for (int p = 1; p < plane_count; p++) {
+        plane_offset[p] = plane_offset[p - 1] +
+                          (off_t)layout.strides[p - 1] * yuv_plane_rows(m_output, p - 1, info.height);
+    }
+    rgb_converter converter(m_matrix, m_range, info.format, m_output);
+    int bands = (info.height + m_band_rows - 1) / m_band_rows;
+
+    auto rows_of = [&](int b) { return std::min(m_band_rows, info.height - b * m_band_rows); };
+    // a band is a contiguous run of file rows either way: bottom-up, image row r
+    // is file row height - 1 - r
+    auto read_band = [&](int b) -> int {
+        int row = b * m_band_rows;
+        int rows = rows_of(b);
+        int file_row = info.top_down ? row : info.height - row - rows;
+        return pread_full(in_fd, m_in[b & 1].data(), info.row_bytes * rows,
+                          info.pixel_offset + (off_t)info.row_bytes * file_row);
+    };
+    auto write_band = [&](int b) -> int {
+        int row = b * m_band_rows;
+        int rows = rows_of(b);
+        yuv_output out = make_yuv_output(m_out[b & 1].data(), info.width, rows, m_output);
+        for (int p = 0; p < plane_count; p++) {
+            // the band starts on an even row, 4:2:0 chroma rows do not straddle bands
+            off_t first = yuv_plane_rows(m_output, p, row);
+            size_t len = (size_t)out.strides[p] * yuv_plane_rows(m_output, p, rows);
+            if (pwrite_full(out_fd, out.planes[p], len, plane_offset[p] + first * out.strides[p]) != 0) {
+                return -1;
+            }
+        }
+        return 0;
+    };
+
+    // declared after everything the tasks use: the futures wait for them on the way out
+    std::future<int> reading = std::async(std::launch::async, read_band, 0);
+    std::future<int> writing;
+    int status = 0;
+    for (int b = 0; b < bands; b++) {
+        if (reading.get() != 0) {
+            LOGE(bmp_logger, "read of band %d failed", b);
+            status = -1;
+            break;
+        }
+        if (b + 1 < bands) {
+            reading = std::async(std::launch::async, read_band, b + 1);
+        }
+        int rows = rows_of(b);
+        const uint8_t *src = m_in[b & 1].data();
+        ptrdiff_t pitch = (ptrdiff_t)info.row_bytes;
+        if (!info.top_down) {
+            src += info.row_bytes * (rows - 1);
+            pitch = -pitch;
+        }
+        yuv_output out = make_yuv_output(m_out[b & 1].data(), info.width, rows, m_output);
+        if (threads > 1) {
+            converter.convert_rows(src, pitch, info.width, rows, out, pool, threads);
+        } else {
+            converter.convert_rows(src, pitch, info.width, rows, out);
+        }
+        // the last write used the other output buffer
+        if (writing.valid() && writing.get() != 0) {
+            LOGE(bmp_logger, "write of band %d failed", b - 1);
+            status = -1;
+            break;
+        }
+        writing = std::async(std::launch::async, write_band, b);
+    }
+    if (writing.valid() && writing.get() != 0) {
+        LOGE(bmp_logger, "write of the last band failed");
+        status = -1;
+    }
+    if (reading.valid()) {
+        reading.wait();
+    }
+    return status;
+}
+
+    } // namespace jpeg
+} // namespace zzwlib
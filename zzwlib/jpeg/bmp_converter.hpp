@@ -0,0 +1,95 @@
+
+//
+// streaming BMP -> YUV conversion in bands of rows.
+//
+// the header is parsed for real: BITMAPINFOHEADER and its V2 - V5 extensions,
+// the pixel data starts at bfOffBits, negative heights are top-down images.
+// 24 bit BI_RGB and 32 bit BI_RGB / BI_BITFIELDS (B G R X or A byte order) are
+// supported.
+//
+// the image goes through in bands of band_rows rows with two input and two
+// output buffers: band n + 1 is read (pread) and band n - 1 written (pwrite)
+// while band n is converted, so I/O overlaps compute. a bottom-up band is still
+// one contiguous read, it is converted with a negative pitch. memory is the
+// four band buffers whatever the image size.
+//
+// with more than one thread a band is converted in L2 sized tiles on the shared
+// thread pool, and is made big enough for a couple of tiles per thread.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#include "rgb_convert.hpp"
+
+namespace zzwlib{
+    namespace jpeg {
+
+// headers of a bmp file, as found by probe_bmp()
+struct bmp_info {
+    int width = 0;
+    int height = 0;             // always positive, see top_down
+    bool top_down = false;      // negative biHeight: the first row in the file is the top one
+    int bit_count = 0;
+    uint32_t compression = 0;   // BI_RGB 0, BI_BITFIELDS 3, BI_ALPHABITFIELDS 6
+    uint32_t header_size = 0;   // biSize: 40, 52, 56, 108 (V4) or 124 (V5)
+    uint32_t pixel_offset = 0;  // bfOffBits
+    size_t row_bytes = 0;       // rows are padded to 4 bytes
+    rgb_format format = rgb_format::bgr888;
+};
+
+// BITMAPFILEHEADER + info header (+ the masks of BI_BITFIELDS after a 40 byte header)
+const size_t BMP_MAX_HEADER_LEN = 14 + 124 + 16;
+
+// read the file and info headers, the start of the file is enough.
+// return: 0 info is set, 1 data ends before the end of the headers,
+//         -1 not a bmp / a layout which is not supported.
+int probe_bmp(const uint8_t *data, size_t len, bmp_info &info);
+
+class bmp_converter final {
+public:
+    // band_rows: rows per band, rounded up to even (4:2:0 chroma rows are whole)
+    explicit bmp_converter(yuv_matrix matrix = yuv_matrix::bt601,
+                           yuv_range range = yuv_range::full,
+                           yuv_format output = yuv_format::yuv444p,
+                           int band_rows = 64);
+
+    bmp_converter(const bmp_converter&) = delete;
+    bmp_converter& operator=(const bmp_converter&) = delete;
+
+    // bmp_path to a tightly packed yuv file (planes back to back, as ffmpeg's rawvideo).
+    // both have to be seekable files.
+    // return: 0 on success, -1 on error.
+    int convert(const char *bmp_path, const char *yuv_path);
+
+    // headers of the last converted file
+    const bmp_info &info() const { return m_info; }
+
+    // threads for the conversion of a band, 0: one per cpu
+    void set_threads(int threads) { m_threads = threads; }
+
+    // rows per band of the last file
+    int band_rows() const { return m_band_rows; }
+
+    // bytes of the band buffers of the last file, the peak memory of convert()
+    size_t buffer_bytes() const;
+
+private:
+    int run(int in_fd, int out_fd);
+
+    yuv_matrix m_matrix;
+    yuv_range m_range;
+    yuv_format m_output;
+    int m_band_request;         // as asked for, rounded up to even
+    int m_band_rows;
+    int m_threads = 1;
+    bmp_info m_info;
+    std::vector<uint8_t> m_in[2];
+    std::vector<uint8_t> m_out[2];
+};
+
+    } // namespace jpeg
+} // namespace zzwlib
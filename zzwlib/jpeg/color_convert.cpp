@@ -0,0 +1,376 @@
+#include <string.h>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define COLOR_X86_SIMD 1
+#endif
+
+#include "color_convert.hpp"
+
+namespace zzwlib{
+    namespace jpeg {
+
+namespace {
+
+// 14-bit fixed point JFIF coefficients
+const int SCALE_BITS = 14;
+const int ROUND = 1 << (SCALE_BITS - 1);
+const int K_CR_R = 22970;       // 1.402
+const int K_CB_G = -5638;       // -0.344136
+const int K_CR_G = -11700;      // -0.714136
+const int K_CB_B = 29032;       // 1.772
+
+inline uint8_t clamp_u8(int v)
+{
+    return (uint8_t)(v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+void ycbcr_row_scalar(const uint8_t *y, const uint8_t *cb, const uint8_t *cr,
+                      uint8_t *dst, int width, pixel_format format)
+{
+    int r_idx = format == pixel_format::bgrx8888 ? 2 : 0;
+    int b_idx = 2 - r_idx;
+    for (int x = 0; x < width; x++) {
+        int luma = y[x];
+        int u = cb[x] - 128;
+        int v = cr[x] - 128;
+        dst[4 * x + r_idx] = clamp_u8(luma + ((K_CR_R * v + ROUND) >> SCALE_BITS));
+        dst[4 * x + 1]     = clamp_u8(luma + ((K_CB_G * u + K_CR_G * v + ROUND) >> SCALE_BITS));
+        dst[4 * x + b_idx] = clamp_u8(luma + ((K_CB_B * u + ROUND) >> SCALE_BITS));
+        dst[4 * x + 3]     = 0xff;
+    }
+}
+
+// 2x horizontal triangle filter of in[0, n), in[-1] and in[n] hold the edge samples:
+// out[2i] = (3 in[i] + in[i - 1] + bias0) >> shift, out[2i + 1] = (3 in[i] + in[i + 1] + bias1) >> shift
+inline void h2_fancy_scalar(const int16_t *in, uint8_t *out, int n, int mul, int bias0, int bias1, int shift)
+{
+    for (int i = 0; i < n; i++) {
+        int center = mul * in[i];
+        out[2 * i]     = (uint8_t)((center + in[i - 1] + bias0) >> shift);
+        out[2 * i + 1] = (uint8_t)((center + in[i + 1] + bias1) >> shift);
+    }
+}
+
+// h2v2: in is the vertical filter output (3 near + far, 0 - 1020)
+void h2v2_fancy_scalar(const int16_t *colsum, uint8_t *out, int n)
+{
+    h2_fancy_scalar(colsum, out, n, 3, 8, 7, 4);
+}
+
+#ifdef COLOR_X86_SIMD
+
+#define SSE2_TARGET __attribute__((target("sse2")))
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+// (c0, c1) in every 32-bit lane, madd with interleaved (cb, cr) gives cb * c0 + cr * c1
+inline SSE2_TARGET __m128i pair_const(int c0, int c1)
+{
+    return _mm_set1_epi32((int)(((uint32_t)(uint16_t)c1 << 16) | (uint16_t)c0));
+}
+
+// (cb * c0 + cr * c1 + ROUND) >> SCALE_BITS of 8 pixels, the two halves interleaved in lo / hi
+inline SSE2_TARGET __m128i chroma_delta_sse2(__m128i lo, __m128i hi, __m128i k)
+{
+    const __m128i round = _mm_set1_epi32(ROUND);
+    __m128i d_lo = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(lo, k), round), SCALE_BITS);
+    __m128i d_hi = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(hi, k), round), SCALE_BITS);
+    return _mm_packs_epi32(d_lo, d_hi);
+}
+
+SSE2_TARGET void ycbcr_row_sse2(const uint8_t *y, const uint8_t *cb, const uint8_t *cr,
+                                uint8_t *dst, int width, pixel_format format)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bias = _mm_set1_epi16(128);
+    const __m128i alpha = _mm_set1_epi16(255);
+    const __m128i k_r = pair_const(0, K_CR_R);
+    const __m128i k_g = pair_const(K_CB_G, K_CR_G);
+    const __m128i k_b = pair_const(K_CB_B, 0);
+    bool bgr = format == pixel_format::bgrx8888;
+
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m128i y16 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(y + x)), zero);
+        __m128i u16 = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(cb + x)), zero), bias);
+        __m128i v16 = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(cr + x)), zero), bias);
+        __m128i uv_lo = _mm_unpacklo_epi16(u16, v16);
+        __m128i uv_hi = _mm_unpackhi_epi16(u16, v16);
+
+        __m128i r16 = _mm_adds_epi16(y16, chroma_delta_sse2(uv_lo, uv_hi, k_r));
+        __m128i g16 = _mm_adds_epi16(y16, chroma_delta_sse2(uv_lo, uv_hi, k_g));
+        __m128i b16 = _mm_adds_epi16(y16, chroma_delta_sse2(uv_lo, uv_hi, k_b));
+
+        // c0: B (or R) 0-7 | R (or B) 0-7, c1: G 0-7 | A 0-7
+        __m128i c0 = bgr ? _mm_packus_epi16(b16, r16) : _mm_packus_epi16(r16, b16);
+        __m128i c1 = _mm_packus_epi16(g16, alpha);
+        __m128i c0c1_lo = _mm_unpacklo_epi8(c0, c1);
+        __m128i c0c1_hi = _mm_unpackhi_epi8(c0, c1);
+        _mm_storeu_si128((__m128i *)(dst + 4 * x), _mm_unpacklo_epi16(c0c1_lo, c0c1_hi));
+        _mm_storeu_si128((__m128i *)(dst + 4 * x + 16), _mm_unpackhi_epi16(c0c1_lo, c0c1_hi));
+    }
+    ycbcr_row_scalar(y + x, cb + x, cr + x, dst + 4 * x, width - x, format);
+}
+
+inline AVX2_TARGET __m256i chroma_delta_avx2(__m256i lo, __m256i hi, __m256i k)
+{
+    const __m256i round = _mm256_set1_epi32(ROUND);
+    __m256i d_lo = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(lo, k), round), SCALE_BITS);
+    __m256i d_hi = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(hi, k), round), SCALE_BITS);
+    // unpacklo / unpackhi split each 128-bit lane, packs puts the pixels back in order
+    return _mm256_packs_epi32(d_lo, d_hi);
+}
+
+inline AVX2_TARGET __m256i pair_const_avx2(int c0, int c1)
+{
+    return _mm256_set1_epi32((int)(((uint32_t)(uint16_t)c1 << 16) | (uint16_t)c0));
+}
+
+AVX2_TARGET void ycbcr_row_avx2(const uint8_t *y, const uint8_t *cb, const uint8_t *cr,
+                                uint8_t *dst, int width, pixel_format format)
+{
+    const __m256i bias = _mm256_set1_epi16(128);
+    const __m256i alpha = _mm256_set1_epi16(255);
+    const __m256i k_r = pair_const_avx2(0, K_CR_R);
+    const __m256i k_g = pair_const_avx2(K_CB_G, K_CR_G);
+    const __m256i k_b = pair_const_avx2(K_CB_B, 0);
+    bool bgr = format == pixel_format::bgrx8888;
+
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m256i y16 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(y + x)));
+        __m256i u16 = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(cb + x))), bias);
+        __m256i v16 = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(cr + x))), bias);
+        __m256i uv_lo = _mm256_unpacklo_epi16(u16, v16);
+        __m256i uv_hi = _mm256_unpackhi_epi16(u16, v16);
+
+        __m256i r16 = _mm256_adds_epi16(y16, chroma_delta_avx2(uv_lo, uv_hi, k_r));
+        __m256i g16 = _mm256_adds_epi16(y16, chroma_delta_avx2(uv_lo, uv_hi, k_g));
+        __m256i b16 = _mm256_adds_epi16(y16, chroma_delta_avx2(uv_lo, uv_hi, k_b));
+
+        // per 128-bit lane, as in the sse2 kernel: pixels 0-7 in lane 0, 8-15 in lane 1
+        __m256i c0 = bgr ? _mm256_packus_epi16(b16, r16) : _mm256_packus_epi16(r16, b16);
+        __m256i c1 = _mm256_packus_epi16(g16, alpha);
+        __m256i c0c1_lo = _mm256_unpacklo_epi8(c0, c1);
+        __m256i c0c1_hi = _mm256_unpackhi_epi8(c0, c1);
+        __m256i p_lo = _mm256_unpacklo_epi16(c0c1_lo, c0c1_hi);   // pixels 0-3 | 8-11
+        __m256i p_hi = _mm256_unpackhi_epi16(c0c1_lo, c0c1_hi);   // pixels 4-7 | 12-15
+        _mm256_storeu_si256((__m256i *)(dst + 4 * x), _mm256_permute2x128_si256(p_lo, p_hi, 0x20));
+        _mm256_storeu_si256((__m256i *)(dst + 4 * x + 32), _mm256_permute2x128_si256(p_lo, p_hi, 0x31));
+    }
+    ycbcr_row_scalar(y + x, cb + x, cr + x, dst + 4 * x, width - x, format);
+}
+
+SSE2_TARGET void h2v2_fancy_sse2(const int16_t *colsum, uint8_t *out, int n)
+{
+    const __m128i bias0 = _mm_set1_epi16(8);
+    const __m128i bias1 = _mm_set1_epi16(7);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i cur = _mm_loadu_si128((const __m128i *)(colsum + i));
+        __m128i prev = _mm_loadu_si128((const __m128i *)(colsum + i - 1));
+        __m128i next = _mm_loadu_si128((const __m128i *)(colsum + i + 1));
+        __m128i center = _mm_add_epi16(_mm_add_epi16(cur, cur), cur);
+        __m128i even = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(center, prev), bias0), 4);
+        __m128i odd = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(center, next), bias1), 4);
+        // interleave even / odd outputs, all in 0 - 255
+        _mm_storeu_si128((__m128i *)(out + 2 * i),
+                         _mm_packus_epi16(_mm_unpacklo_epi16(even, odd), _mm_unpackhi_epi16(even, odd)));
+    }
+    h2v2_fancy_scalar(colsum + i, out + 2 * i, n - i);
+}
+
+#endif // COLOR_X86_SIMD
+
+} // namespace
+
+ycbcr_row_kernel get_ycbcr_row_kernel(simd_level level)
+{
+    if ((int)level > (int)detect_simd_level()) {
+        level = detect_simd_level();
+    }
+#ifdef COLOR_X86_SIMD
+    if (level == simd_level::avx2) {
+        return ycbcr_row_avx2;
+    }
+    if (level == simd_level::sse2) {
+        return ycbcr_row_sse2;
+    }
+#endif
+    return ycbcr_row_scalar;
+}
+
+h2v2_upsample_kernel get_h2v2_upsample_kernel(simd_level level)
+{
+#ifdef COLOR_X86_SIMD
+    if ((int)level >= (int)simd_level::sse2 && (int)detect_simd_level() >= (int)simd_level::sse2) {
+        return h2v2_fancy_sse2;
+    }
+#endif
+    (void)level;
+    return h2v2_fancy_scalar;
+}
+
+ycbcr_frame make_ycbcr_frame(const jpeg_decoder &decoder)
+{
+    ycbcr_frame frame;
+    frame.components = decoder.components() >= 3 ? 3 : std::min(decoder.components(), 1);
+    frame.width = decoder.width();
+    frame.height = decoder.height();
+    for (int c = 0; c < frame.components; c++) {
+        frame.planes[c] = decoder.plane(c);
+    }
+    if (frame.components == 3) {
+        frame.h_ratio = std::max(1, decoder.max_h_samp() / decoder.h_samp(1));
+        frame.v_ratio = std::max(1, decoder.max_v_samp() / decoder.v_samp(1));
+    }
+    return frame;
+}
+
+void color_converter::upsample_plane_row(const ycbcr_frame &frame, const image_plane &plane, int y, uint8_t *out)
+{
+    int cw = plane.width;
+    int cy = std::min(y / frame.v_ratio, plane.height - 1);
+    const uint8_t *near = plane.data.data() + (size_t)cy * plane.stride;
+    bool fancy = m_method == upsample_method::fancy;
+
+    if (fancy && frame.v_ratio == 2) {
+        // vertical triangle filter: 3/4 of the nearest chroma row, 1/4 of the one above / below
+        int far_y = (y & 1) ? std::min(cy + 1, plane.height - 1) : std::max(cy - 1, 0);
+        const uint8_t *far = plane.data.data() + (size_t)far_y * plane.stride;
+        // colsum[-1] and colsum[cw] repeat the edge samples
+        int16_t *colsum = m_colsum.data() + 1;
+        for (int i = 0; i < cw; i++) {
+            colsum[i] = (int16_t)(3 * near[i] + far[i]);
+        }
+        colsum[-1] = colsum[0];
+        colsum[cw] = colsum[cw - 1];
+        if (frame.h_ratio == 2) {
+            m_h2v2_kernel(colsum, out, cw);
+        } else {
+            int bias = (y & 1) ? 2 : 1;
+            for (int x = 0; x < frame.width; x++) {
+                out[x] = (uint8_t)((colsum[x / frame.h_ratio] + bias) >> 2);
+            }
+        }
+        return;
+    }
+
+    if (fancy && frame.h_ratio == 2) {
+        // horizontal triangle filter
+        int16_t *in = m_colsum.data() + 1;
+        for (int i = 0; i < cw; i++) {
+            in[i] = near[i];
+        }
+        in[-1] = in[0];
+        in[cw] = in[cw - 1];
+        h2_fancy_scalar(in, out, cw, 3, 1, 2, 2);
+        return;
+    }
+
+    if (frame.h_ratio == 2) {
+        for (int i = 0; i < cw; i++) {
+            out[2 * i] = near[i];
+            out[2 * i + 1] = near[i];
+        }
+        return;
+    }
+    for (int x = 0; x < frame.width; x++) {
+        out[x] = near[x / frame.h_ratio];
+    }
+}
+
+void color_converter::upsample_row(const ycbcr_frame &frame, int y, const uint8_t *&cb, const uint8_t *&cr)
+{
+    if (frame.components == 1) {
+        // gray: Cb = Cr = 128 gives R = G = B = Y
+        cb = m_cb.data();
+        cr = m_cr.data();
+        return;
+    }
+
+    const image_plane &cb_plane = *frame.planes[1];
+    const image_plane &cr_plane = *frame.planes[2];
+    if (frame.h_ratio == 1 && (frame.v_ratio == 1 || m_method == upsample_method::nearest)) {
+        // chroma rows are used as they are
+        int cy = y / frame.v_ratio;
+        cb = cb_plane.data.data() + (size_t)cy * cb_plane.stride;
+        cr = cr_plane.data.data() + (size_t)cy * cr_plane.stride;
+        return;
+    }
+    upsample_plane_row(frame, cb_plane, y, m_cb.data());
+    upsample_plane_row(frame, cr_plane, y, m_cr.data());
+    cb = m_cb.data();
+    cr = m_cr.data();
+}
+
+int color_converter::convert_rows(const ycbcr_frame &frame, int y, int rows, uint8_t *dst, int pitch)
+{
+    if ((frame.components != 1 && frame.components != 3) || frame.planes[0] == nullptr) {
+        return -1;
+    }
+
+    // line buffers: a whole number of chroma samples, padded for the kernels
+    size_t line = (size_t)frame.width + 2 * frame.h_ratio + 32;
+    if (m_cb.size() < line) {
+        m_cb.resize(line);
+        m_cr.resize(line);
+        m_colsum.resize(line);
+    }
+    if (frame.components == 1) {
+        memset(m_cb.data(), 128, line);
+        memset(m_cr.data(), 128, line);
+    }
+
+    const image_plane &luma = *frame.planes[0];
+    int end = std::min(y + rows, frame.height);
+    for (int row = y; row < end; row++) {
+        const uint8_t *cb = nullptr;
+        const uint8_t *cr = nullptr;
+        upsample_row(frame, row, cb, cr);
+        m_kernel(luma.data.data() + (size_t)row * luma.stride, cb, cr,
+                 dst + (size_t)row * pitch, frame.width, m_format);
+    }
+    return 0;
+}
+
+int color_converter::convert_rows(const ycbcr_frame &frame, int y, int rows, uint8_t *dst, int pitch,
+                                  zzwlib::thread_pool &pool, int threads) const
+{
+    if ((frame.components != 1 && frame.components != 3) || frame.planes[0] == nullptr) {
+        return -1;
+    }
+    // Y in, 4 bytes out and the two chroma line buffers per row; whole chroma rows per tile
+    int tile = zzwlib::tile_rows((size_t)frame.width * 7, frame.v_ratio);
+    int end = std::min(y + rows, frame.height);
+    pool.parallel_for(y, end, tile, [&](int first, int last) {
+        color_converter worker(m_method, m_format);
+        worker.m_kernel = m_kernel;
+        worker.m_h2v2_kernel = m_h2v2_kernel;
+        worker.convert_rows(frame, first, last - first, dst, pitch);
+    }, threads);
+    return 0;
+}
+
+int color_converter::convert_available(const ycbcr_frame &frame, int rows_decoded, uint8_t *dst, int pitch)
+{
+    int end = rows_decoded;
+    if (end < frame.height && m_method == upsample_method::fancy && frame.v_ratio == 2) {
+        // the last rows need the chroma row below, which is in the next MCU row
+        end -= frame.v_ratio;
+    }
+    end = std::min(end, frame.height);
+    if (end <= m_next_row) {
+        return 0;
+    }
+    int start = m_next_row;
+    if (convert_rows(frame, start, end - start, dst, pitch) != 0) {
+        return -1;
+    }
+    m_next_row = end;
+    return end - start;
+}
+
+    } // namespace jpeg
+} // namespace zzwlib
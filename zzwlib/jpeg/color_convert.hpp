@@ -0,0 +1,110 @@
+
+//
+// fused chroma upsampling + YCbCr -> 32 bit RGB conversion.
+//
+// every output row is made in one pass: the chroma rows it needs are upsampled
+// into two line buffers, then a SIMD kernel converts Y + the line buffers straight
+// into the destination row. no full resolution Cb / Cr planes are written.
+//
+// colour conversion is JFIF (full range BT.601) in 14-bit fixed point:
+//   R = Y + 1.402 (Cr - 128)
+//   G = Y - 0.344136 (Cb - 128) - 0.714136 (Cr - 128)
+//   B = Y + 1.772 (Cb - 128)
+// the SIMD kernels give the same results as the scalar one.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "jpeg.hpp"
+#include "idct.hpp"
+#include "../thread_pool.hpp"
+
+namespace zzwlib{
+    namespace jpeg {
+
+enum class upsample_method : int {
+    nearest = 0,    // sample replication
+    fancy,          // triangle filter (3/4, 1/4 of the nearest two samples), 2x factors only
+};
+
+// byte order in memory
+enum class pixel_format : int {
+    bgrx8888 = 0,   // B G R 0xff, DRM_FORMAT_XRGB8888 / ARGB8888
+    rgbx8888,       // R G B 0xff, DRM_FORMAT_XBGR8888 / ABGR8888
+};
+
+// decoded planes as the converter sees them
+struct ycbcr_frame {
+    const image_plane *planes[3] = {nullptr, nullptr, nullptr};
+    int components = 0;     // 1: gray, 3: YCbCr
+    int width = 0;
+    int height = 0;
+    int h_ratio = 1;        // luma samples per chroma sample
+    int v_ratio = 1;
+};
+
+// frame of the image last decoded by decoder
+ycbcr_frame make_ycbcr_frame(const jpeg_decoder &decoder);
+
+// per row kernel: width pixels of y, cb, cr (full resolution) to 4 bytes per pixel
+typedef void (*ycbcr_row_kernel)(const uint8_t *y, const uint8_t *cb, const uint8_t *cr,
+                                 uint8_t *dst, int width, pixel_format format);
+
+ycbcr_row_kernel get_ycbcr_row_kernel(simd_level level);
+
+// 2x horizontal part of 4:2:0 fancy upsampling.
+// colsum: n vertically filtered chroma samples (3 near + far), colsum[-1] / colsum[n]
+// repeat the edges. out: 2n samples.
+typedef void (*h2v2_upsample_kernel)(const int16_t *colsum, uint8_t *out, int n);
+
+h2v2_upsample_kernel get_h2v2_upsample_kernel(simd_level level);
+
+class color_converter final {
+public:
+    explicit color_converter(upsample_method method = upsample_method::fancy,
+                             pixel_format format = pixel_format::bgrx8888,
+                             simd_level level = detect_simd_level()) :
+        m_method(method),
+        m_format(format),
+        m_kernel(get_ycbcr_row_kernel(level)),
+        m_h2v2_kernel(get_h2v2_upsample_kernel(level)) {}
+
+    // convert image rows [y, y + rows) to dst.
+    // dst: row 0 of the destination, pitch: bytes per destination row.
+    // return: 0, -1 if the frame is not gray / YCbCr.
+    int convert_rows(const ycbcr_frame &frame, int y, int rows, uint8_t *dst, int pitch);
+
+    // the same in tiles of rows on pool, on up to threads threads (0: all of them).
+    // tiles are sized to L2, each has its own line buffers.
+    int convert_rows(const ycbcr_frame &frame, int y, int rows, uint8_t *dst, int pitch,
+                     zzwlib::thread_pool &pool, int threads = 0) const;
+
+    // row by row use, e.g. from jpeg_decoder's row callback: image rows [0, rows_decoded)
+    // are decoded, convert the ones not converted yet whose chroma context is complete.
+    // start each image with reset().
+    // return: # of rows converted by this call, -1 on error.
+    int convert_available(const ycbcr_frame &frame, int rows_decoded, uint8_t *dst, int pitch);
+
+    void reset() { m_next_row = 0; }
+
+private:
+    // full width chroma of image row y: the plane rows themselves when no
+    // upsampling is needed, m_cb / m_cr otherwise
+    void upsample_row(const ycbcr_frame &frame, int y, const uint8_t *&cb, const uint8_t *&cr);
+    void upsample_plane_row(const ycbcr_frame &frame, const image_plane &plane, int y, uint8_t *out);
+
+    upsample_method m_method;
+    pixel_format m_format;
+    ycbcr_row_kernel m_kernel;
+    h2v2_upsample_kernel m_h2v2_kernel;
+    int m_next_row = 0;
+    std::vector<int16_t> m_colsum;      // filter input, one chroma row + an edge sample each side
+    std::vector<uint8_t> m_cb;
+    std::vector<uint8_t> m_cr;
+};
+
+    } // namespace jpeg
+} // namespace zzwlib
@@ -3,8 +3,10 @@
 #include <array>
 #include <iostream>
 #include <stdio.h>
+#include <string.h>
 
 #include "../logger.hpp"
+#include "idct.hpp"
 
 zzwlib::logger dct_logger("dct", zzwlib::loglevel::log_verbose_level);
 
@@ -35,38 +37,72 @@ namespace zzwlib {
                 }
             }
         }
+        // blocks are in natural order: dct_block[v][u], v vertical, u horizontal frequency
         void computeIDCT() {
-            for (int y = 0; y < 8; y++) {
-                for (int x = 0; x < 8; x++) {
-                    float sum = 0.0f;
-                    for (int u = 0; u < 8; u++) {
-                        for (int v = 0; v < 8; v++) {
-                            float alpha = (u == 0) ? 1.0f / std::sqrt(2.0f) : 1.0f;
-                            float beta =  (v == 0) ? 1.0f / std::sqrt(2.0f) : 1.0f;
-                            sum += alpha * beta * dct_block[u][v] * std::cos((2 * x + 1) * u * M_PI / 16.0) * std::cos((2 * y + 1) * v * M_PI / 16.0);
-                        }
-                    }
-                    src_block[y][x] = sum / 4.0f;
-                }
-            }
+            idct_8x8_float(&dct_block[0][0], &src_block[0][0]);
         }
 
         void computeFDCT() {
-            for (int u = 0; u < 8; u++) {
-                for (int v = 0; v < 8; v++) {
-
-                    float sum = 0.0f;
-                    float alpha = (u == 0) ? 1.0f / std::sqrt(2.0f) : 1.0f;
-                    float beta =  (v == 0) ? 1.0f / std::sqrt(2.0f) : 1.0f;
+            fdct_8x8_float(&src_block[0][0], &dct_block[0][0]);
+        }
 
-                    for (int y = 0; y < 8; y++) {
-                        for (int x = 0; x < 8; x++) {
-                            sum += src_block[y][x] * std::cos((2 * x + 1) * u * M_PI / 16.0) * std::cos((2 * y + 1) * v * M_PI / 16.0);
-                        }
+        // compare every simd level with the scalar kernels, bit for bit.
+        // return: number of mismatching blocks
+        int check_idct_kernels(int rounds) {
+            const idct_kernels &ref = get_idct_kernels(simd_level::scalar);
+            int mismatch = 0;
+
+            for (int level = (int)simd_level::sse2; level <= (int)detect_simd_level(); level++) {
+                const idct_kernels &k = get_idct_kernels((simd_level)level);
+                int level_mismatch = 0;
+                for (int n = 0; n < rounds; n++) {
+                    int16_t zz[64], coef_ref[64], coef[64], q[64];
+                    uint8_t out_ref[64], out[64];
+                    // small values most of the time, the full 16-bit range now and then
+                    int range = (n % 8 == 0) ? 65536 : 512;
+                    for (int i = 0; i < 64; i++) {
+                        zz[i] = (rand() % 4 == 0) ? (int16_t)(rand() % range - range / 2) : 0;
+                        q[i] = (n % 8 == 1) ? (int16_t)(rand() % 65536 - 32768) : (int16_t)(1 + rand() % 64);
+                    }
+                    ref.dezigzag(zz, coef_ref);
+                    k.dezigzag(zz, coef);
+                    bool same = memcmp(coef_ref, coef, sizeof(coef)) == 0;
+
+                    ref.idct_int(coef_ref, q, out_ref, 8);
+                    k.idct_int(coef_ref, q, out, 8);
+                    same = same && memcmp(out_ref, out, sizeof(out)) == 0;
+
+                    ref.dequant(coef_ref, q);
+                    k.dequant(coef, q);
+                    same = same && memcmp(coef_ref, coef, sizeof(coef)) == 0;
+
+                    // encoder side: samples, extreme (0 / 255 stripes) every other round
+                    uint8_t samples[64];
+                    uint16_t quant[64];
+                    for (int i = 0; i < 64; i++) {
+                        samples[i] = (n % 2 == 0) ? (uint8_t)rand() : (((i >> (n % 3)) ^ (n >> 2)) & 1) * 255;
+                        quant[i] = (uint16_t)(1 + rand() % 255);
+                    }
+                    fdct_divisors div;
+                    prepare_fdct_divisors(quant, div);
+                    ref.fdct_int(samples, 8, coef_ref);
+                    k.fdct_int(samples, 8, coef);
+                    same = same && memcmp(coef_ref, coef, sizeof(coef)) == 0;
+
+                    int16_t zz_ref[64];
+                    uint64_t nonzero_ref = ref.quantize(coef_ref, div, zz_ref);
+                    uint64_t nonzero = k.quantize(coef, div, zz);
+                    same = same && nonzero_ref == nonzero && memcmp(zz_ref, zz, sizeof(zz)) == 0;
+
+                    if (!same) {
+                        level_mismatch++;
                     }
-                    dct_block[u][v] = sum * alpha * beta / 4.0f;
                 }
+                LOGD(dct_logger, "%s kernels: %d / %d blocks mismatch",
+                     to_string((simd_level)level), level_mismatch, rounds);
+                mismatch += level_mismatch;
             }
+            return mismatch;
         }
 
         void print_src_block()
@@ -116,5 +152,10 @@ int main(int argc, char *argv[])
     LOGD(dct_logger, "\n\nsrc_block:");
     zzwlib::jpeg::print_src_block();
 
+    LOGD(dct_logger, "\n\nsimd level: %s", zzwlib::jpeg::to_string(zzwlib::jpeg::detect_simd_level()));
+    if (zzwlib::jpeg::check_idct_kernels(100000) != 0) {
+        return -1;
+    }
+
     return 0;
 }
@@ -0,0 +1,163 @@
+
+//
+// table driven huffman decoder, built from DHT data.
+//
+// 1. codes no longer than lookahead_bits are resolved with one lookup in m_lookup,
+//    which is indexed by the next lookahead_bits bits of the stream;
+// 2. longer codes fall back to the canonical tables (jpeg spec F.2.2.3):
+//    m_maxcode[l] is the largest code of length l, m_valoffset[l] maps a code
+//    of length l to its index in m_huffval.
+//
+// huffman_encoder is the other direction: symbol -> code and code length.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <array>
+
+namespace zzwlib{
+    namespace jpeg {
+
+struct HuffmanRow {
+    int num;
+    std::vector<uint8_t> val_list;
+};
+
+// 16 rows, row i holds the symbols whose code length is i + 1
+typedef std::vector<HuffmanRow> HuffmanTable;
+
+class huffman_decoder final {
+public:
+    static constexpr int lookahead_bits = 9;
+
+    huffman_decoder() {
+        m_lookup.fill(0);
+        m_maxcode.fill(-1);
+        m_valoffset.fill(0);
+        m_huffval.fill(0);
+    }
+
+    // return: 0 on success, -1 if the table is not a valid canonical huffman table.
+    int build(const HuffmanTable &table) {
+        m_lookup.fill(0);
+        m_maxcode.fill(-1);
+        m_valoffset.fill(0);
+        m_huffval.fill(0);
+
+        if (table.size() != 16) {
+            return -1;
+        }
+
+        int code = 0;
+        int idx = 0;
+        for (int len = 1; len <= 16; len++) {
+            const HuffmanRow &row = table[len - 1];
+            if (row.num != (int)row.val_list.size() || idx + row.num > 256) {
+                return -1;
+            }
+            // the codes have to fit len bits before they go to m_lookup,
+            // and the all ones code is not used (jpeg spec C.2, as libjpeg)
+            if (code + row.num >= (1 << len)) {
+                return -1;
+            }
+            if (row.num > 0) {
+                // codes of this length are code .. code + num - 1
+                m_valoffset[len] = idx - code;
+                for (int i = 0; i < row.num; i++) {
+                    m_huffval[idx + i] = row.val_list[i];
+                    if (len <= lookahead_bits) {
+                        // every lookahead_bits wide pattern starting with this code
+                        int shift = lookahead_bits - len;
+                        int first = (code + i) << shift;
+                        uint16_t entry = (uint16_t)((len << 8) | row.val_list[i]);
+                        for (int k = 0; k < (1 << shift); k++) {
+                            m_lookup[first + k] = entry;
+                        }
+                    }
+                }
+                code += row.num;
+                idx += row.num;
+                m_maxcode[len] = code - 1;
+            }
+            code <<= 1;
+        }
+        return 0;
+    }
+
+    // bits: the next 16 bits of the stream, msb first.
+    // return: the symbol, code_len set to the number of bits used;
+    //         -1 if no code matches.
+    inline int decode(uint32_t bits, int &code_len) const {
+        uint16_t entry = m_lookup[bits >> (16 - lookahead_bits)];
+        if (entry != 0) {
+            code_len = entry >> 8;
+            return entry & 0xff;
+        }
+        for (int len = lookahead_bits + 1; len <= 16; len++) {
+            int code = (int)(bits >> (16 - len));
+            if (code <= m_maxcode[len]) {
+                code_len = len;
+                return m_huffval[m_valoffset[len] + code];
+            }
+        }
+        code_len = 0;
+        return -1;
+    }
+
+private:
+    // (code length << 8) | symbol, 0 means the code is longer than lookahead_bits
+    std::array<uint16_t, 1 << lookahead_bits> m_lookup;
+    std::array<int32_t, 17> m_maxcode;
+    std::array<int32_t, 17> m_valoffset;
+    std::array<uint8_t, 256> m_huffval;
+};
+
+// code of every symbol, for the encoder; built from the same tables as the decoder
+class huffman_encoder final {
+public:
+    huffman_encoder() {
+        m_code.fill(0);
+        m_size.fill(0);
+    }
+
+    // return: 0 on success, -1 if the table is not a valid canonical huffman table.
+    int build(const HuffmanTable &table) {
+        m_code.fill(0);
+        m_size.fill(0);
+
+        if (table.size() != 16) {
+            return -1;
+        }
+        // jpeg spec C.2: codes are assigned in order of length, then of symbol position
+        uint32_t code = 0;
+        for (int len = 1; len <= 16; len++) {
+            const HuffmanRow &row = table[len - 1];
+            if (row.num != (int)row.val_list.size()) {
+                return -1;
+            }
+            for (int i = 0; i < row.num; i++) {
+                m_code[row.val_list[i]] = code++;
+                m_size[row.val_list[i]] = (uint8_t)len;
+            }
+            // no all ones code, as in the decoder
+            if (code >= (1u << len)) {
+                return -1;
+            }
+            code <<= 1;
+        }
+        return 0;
+    }
+
+    uint32_t code(int symbol) const { return m_code[symbol]; }
+    // code length, 0 if the symbol has no code
+    int size(int symbol) const { return m_size[symbol]; }
+
+private:
+    std::array<uint32_t, 256> m_code;
+    std::array<uint8_t, 256> m_size;
+};
+
+    } // namespace jpeg
+} // namespace zzwlib
@@ -0,0 +1,1266 @@
+
+#include <math.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define IDCT_X86_SIMD 1
+#endif
+
+#include "idct.hpp"
+
+namespace zzwlib{
+    namespace jpeg {
+
+namespace {
+
+inline uint8_t clamp_u8(int val)
+{
+    return val < 0 ? 0 : (val > 255 ? 255 : val);
+}
+
+inline uint8_t clamp_u8(float val)
+{
+    val += 128.5f;
+    return val < 0.0f ? 0 : (val > 255.0f ? 255 : (uint8_t)val);
+}
+
+inline int16_t saturate_s16(int val)
+{
+    return val < -32768 ? -32768 : (val > 32767 ? 32767 : val);
+}
+
+// zigzag 0..9 are all in the top left 4x4 of the block
+inline int active_size(int last_nz)
+{
+    return last_nz <= 9 ? 4 : 8;
+}
+
+void fill_block(uint8_t val, uint8_t *out, int stride)
+{
+    for (int y = 0; y < 8; y++) {
+        memset(out + y * stride, val, 8);
+    }
+}
+
+//
+// separable float
+//
+struct cos_table {
+    // t[x][u] = c(u) / 2 * cos((2x + 1) * u * pi / 16), c(0) = 1 / sqrt(2), c(u) = 1
+    float t[8][8];
+
+    cos_table() {
+        for (int x = 0; x < 8; x++) {
+            for (int u = 0; u < 8; u++) {
+                double c = (u == 0) ? 1.0 / sqrt(2.0) : 1.0;
+                t[x][u] = (float)(c / 2.0 * cos((2 * x + 1) * u * M_PI / 16.0));
+            }
+        }
+    }
+};
+
+const cos_table g_cos;
+
+void idct_separable_float(const int16_t *coef, const idct_qtable &qt, int last_nz,
+                          uint8_t *out, int stride)
+{
+    int n = active_size(last_nz);
+    float tmp[8][8];
+
+    // row pass: tmp[v][x] = sum_u F[v][u] * t[x][u]
+    for (int v = 0; v < n; v++) {
+        float in[8];
+        for (int u = 0; u < n; u++) {
+            in[u] = coef[v * 8 + u] * (float)qt.q[v * 8 + u];
+        }
+        for (int x = 0; x < 8; x++) {
+            float sum = 0.0f;
+            for (int u = 0; u < n; u++) {
+                sum += in[u] * g_cos.t[x][u];
+            }
+            tmp[v][x] = sum;
+        }
+    }
+
+    // column pass: out[y][x] = sum_v t[y][v] * tmp[v][x]
+    for (int y = 0; y < 8; y++) {
+        for (int x = 0; x < 8; x++) {
+            float sum = 0.0f;
+            for (int v = 0; v < n; v++) {
+                sum += g_cos.t[y][v] * tmp[v][x];
+            }
+            out[y * stride + x] = clamp_u8(sum);
+        }
+    }
+}
+
+//
+// AAN float, as jidctflt
+//
+const float aan_scale[8] = {
+    1.0f, 1.387039845f, 1.306562965f, 1.175875602f,
+    1.0f, 0.785694958f, 0.541196100f, 0.275899379f
+};
+
+template <int step>
+inline void aan_1d(const float *in, float *out)
+{
+    // even part
+    float tmp10 = in[0 * step] + in[4 * step];
+    float tmp11 = in[0 * step] - in[4 * step];
+    float tmp13 = in[2 * step] + in[6 * step];
+    float tmp12 = (in[2 * step] - in[6 * step]) * 1.414213562f - tmp13;
+
+    float tmp0 = tmp10 + tmp13;
+    float tmp3 = tmp10 - tmp13;
+    float tmp1 = tmp11 + tmp12;
+    float tmp2 = tmp11 - tmp12;
+
+    // odd part
+    float z13 = in[5 * step] + in[3 * step];
+    float z10 = in[5 * step] - in[3 * step];
+    float z11 = in[1 * step] + in[7 * step];
+    float z12 = in[1 * step] - in[7 * step];
+
+    float tmp7 = z11 + z13;
+    tmp11 = (z11 - z13) * 1.414213562f;
+
+    float z5 = (z10 + z12) * 1.847759065f;
+    tmp10 = 1.082392200f * z12 - z5;
+    tmp12 = -2.613125930f * z10 + z5;
+
+    float tmp6 = tmp12 - tmp7;
+    float tmp5 = tmp11 - tmp6;
+    float tmp4 = tmp10 + tmp5;
+
+    out[0 * step] = tmp0 + tmp7;
+    out[7 * step] = tmp0 - tmp7;
+    out[1 * step] = tmp1 + tmp6;
+    out[6 * step] = tmp1 - tmp6;
+    out[2 * step] = tmp2 + tmp5;
+    out[5 * step] = tmp2 - tmp5;
+    out[4 * step] = tmp3 + tmp4;
+    out[3 * step] = tmp3 - tmp4;
+}
+
+void idct_fast_float(const int16_t *coef, const idct_qtable &qt, int last_nz,
+                     uint8_t *out, int stride)
+{
+    int n = active_size(last_nz);
+    float ws[64];
+
+    // column pass
+    for (int u = 0; u < 8; u++) {
+        if (u >= n) {
+            for (int v = 0; v < 8; v++) {
+                ws[v * 8 + u] = 0.0f;
+            }
+            continue;
+        }
+        float in[64];
+        bool ac_zero = true;
+        for (int v = 0; v < 8; v++) {
+            in[v * 8] = coef[v * 8 + u] * qt.fq[v * 8 + u];
+            if (v > 0 && coef[v * 8 + u] != 0) {
+                ac_zero = false;
+            }
+        }
+        if (ac_zero) {
+            for (int v = 0; v < 8; v++) {
+                ws[v * 8 + u] = in[0];
+            }
+            continue;
+        }
+        aan_1d<8>(in, ws + u);
+    }
+
+    // row pass
+    for (int y = 0; y < 8; y++) {
+        float row[8];
+        aan_1d<1>(ws + y * 8, row);
+        for (int x = 0; x < 8; x++) {
+            out[y * stride + x] = clamp_u8(row[x]);
+        }
+    }
+}
+
+//
+// 16-bit fixed point LLM, as jidctint.
+//
+// the products are written as sums of (input * constant) pairs, so the SIMD
+// kernels can use 16x16->32 multiply-add and give the same results.
+//
+constexpr int CONST_BITS = 12;
+constexpr int PASS1_BITS = 2;
+
+constexpr int fix(double x)
+{
+    return (int)(x * (1 << CONST_BITS) + 0.5);
+}
+
+constexpr int F_0_298631336 = fix(0.298631336);
+constexpr int F_0_390180644 = fix(0.390180644);
+constexpr int F_0_541196100 = fix(0.541196100);
+constexpr int F_0_765366865 = fix(0.765366865);
+constexpr int F_0_899976223 = fix(0.899976223);
+constexpr int F_1_175875602 = fix(1.175875602);
+constexpr int F_1_501321110 = fix(1.501321110);
+constexpr int F_1_847759065 = fix(1.847759065);
+constexpr int F_1_961570560 = fix(1.961570560);
+constexpr int F_2_053119869 = fix(2.053119869);
+constexpr int F_2_562915447 = fix(2.562915447);
+constexpr int F_3_072711026 = fix(3.072711026);
+
+// even part, pairs (s2, s6) and (s0, s4)
+constexpr int K_T2_S2 = F_0_541196100;
+constexpr int K_T2_S6 = F_0_541196100 - F_1_847759065;
+constexpr int K_T3_S2 = F_0_541196100 + F_0_765366865;
+constexpr int K_T3_S6 = F_0_541196100;
+
+// odd part, pairs (s7, s3) and (s5, s1)
+constexpr int K_O0_S7 = F_0_298631336 - F_0_899976223 - F_1_961570560 + F_1_175875602;
+constexpr int K_O0_S3 = F_1_175875602 - F_1_961570560;
+constexpr int K_O0_S5 = F_1_175875602;
+constexpr int K_O0_S1 = F_1_175875602 - F_0_899976223;
+
+constexpr int K_O1_S7 = F_1_175875602;
+constexpr int K_O1_S3 = F_1_175875602 - F_2_562915447;
+constexpr int K_O1_S5 = F_2_053119869 - F_2_562915447 - F_0_390180644 + F_1_175875602;
+constexpr int K_O1_S1 = F_1_175875602 - F_0_390180644;
+
+constexpr int K_O2_S7 = F_1_175875602 - F_1_961570560;
+constexpr int K_O2_S3 = F_3_072711026 - F_2_562915447 - F_1_961570560 + F_1_175875602;
+constexpr int K_O2_S5 = F_1_175875602 - F_2_562915447;
+constexpr int K_O2_S1 = F_1_175875602;
+
+constexpr int K_O3_S7 = F_1_175875602 - F_0_899976223;
+constexpr int K_O3_S3 = F_1_175875602;
+constexpr int K_O3_S5 = F_1_175875602 - F_0_390180644;
+constexpr int K_O3_S1 = F_1_501321110 - F_0_899976223 - F_0_390180644 + F_1_175875602;
+
+// pass 1 descale, pass 2 descale with the +128 level shift folded in
+constexpr int PASS1_SHIFT = CONST_BITS - PASS1_BITS;
+constexpr int PASS1_ROUND = 1 << (PASS1_SHIFT - 1);
+constexpr int PASS2_SHIFT = CONST_BITS + PASS1_BITS + 3;
+constexpr int PASS2_BIAS = (1 << (PASS2_SHIFT - 1)) + (128 << PASS2_SHIFT);
+
+// s: 8 inputs, o: 8 outputs before descale.
+// low: s4..s7 are known to be zero.
+template <bool low>
+inline void llm_1d(const int *s, int *o)
+{
+    int t0, t1, t2, t3;
+    int odd0, odd1, odd2, odd3;
+    if (low) {
+        t0 = s[0] * (1 << CONST_BITS);
+        t1 = t0;
+        t2 = s[2] * K_T2_S2;
+        t3 = s[2] * K_T3_S2;
+        odd0 = s[3] * K_O0_S3 + s[1] * K_O0_S1;
+        odd1 = s[3] * K_O1_S3 + s[1] * K_O1_S1;
+        odd2 = s[3] * K_O2_S3 + s[1] * K_O2_S1;
+        odd3 = s[3] * K_O3_S3 + s[1] * K_O3_S1;
+    } else {
+        t0 = (s[0] + s[4]) * (1 << CONST_BITS);
+        t1 = (s[0] - s[4]) * (1 << CONST_BITS);
+        t2 = s[2] * K_T2_S2 + s[6] * K_T2_S6;
+        t3 = s[2] * K_T3_S2 + s[6] * K_T3_S6;
+        odd0 = s[7] * K_O0_S7 + s[3] * K_O0_S3 + s[5] * K_O0_S5 + s[1] * K_O0_S1;
+        odd1 = s[7] * K_O1_S7 + s[3] * K_O1_S3 + s[5] * K_O1_S5 + s[1] * K_O1_S1;
+        odd2 = s[7] * K_O2_S7 + s[3] * K_O2_S3 + s[5] * K_O2_S5 + s[1] * K_O2_S1;
+        odd3 = s[7] * K_O3_S7 + s[3] * K_O3_S3 + s[5] * K_O3_S5 + s[1] * K_O3_S1;
+    }
+
+    int e0 = t0 + t3;
+    int e3 = t0 - t3;
+    int e1 = t1 + t2;
+    int e2 = t1 - t2;
+
+    o[0] = e0 + odd3;
+    o[7] = e0 - odd3;
+    o[1] = e1 + odd2;
+    o[6] = e1 - odd2;
+    o[2] = e2 + odd1;
+    o[5] = e2 - odd1;
+    o[3] = e3 + odd0;
+    o[4] = e3 - odd0;
+}
+
+template <bool low>
+void idct_fast_int_impl(const int16_t *coef, const idct_qtable &qt, uint8_t *out, int stride)
+{
+    constexpr int n = low ? 4 : 8;
+    int16_t ws[64];
+
+    // column pass, dequantize on load
+    for (int u = 0; u < 8; u++) {
+        if (u >= n) {
+            for (int v = 0; v < 8; v++) {
+                ws[v * 8 + u] = 0;
+            }
+            continue;
+        }
+        int s[8] = {0};
+        bool ac_zero = true;
+        for (int v = 0; v < n; v++) {
+            s[v] = (int16_t)(coef[v * 8 + u] * qt.q[v * 8 + u]);
+            if (v > 0 && s[v] != 0) {
+                ac_zero = false;
+            }
+        }
+        if (ac_zero) {
+            int16_t dc = saturate_s16(s[0] * (1 << PASS1_BITS));
+            for (int v = 0; v < 8; v++) {
+                ws[v * 8 + u] = dc;
+            }
+            continue;
+        }
+        int o[8];
+        llm_1d<low>(s, o);
+        for (int v = 0; v < 8; v++) {
+            ws[v * 8 + u] = saturate_s16((o[v] + PASS1_ROUND) >> PASS1_SHIFT);
+        }
+    }
+
+    // row pass
+    for (int y = 0; y < 8; y++) {
+        const int16_t *row = ws + y * 8;
+        uint8_t *dst = out + y * stride;
+        int s[8];
+        bool ac_zero = true;
+        for (int x = 0; x < 8; x++) {
+            s[x] = row[x];
+            if (x > 0 && s[x] != 0) {
+                ac_zero = false;
+            }
+        }
+        if (ac_zero) {
+            memset(dst, clamp_u8((s[0] * (1 << CONST_BITS) + PASS2_BIAS) >> PASS2_SHIFT), 8);
+            continue;
+        }
+        int o[8];
+        llm_1d<low>(s, o);
+        for (int x = 0; x < 8; x++) {
+            dst[x] = clamp_u8((o[x] + PASS2_BIAS) >> PASS2_SHIFT);
+        }
+    }
+}
+
+void idct_fast_int(const int16_t *coef, const idct_qtable &qt, int last_nz,
+                   uint8_t *out, int stride)
+{
+    if (last_nz == 0) {
+        // same arithmetic as the full transform with only s0 set
+        int16_t dc = saturate_s16((int16_t)(coef[0] * qt.q[0]) * (1 << PASS1_BITS));
+        fill_block(clamp_u8((dc * (1 << CONST_BITS) + PASS2_BIAS) >> PASS2_SHIFT), out, stride);
+    } else if (last_nz <= 9) {
+        idct_fast_int_impl<true>(coef, qt, out, stride);
+    } else {
+        idct_fast_int_impl<false>(coef, qt, out, stride);
+    }
+}
+
+//
+// reduced size idct for scaled decoding, n = 4, 2, 1 output samples per side.
+// t[x][u] is the 8 point basis c(u) / 2 * cos((2i + 1) * u * pi / 16) averaged over the
+// 8 / n samples i output x covers, so the n x n result is the 8x8 idct box filtered
+// down, computed straight from the coefficients. the averaged basis folds the high
+// frequencies onto the low ones instead of dropping them (u = 4 cancels out for n = 4).
+//
+template <int N>
+struct scaled_cos_table {
+    int t[N][8];
+
+    scaled_cos_table() {
+        constexpr int span = 8 / N;
+        for (int x = 0; x < N; x++) {
+            for (int u = 0; u < 8; u++) {
+                double c = (u == 0) ? 1.0 / sqrt(2.0) : 1.0;
+                double sum = 0.0;
+                for (int i = x * span; i < (x + 1) * span; i++) {
+                    sum += c / 2.0 * cos((2 * i + 1) * u * M_PI / 16.0);
+                }
+                t[x][u] = (int)lround(sum / span * (1 << CONST_BITS));
+            }
+        }
+    }
+};
+
+constexpr int SCALED_PASS2_SHIFT = CONST_BITS + PASS1_BITS;
+constexpr int SCALED_PASS2_BIAS = (1 << (SCALED_PASS2_SHIFT - 1)) + (128 << SCALED_PASS2_SHIFT);
+
+template <int N>
+void idct_scaled(const int16_t *coef, const idct_qtable &qt, int last_nz, uint8_t *out, int stride)
+{
+    static const scaled_cos_table<N> table;
+
+    if (last_nz == 0) {
+        // same arithmetic as the full transform with only F[0][0] set
+        int ws = ((int16_t)(coef[0] * qt.q[0]) * table.t[0][0] + PASS1_ROUND) >> PASS1_SHIFT;
+        uint8_t fill = clamp_u8((int)(((int64_t)ws * table.t[0][0] + SCALED_PASS2_BIAS) >> SCALED_PASS2_SHIFT));
+        for (int y = 0; y < N; y++) {
+            memset(out + y * stride, fill, N);
+        }
+        return;
+    }
+
+    // row pass over the rows which may have non zero coefficients:
+    // ws[v][x] = sum_u F[v][u] * t[x][u], dequantized with 16-bit wrap as fast_int
+    int n = active_size(last_nz);
+    int ws[8][N];
+    for (int v = 0; v < n; v++) {
+        int in[8];
+        for (int u = 0; u < n; u++) {
+            in[u] = (int16_t)(coef[v * 8 + u] * qt.q[v * 8 + u]);
+        }
+        for (int x = 0; x < N; x++) {
+            int sum = 0;
+            for (int u = 0; u < n; u++) {
+                sum += in[u] * table.t[x][u];
+            }
+            ws[v][x] = (sum + PASS1_ROUND) >> PASS1_SHIFT;
+        }
+    }
+    // column pass
+    for (int y = 0; y < N; y++) {
+        uint8_t *dst = out + y * stride;
+        for (int x = 0; x < N; x++) {
+            int64_t sum = 0;
+            for (int v = 0; v < n; v++) {
+                sum += (int64_t)ws[v][x] * table.t[y][v];
+            }
+            dst[x] = clamp_u8((int)((sum + SCALED_PASS2_BIAS) >> SCALED_PASS2_SHIFT));
+        }
+    }
+}
+
+//
+// forward transform, 16-bit fixed point LLM as jfdctint with the constants above.
+// o: 8 outputs of the odd part before descale, in the order 1, 3, 5, 7
+//
+inline void fdct_odd(int tmp4, int tmp5, int tmp6, int tmp7, int *o)
+{
+    int z1 = tmp4 + tmp7;
+    int z2 = tmp5 + tmp6;
+    int z3 = tmp4 + tmp6;
+    int z4 = tmp5 + tmp7;
+    int z5 = (z3 + z4) * F_1_175875602;
+
+    tmp4 *= F_0_298631336;
+    tmp5 *= F_2_053119869;
+    tmp6 *= F_3_072711026;
+    tmp7 *= F_1_501321110;
+    z1 *= -F_0_899976223;
+    z2 *= -F_2_562915447;
+    z3 = z3 * -F_1_961570560 + z5;
+    z4 = z4 * -F_0_390180644 + z5;
+
+    o[0] = tmp7 + z1 + z4;
+    o[1] = tmp6 + z2 + z3;
+    o[2] = tmp5 + z2 + z4;
+    o[3] = tmp4 + z1 + z3;
+}
+
+// fdct_odd as pair products, for the SIMD kernels: output k (1, 3, 5, 7) is
+// tmp4 * K_Fk_T4 + tmp5 * K_Fk_T5 + tmp6 * K_Fk_T6 + tmp7 * K_Fk_T7
+constexpr int K_F1_T4 = F_1_175875602 - F_0_899976223;
+constexpr int K_F1_T5 = F_1_175875602 - F_0_390180644;
+constexpr int K_F1_T6 = F_1_175875602;
+constexpr int K_F1_T7 = F_1_501321110 - F_0_899976223 - F_0_390180644 + F_1_175875602;
+
+constexpr int K_F3_T4 = F_1_175875602 - F_1_961570560;
+constexpr int K_F3_T5 = F_1_175875602 - F_2_562915447;
+constexpr int K_F3_T6 = F_3_072711026 - F_2_562915447 - F_1_961570560 + F_1_175875602;
+constexpr int K_F3_T7 = F_1_175875602;
+
+constexpr int K_F5_T4 = F_1_175875602;
+constexpr int K_F5_T5 = F_2_053119869 - F_2_562915447 - F_0_390180644 + F_1_175875602;
+constexpr int K_F5_T6 = F_1_175875602 - F_2_562915447;
+constexpr int K_F5_T7 = F_1_175875602 - F_0_390180644;
+
+constexpr int K_F7_T4 = F_0_298631336 - F_0_899976223 - F_1_961570560 + F_1_175875602;
+constexpr int K_F7_T5 = F_1_175875602;
+constexpr int K_F7_T6 = F_1_175875602 - F_1_961570560;
+constexpr int K_F7_T7 = F_1_175875602 - F_0_899976223;
+
+void fdct_fast_int(const uint8_t *in, int stride, int16_t *out)
+{
+    int ws[64];
+
+    // row pass, level shift folded into the DC, outputs scaled up by 2^PASS1_BITS
+    for (int y = 0; y < 8; y++) {
+        const uint8_t *d = in + y * stride;
+        int *w = ws + y * 8;
+        int tmp0 = d[0] + d[7];
+        int tmp7 = d[0] - d[7];
+        int tmp1 = d[1] + d[6];
+        int tmp6 = d[1] - d[6];
+        int tmp2 = d[2] + d[5];
+        int tmp5 = d[2] - d[5];
+        int tmp3 = d[3] + d[4];
+        int tmp4 = d[3] - d[4];
+
+        int tmp10 = tmp0 + tmp3;
+        int tmp13 = tmp0 - tmp3;
+        int tmp11 = tmp1 + tmp2;
+        int tmp12 = tmp1 - tmp2;
+
+        w[0] = (tmp10 + tmp11 - 8 * 128) * (1 << PASS1_BITS);
+        w[4] = (tmp10 - tmp11) * (1 << PASS1_BITS);
+        int z1 = (tmp12 + tmp13) * F_0_541196100;
+        w[2] = (z1 + tmp13 * F_0_765366865 + PASS1_ROUND) >> PASS1_SHIFT;
+        w[6] = (z1 - tmp12 * F_1_847759065 + PASS1_ROUND) >> PASS1_SHIFT;
+
+        int o[4];
+        fdct_odd(tmp4, tmp5, tmp6, tmp7, o);
+        w[1] = (o[0] + PASS1_ROUND) >> PASS1_SHIFT;
+        w[3] = (o[1] + PASS1_ROUND) >> PASS1_SHIFT;
+        w[5] = (o[2] + PASS1_ROUND) >> PASS1_SHIFT;
+        w[7] = (o[3] + PASS1_ROUND) >> PASS1_SHIFT;
+    }
+
+    // column pass, outputs are 8x the DCT coefficients
+    constexpr int shift = CONST_BITS + PASS1_BITS;
+    constexpr int round = 1 << (shift - 1);
+    for (int x = 0; x < 8; x++) {
+        const int *w = ws + x;
+        int tmp0 = w[0] + w[56];
+        int tmp7 = w[0] - w[56];
+        int tmp1 = w[8] + w[48];
+        int tmp6 = w[8] - w[48];
+        int tmp2 = w[16] + w[40];
+        int tmp5 = w[16] - w[40];
+        int tmp3 = w[24] + w[32];
+        int tmp4 = w[24] - w[32];
+
+        int tmp10 = tmp0 + tmp3;
+        int tmp13 = tmp0 - tmp3;
+        int tmp11 = tmp1 + tmp2;
+        int tmp12 = tmp1 - tmp2;
+
+        out[x] = (int16_t)((tmp10 + tmp11 + (1 << (PASS1_BITS - 1))) >> PASS1_BITS);
+        out[32 + x] = (int16_t)((tmp10 - tmp11 + (1 << (PASS1_BITS - 1))) >> PASS1_BITS);
+        int z1 = (tmp12 + tmp13) * F_0_541196100;
+        out[16 + x] = (int16_t)((z1 + tmp13 * F_0_765366865 + round) >> shift);
+        out[48 + x] = (int16_t)((z1 - tmp12 * F_1_847759065 + round) >> shift);
+
+        int o[4];
+        fdct_odd(tmp4, tmp5, tmp6, tmp7, o);
+        out[8 + x] = (int16_t)((o[0] + round) >> shift);
+        out[24 + x] = (int16_t)((o[1] + round) >> shift);
+        out[40 + x] = (int16_t)((o[2] + round) >> shift);
+        out[56 + x] = (int16_t)((o[3] + round) >> shift);
+    }
+}
+
+//
+// per block kernels
+//
+
+// zigzag index -> natural index
+const uint8_t zigzag_to_natural[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10,
+    17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34,
+    27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36,
+    29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46,
+    53, 60, 61, 54, 47, 55, 62, 63
+};
+
+void dezigzag_scalar(const int16_t *zz, int16_t *natural)
+{
+    for (int i = 0; i < 64; i++) {
+        natural[zigzag_to_natural[i]] = zz[i];
+    }
+}
+
+void dequant_scalar(int16_t *coef, const int16_t *q)
+{
+    for (int i = 0; i < 64; i++) {
+        coef[i] = (int16_t)(coef[i] * q[i]);
+    }
+}
+
+void idct_int_scalar(const int16_t *coef, const int16_t *q, uint8_t *out, int stride)
+{
+    idct_qtable qt;
+    memcpy(qt.q, q, sizeof(qt.q));
+    idct_fast_int_impl<false>(coef, qt, out, stride);
+}
+
+uint64_t quantize_scalar(const int16_t *coef, const fdct_divisors &div, int16_t *zz)
+{
+    uint64_t nonzero = 0;
+    for (int k = 0; k < 64; k++) {
+        int i = zigzag_to_natural[k];
+        int c = coef[i];
+        uint32_t t = (uint32_t)(c < 0 ? -c : c) + div.corr[i];
+        t = ((t * div.recip[i]) >> 16) * div.scale[i] >> 16;
+        zz[k] = (int16_t)(c < 0 ? -(int)t : (int)t);
+        nonzero |= (uint64_t)(t != 0) << k;
+    }
+    return nonzero;
+}
+
+#ifdef IDCT_X86_SIMD
+
+#define SSE2_TARGET __attribute__((target("sse2")))
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+// (c0, c1) in every 32-bit lane, madd with interleaved (a, b) gives a * c0 + b * c1
+inline SSE2_TARGET __m128i pair_const(int c0, int c1)
+{
+    return _mm_set1_epi32((int)(((uint32_t)(uint16_t)c1 << 16) | (uint16_t)c0));
+}
+
+inline SSE2_TARGET void transpose_8x8_sse2(__m128i *r)
+{
+    __m128i t0 = _mm_unpacklo_epi16(r[0], r[1]);
+    __m128i t1 = _mm_unpackhi_epi16(r[0], r[1]);
+    __m128i t2 = _mm_unpacklo_epi16(r[2], r[3]);
+    __m128i t3 = _mm_unpackhi_epi16(r[2], r[3]);
+    __m128i t4 = _mm_unpacklo_epi16(r[4], r[5]);
+    __m128i t5 = _mm_unpackhi_epi16(r[4], r[5]);
+    __m128i t6 = _mm_unpacklo_epi16(r[6], r[7]);
+    __m128i t7 = _mm_unpackhi_epi16(r[6], r[7]);
+
+    __m128i u0 = _mm_unpacklo_epi32(t0, t2);
+    __m128i u1 = _mm_unpackhi_epi32(t0, t2);
+    __m128i u2 = _mm_unpacklo_epi32(t1, t3);
+    __m128i u3 = _mm_unpackhi_epi32(t1, t3);
+    __m128i u4 = _mm_unpacklo_epi32(t4, t6);
+    __m128i u5 = _mm_unpackhi_epi32(t4, t6);
+    __m128i u6 = _mm_unpacklo_epi32(t5, t7);
+    __m128i u7 = _mm_unpackhi_epi32(t5, t7);
+
+    r[0] = _mm_unpacklo_epi64(u0, u4);
+    r[1] = _mm_unpackhi_epi64(u0, u4);
+    r[2] = _mm_unpacklo_epi64(u1, u5);
+    r[3] = _mm_unpackhi_epi64(u1, u5);
+    r[4] = _mm_unpacklo_epi64(u2, u6);
+    r[5] = _mm_unpackhi_epi64(u2, u6);
+    r[6] = _mm_unpacklo_epi64(u3, u7);
+    r[7] = _mm_unpackhi_epi64(u3, u7);
+}
+
+// packed uint8 rows of 8 registers of int16 rows
+inline SSE2_TARGET void store_rows_sse2(const __m128i *r, uint8_t *out, int stride)
+{
+    for (int y = 0; y < 8; y += 2) {
+        __m128i rows = _mm_packus_epi16(r[y], r[y + 1]);
+        _mm_storel_epi64((__m128i *)(out + y * stride), rows);
+        _mm_storel_epi64((__m128i *)(out + (y + 1) * stride), _mm_unpackhi_epi64(rows, rows));
+    }
+}
+
+//
+// SSE2: lanes are the 8 columns, every pair product is split in low / high halves
+//
+struct sse2_pair {
+    __m128i lo;
+    __m128i hi;
+};
+
+inline SSE2_TARGET sse2_pair madd_sse2(__m128i a, __m128i b, int c0, int c1)
+{
+    __m128i k = pair_const(c0, c1);
+    return { _mm_madd_epi16(_mm_unpacklo_epi16(a, b), k),
+             _mm_madd_epi16(_mm_unpackhi_epi16(a, b), k) };
+}
+
+inline SSE2_TARGET sse2_pair add_sse2(sse2_pair a, sse2_pair b)
+{
+    return { _mm_add_epi32(a.lo, b.lo), _mm_add_epi32(a.hi, b.hi) };
+}
+
+inline SSE2_TARGET sse2_pair sub_sse2(sse2_pair a, sse2_pair b)
+{
+    return { _mm_sub_epi32(a.lo, b.lo), _mm_sub_epi32(a.hi, b.hi) };
+}
+
+template <int shift>
+inline SSE2_TARGET __m128i descale_sse2(sse2_pair a)
+{
+    return _mm_packs_epi32(_mm_srai_epi32(a.lo, shift), _mm_srai_epi32(a.hi, shift));
+}
+
+// one llm pass over 8 registers, r[k] holds input k of all 8 columns
+template <int bias, int shift>
+inline SSE2_TARGET void llm_pass_sse2(__m128i *r)
+{
+    __m128i vbias = _mm_set1_epi32(bias);
+
+    sse2_pair t0 = madd_sse2(r[0], r[4], 1 << CONST_BITS, 1 << CONST_BITS);
+    sse2_pair t1 = madd_sse2(r[0], r[4], 1 << CONST_BITS, -(1 << CONST_BITS));
+    t0 = { _mm_add_epi32(t0.lo, vbias), _mm_add_epi32(t0.hi, vbias) };
+    t1 = { _mm_add_epi32(t1.lo, vbias), _mm_add_epi32(t1.hi, vbias) };
+    sse2_pair t2 = madd_sse2(r[2], r[6], K_T2_S2, K_T2_S6);
+    sse2_pair t3 = madd_sse2(r[2], r[6], K_T3_S2, K_T3_S6);
+
+    sse2_pair e0 = add_sse2(t0, t3);
+    sse2_pair e3 = sub_sse2(t0, t3);
+    sse2_pair e1 = add_sse2(t1, t2);
+    sse2_pair e2 = sub_sse2(t1, t2);
+
+    sse2_pair odd0 = add_sse2(madd_sse2(r[7], r[3], K_O0_S7, K_O0_S3), madd_sse2(r[5], r[1], K_O0_S5, K_O0_S1));
+    sse2_pair odd1 = add_sse2(madd_sse2(r[7], r[3], K_O1_S7, K_O1_S3), madd_sse2(r[5], r[1], K_O1_S5, K_O1_S1));
+    sse2_pair odd2 = add_sse2(madd_sse2(r[7], r[3], K_O2_S7, K_O2_S3), madd_sse2(r[5], r[1], K_O2_S5, K_O2_S1));
+    sse2_pair odd3 = add_sse2(madd_sse2(r[7], r[3], K_O3_S7, K_O3_S3), madd_sse2(r[5], r[1], K_O3_S5, K_O3_S1));
+
+    r[0] = descale_sse2<shift>(add_sse2(e0, odd3));
+    r[7] = descale_sse2<shift>(sub_sse2(e0, odd3));
+    r[1] = descale_sse2<shift>(add_sse2(e1, odd2));
+    r[6] = descale_sse2<shift>(sub_sse2(e1, odd2));
+    r[2] = descale_sse2<shift>(add_sse2(e2, odd1));
+    r[5] = descale_sse2<shift>(sub_sse2(e2, odd1));
+    r[3] = descale_sse2<shift>(add_sse2(e3, odd0));
+    r[4] = descale_sse2<shift>(sub_sse2(e3, odd0));
+}
+
+SSE2_TARGET void dequant_sse2(int16_t *coef, const int16_t *q)
+{
+    for (int i = 0; i < 64; i += 8) {
+        __m128i c = _mm_loadu_si128((const __m128i *)(coef + i));
+        __m128i k = _mm_loadu_si128((const __m128i *)(q + i));
+        _mm_storeu_si128((__m128i *)(coef + i), _mm_mullo_epi16(c, k));
+    }
+}
+
+SSE2_TARGET void idct_int_sse2(const int16_t *coef, const int16_t *q, uint8_t *out, int stride)
+{
+    __m128i r[8];
+    for (int i = 0; i < 8; i++) {
+        r[i] = _mm_mullo_epi16(_mm_loadu_si128((const __m128i *)(coef + i * 8)),
+                               _mm_loadu_si128((const __m128i *)(q + i * 8)));
+    }
+    // columns, then rows on the transposed block
+    llm_pass_sse2<PASS1_ROUND, PASS1_SHIFT>(r);
+    transpose_8x8_sse2(r);
+    llm_pass_sse2<PASS2_BIAS, PASS2_SHIFT>(r);
+    transpose_8x8_sse2(r);
+    store_rows_sse2(r, out, stride);
+}
+
+// one fdct pass (as fdct_fast_int), r[k] holds input k of all 8 lanes.
+// first: the row pass with the level shift, else the column pass.
+template <bool first>
+inline SSE2_TARGET void fdct_pass_sse2(__m128i *r)
+{
+    constexpr int shift = first ? PASS1_SHIFT : CONST_BITS + PASS1_BITS;
+    __m128i round = _mm_set1_epi32(1 << (shift - 1));
+    sse2_pair vround = { round, round };
+
+    __m128i tmp0 = _mm_add_epi16(r[0], r[7]);
+    __m128i tmp7 = _mm_sub_epi16(r[0], r[7]);
+    __m128i tmp1 = _mm_add_epi16(r[1], r[6]);
+    __m128i tmp6 = _mm_sub_epi16(r[1], r[6]);
+    __m128i tmp2 = _mm_add_epi16(r[2], r[5]);
+    __m128i tmp5 = _mm_sub_epi16(r[2], r[5]);
+    __m128i tmp3 = _mm_add_epi16(r[3], r[4]);
+    __m128i tmp4 = _mm_sub_epi16(r[3], r[4]);
+
+    __m128i tmp10 = _mm_add_epi16(tmp0, tmp3);
+    __m128i tmp13 = _mm_sub_epi16(tmp0, tmp3);
+    __m128i tmp11 = _mm_add_epi16(tmp1, tmp2);
+    __m128i tmp12 = _mm_sub_epi16(tmp1, tmp2);
+
+    if (first) {
+        __m128i dc = _mm_sub_epi16(_mm_add_epi16(tmp10, tmp11), _mm_set1_epi16(8 * 128));
+        r[0] = _mm_slli_epi16(dc, PASS1_BITS);
+        r[4] = _mm_slli_epi16(_mm_sub_epi16(tmp10, tmp11), PASS1_BITS);
+    } else {
+        __m128i half = _mm_set1_epi16(1 << (PASS1_BITS - 1));
+        r[0] = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(tmp10, tmp11), half), PASS1_BITS);
+        r[4] = _mm_srai_epi16(_mm_add_epi16(_mm_sub_epi16(tmp10, tmp11), half), PASS1_BITS);
+    }
+    r[2] = descale_sse2<shift>(add_sse2(madd_sse2(tmp12, tmp13, K_T2_S2, K_T3_S2), vround));
+    r[6] = descale_sse2<shift>(add_sse2(madd_sse2(tmp12, tmp13, K_T2_S6, K_T3_S6), vround));
+
+    r[1] = descale_sse2<shift>(add_sse2(add_sse2(madd_sse2(tmp4, tmp5, K_F1_T4, K_F1_T5),
+                                                 madd_sse2(tmp6, tmp7, K_F1_T6, K_F1_T7)), vround));
+    r[3] = descale_sse2<shift>(add_sse2(add_sse2(madd_sse2(tmp4, tmp5, K_F3_T4, K_F3_T5),
+                                                 madd_sse2(tmp6, tmp7, K_F3_T6, K_F3_T7)), vround));
+    r[5] = descale_sse2<shift>(add_sse2(add_sse2(madd_sse2(tmp4, tmp5, K_F5_T4, K_F5_T5),
+                                                 madd_sse2(tmp6, tmp7, K_F5_T6, K_F5_T7)), vround));
+    r[7] = descale_sse2<shift>(add_sse2(add_sse2(madd_sse2(tmp4, tmp5, K_F7_T4, K_F7_T5),
+                                                 madd_sse2(tmp6, tmp7, K_F7_T6, K_F7_T7)), vround));
+}
+
+// 8 rows of samples as int16
+inline SSE2_TARGET void load_rows_sse2(const uint8_t *in, int stride, __m128i *r)
+{
+    __m128i zero = _mm_setzero_si128();
+    for (int y = 0; y < 8; y++) {
+        r[y] = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(in + y * stride)), zero);
+    }
+}
+
+SSE2_TARGET void fdct_int_sse2(const uint8_t *in, int stride, int16_t *out)
+{
+    __m128i r[8];
+    load_rows_sse2(in, stride, r);
+    // rows (lanes are the rows after the transpose), then columns
+    transpose_8x8_sse2(r);
+    fdct_pass_sse2<true>(r);
+    transpose_8x8_sse2(r);
+    fdct_pass_sse2<false>(r);
+    for (int i = 0; i < 8; i++) {
+        _mm_storeu_si128((__m128i *)(out + i * 8), r[i]);
+    }
+}
+
+// quantization of 8 coefficients, see fdct_divisors
+inline SSE2_TARGET __m128i quantize_row_sse2(__m128i c, const fdct_divisors &div, int i)
+{
+    __m128i sign = _mm_srai_epi16(c, 15);
+    __m128i t = _mm_sub_epi16(_mm_xor_si128(c, sign), sign);
+    t = _mm_add_epi16(t, _mm_loadu_si128((const __m128i *)(div.corr + i)));
+    t = _mm_mulhi_epu16(t, _mm_loadu_si128((const __m128i *)(div.recip + i)));
+    t = _mm_mulhi_epu16(t, _mm_loadu_si128((const __m128i *)(div.scale + i)));
+    return _mm_sub_epi16(_mm_xor_si128(t, sign), sign);
+}
+
+// bit k set if coefficient k of the 8 registers is non zero
+inline SSE2_TARGET uint64_t nonzero_mask_sse2(const __m128i *r)
+{
+    __m128i zero = _mm_setzero_si128();
+    uint64_t mask = 0;
+    for (int i = 0; i < 4; i++) {
+        __m128i bytes = _mm_packs_epi16(r[2 * i], r[2 * i + 1]);
+        uint32_t zeros = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, zero));
+        mask |= (uint64_t)(~zeros & 0xFFFF) << (16 * i);
+    }
+    return mask;
+}
+
+SSE2_TARGET uint64_t quantize_sse2(const int16_t *coef, const fdct_divisors &div, int16_t *zz)
+{
+    // no pshufb in SSE2: quantize in natural order, then the zigzag gather is scalar
+    alignas(16) int16_t q[64];
+    for (int i = 0; i < 64; i += 8) {
+        __m128i c = _mm_loadu_si128((const __m128i *)(coef + i));
+        _mm_store_si128((__m128i *)(q + i), quantize_row_sse2(c, div, i));
+    }
+    __m128i r[8];
+    for (int k = 0; k < 64; k++) {
+        zz[k] = q[zigzag_to_natural[k]];
+    }
+    for (int j = 0; j < 8; j++) {
+        r[j] = _mm_loadu_si128((const __m128i *)(zz + j * 8));
+    }
+    return nonzero_mask_sse2(r);
+}
+
+//
+// AVX2: the interleaved pairs of all 8 columns fit one register, the 32-bit
+// math runs on 8 lanes at once
+//
+inline AVX2_TARGET __m256i madd_avx2(__m128i a, __m128i b, int c0, int c1)
+{
+    __m256i ab = _mm256_set_m128i(_mm_unpackhi_epi16(a, b), _mm_unpacklo_epi16(a, b));
+    return _mm256_madd_epi16(ab, _mm256_set1_epi32((int)(((uint32_t)(uint16_t)c1 << 16) | (uint16_t)c0)));
+}
+
+template <int shift>
+inline AVX2_TARGET __m128i descale_avx2(__m256i a)
+{
+    a = _mm256_srai_epi32(a, shift);
+    return _mm_packs_epi32(_mm256_castsi256_si128(a), _mm256_extracti128_si256(a, 1));
+}
+
+template <int bias, int shift>
+inline AVX2_TARGET void llm_pass_avx2(__m128i *r)
+{
+    __m256i vbias = _mm256_set1_epi32(bias);
+
+    __m256i t0 = _mm256_add_epi32(madd_avx2(r[0], r[4], 1 << CONST_BITS, 1 << CONST_BITS), vbias);
+    __m256i t1 = _mm256_add_epi32(madd_avx2(r[0], r[4], 1 << CONST_BITS, -(1 << CONST_BITS)), vbias);
+    __m256i t2 = madd_avx2(r[2], r[6], K_T2_S2, K_T2_S6);
+    __m256i t3 = madd_avx2(r[2], r[6], K_T3_S2, K_T3_S6);
+
+    __m256i e0 = _mm256_add_epi32(t0, t3);
+    __m256i e3 = _mm256_sub_epi32(t0, t3);
+    __m256i e1 = _mm256_add_epi32(t1, t2);
+    __m256i e2 = _mm256_sub_epi32(t1, t2);
+
+    __m256i odd0 = _mm256_add_epi32(madd_avx2(r[7], r[3], K_O0_S7, K_O0_S3), madd_avx2(r[5], r[1], K_O0_S5, K_O0_S1));
+    __m256i odd1 = _mm256_add_epi32(madd_avx2(r[7], r[3], K_O1_S7, K_O1_S3), madd_avx2(r[5], r[1], K_O1_S5, K_O1_S1));
+    __m256i odd2 = _mm256_add_epi32(madd_avx2(r[7], r[3], K_O2_S7, K_O2_S3), madd_avx2(r[5], r[1], K_O2_S5, K_O2_S1));
+    __m256i odd3 = _mm256_add_epi32(madd_avx2(r[7], r[3], K_O3_S7, K_O3_S3), madd_avx2(r[5], r[1], K_O3_S5, K_O3_S1));
+
+    r[0] = descale_avx2<shift>(_mm256_add_epi32(e0, odd3));
+    r[7] = descale_avx2<shift>(_mm256_sub_epi32(e0, odd3));
+    r[1] = descale_avx2<shift>(_mm256_add_epi32(e1, odd2));
+    r[6] = descale_avx2<shift>(_mm256_sub_epi32(e1, odd2));
+    r[2] = descale_avx2<shift>(_mm256_add_epi32(e2, odd1));
+    r[5] = descale_avx2<shift>(_mm256_sub_epi32(e2, odd1));
+    r[3] = descale_avx2<shift>(_mm256_add_epi32(e3, odd0));
+    r[4] = descale_avx2<shift>(_mm256_sub_epi32(e3, odd0));
+}
+
+// pshufb masks for a permutation of 64 int16: output row r gathers its 8 values
+// from the input registers in src[r]. source[i]: input index of output i.
+struct shuffle_masks {
+    uint8_t mask[8][8][16];
+    int src[8][8];
+    int nsrc[8];
+
+    explicit shuffle_masks(const uint8_t *source) {
+        for (int r = 0; r < 8; r++) {
+            nsrc[r] = 0;
+            for (int j = 0; j < 8; j++) {
+                bool used = false;
+                for (int x = 0; x < 8; x++) {
+                    int k = source[r * 8 + x];
+                    bool hit = (k / 8 == j);
+                    mask[r][nsrc[r]][2 * x] = hit ? 2 * (k % 8) : 0x80;
+                    mask[r][nsrc[r]][2 * x + 1] = hit ? 2 * (k % 8) + 1 : 0x80;
+                    used = used || hit;
+                }
+                if (used) {
+                    src[r][nsrc[r]++] = j;
+                }
+            }
+        }
+    }
+};
+
+struct zigzag_orders {
+    uint8_t natural_to_zigzag[64];
+    zigzag_orders() {
+        for (int i = 0; i < 64; i++) {
+            natural_to_zigzag[zigzag_to_natural[i]] = (uint8_t)i;
+        }
+    }
+};
+
+inline AVX2_TARGET void shuffle_avx2(const shuffle_masks &masks, const __m128i *in, __m128i *out)
+{
+    for (int r = 0; r < 8; r++) {
+        __m128i row = _mm_setzero_si128();
+        for (int i = 0; i < masks.nsrc[r]; i++) {
+            __m128i m = _mm_loadu_si128((const __m128i *)masks.mask[r][i]);
+            row = _mm_or_si128(row, _mm_shuffle_epi8(in[masks.src[r][i]], m));
+        }
+        out[r] = row;
+    }
+}
+
+AVX2_TARGET void dezigzag_avx2(const int16_t *zz, int16_t *natural)
+{
+    static const zigzag_orders orders;
+    static const shuffle_masks masks(orders.natural_to_zigzag);
+    __m128i in[8];
+    __m128i out[8];
+    for (int j = 0; j < 8; j++) {
+        in[j] = _mm_loadu_si128((const __m128i *)(zz + j * 8));
+    }
+    shuffle_avx2(masks, in, out);
+    for (int r = 0; r < 8; r++) {
+        _mm_storeu_si128((__m128i *)(natural + r * 8), out[r]);
+    }
+}
+
+AVX2_TARGET void dequant_avx2(int16_t *coef, const int16_t *q)
+{
+    for (int i = 0; i < 64; i += 16) {
+        __m256i c = _mm256_loadu_si256((const __m256i *)(coef + i));
+        __m256i k = _mm256_loadu_si256((const __m256i *)(q + i));
+        _mm256_storeu_si256((__m256i *)(coef + i), _mm256_mullo_epi16(c, k));
+    }
+}
+
+AVX2_TARGET void idct_int_avx2(const int16_t *coef, const int16_t *q, uint8_t *out, int stride)
+{
+    __m128i r[8];
+    for (int i = 0; i < 8; i += 2) {
+        __m256i c = _mm256_mullo_epi16(_mm256_loadu_si256((const __m256i *)(coef + i * 8)),
+                                       _mm256_loadu_si256((const __m256i *)(q + i * 8)));
+        r[i] = _mm256_castsi256_si128(c);
+        r[i + 1] = _mm256_extracti128_si256(c, 1);
+    }
+    llm_pass_avx2<PASS1_ROUND, PASS1_SHIFT>(r);
+    transpose_8x8_sse2(r);
+    llm_pass_avx2<PASS2_BIAS, PASS2_SHIFT>(r);
+    transpose_8x8_sse2(r);
+    store_rows_sse2(r, out, stride);
+}
+
+template <bool first>
+inline AVX2_TARGET void fdct_pass_avx2(__m128i *r)
+{
+    constexpr int shift = first ? PASS1_SHIFT : CONST_BITS + PASS1_BITS;
+    __m256i round = _mm256_set1_epi32(1 << (shift - 1));
+
+    __m128i tmp0 = _mm_add_epi16(r[0], r[7]);
+    __m128i tmp7 = _mm_sub_epi16(r[0], r[7]);
+    __m128i tmp1 = _mm_add_epi16(r[1], r[6]);
+    __m128i tmp6 = _mm_sub_epi16(r[1], r[6]);
+    __m128i tmp2 = _mm_add_epi16(r[2], r[5]);
+    __m128i tmp5 = _mm_sub_epi16(r[2], r[5]);
+    __m128i tmp3 = _mm_add_epi16(r[3], r[4]);
+    __m128i tmp4 = _mm_sub_epi16(r[3], r[4]);
+
+    __m128i tmp10 = _mm_add_epi16(tmp0, tmp3);
+    __m128i tmp13 = _mm_sub_epi16(tmp0, tmp3);
+    __m128i tmp11 = _mm_add_epi16(tmp1, tmp2);
+    __m128i tmp12 = _mm_sub_epi16(tmp1, tmp2);
+
+    if (first) {
+        __m128i dc = _mm_sub_epi16(_mm_add_epi16(tmp10, tmp11), _mm_set1_epi16(8 * 128));
+        r[0] = _mm_slli_epi16(dc, PASS1_BITS);
+        r[4] = _mm_slli_epi16(_mm_sub_epi16(tmp10, tmp11), PASS1_BITS);
+    } else {
+        __m128i half = _mm_set1_epi16(1 << (PASS1_BITS - 1));
+        r[0] = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(tmp10, tmp11), half), PASS1_BITS);
+        r[4] = _mm_srai_epi16(_mm_add_epi16(_mm_sub_epi16(tmp10, tmp11), half), PASS1_BITS);
+    }
+    r[2] = descale_avx2<shift>(_mm256_add_epi32(madd_avx2(tmp12, tmp13, K_T2_S2, K_T3_S2), round));
+    r[6] = descale_avx2<shift>(_mm256_add_epi32(madd_avx2(tmp12, tmp13, K_T2_S6, K_T3_S6), round));
+
+    __m256i o1 = _mm256_add_epi32(madd_avx2(tmp4, tmp5, K_F1_T4, K_F1_T5), madd_avx2(tmp6, tmp7, K_F1_T6, K_F1_T7));
+    __m256i o3 = _mm256_add_epi32(madd_avx2(tmp4, tmp5, K_F3_T4, K_F3_T5), madd_avx2(tmp6, tmp7, K_F3_T6, K_F3_T7));
+    __m256i o5 = _mm256_add_epi32(madd_avx2(tmp4, tmp5, K_F5_T4, K_F5_T5), madd_avx2(tmp6, tmp7, K_F5_T6, K_F5_T7));
+    __m256i o7 = _mm256_add_epi32(madd_avx2(tmp4, tmp5, K_F7_T4, K_F7_T5), madd_avx2(tmp6, tmp7, K_F7_T6, K_F7_T7));
+    r[1] = descale_avx2<shift>(_mm256_add_epi32(o1, round));
+    r[3] = descale_avx2<shift>(_mm256_add_epi32(o3, round));
+    r[5] = descale_avx2<shift>(_mm256_add_epi32(o5, round));
+    r[7] = descale_avx2<shift>(_mm256_add_epi32(o7, round));
+}
+
+AVX2_TARGET void fdct_int_avx2(const uint8_t *in, int stride, int16_t *out)
+{
+    __m128i r[8];
+    load_rows_sse2(in, stride, r);
+    transpose_8x8_sse2(r);
+    fdct_pass_avx2<true>(r);
+    transpose_8x8_sse2(r);
+    fdct_pass_avx2<false>(r);
+    for (int i = 0; i < 8; i += 2) {
+        _mm256_storeu_si256((__m256i *)(out + i * 8), _mm256_set_m128i(r[i + 1], r[i]));
+    }
+}
+
+AVX2_TARGET uint64_t quantize_avx2(const int16_t *coef, const fdct_divisors &div, int16_t *zz)
+{
+    static const shuffle_masks masks(zigzag_to_natural);
+    __m128i q[8];
+    __m128i r[8];
+    for (int i = 0; i < 8; i++) {
+        q[i] = quantize_row_sse2(_mm_loadu_si128((const __m128i *)(coef + i * 8)), div, i * 8);
+    }
+    shuffle_avx2(masks, q, r);
+    for (int j = 0; j < 8; j++) {
+        _mm_storeu_si128((__m128i *)(zz + j * 8), r[j]);
+    }
+    return nonzero_mask_sse2(r);
+}
+
+#endif // IDCT_X86_SIMD
+
+const idct_kernels g_kernels[] = {
+    { simd_level::scalar, dezigzag_scalar, dequant_scalar, idct_int_scalar,
+      fdct_fast_int, quantize_scalar },
+#ifdef IDCT_X86_SIMD
+    // no pshufb in SSE2, the de-scatter stays scalar
+    { simd_level::sse2, dezigzag_scalar, dequant_sse2, idct_int_sse2,
+      fdct_int_sse2, quantize_sse2 },
+    { simd_level::avx2, dezigzag_avx2, dequant_avx2, idct_int_avx2,
+      fdct_int_avx2, quantize_avx2 },
+#endif
+};
+
+} // anonymous namespace
+
+const char *to_string(simd_level level)
+{
+    switch (level) {
+    case simd_level::scalar: return "scalar";
+    case simd_level::sse2: return "sse2";
+    case simd_level::avx2: return "avx2";
+    default: return "unknown";
+    }
+}
+
+simd_level detect_simd_level()
+{
+#ifdef IDCT_X86_SIMD
+    static const simd_level level = [] {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return simd_level::avx2;
+        }
+        if (__builtin_cpu_supports("sse2")) {
+            return simd_level::sse2;
+        }
+        return simd_level::scalar;
+    }();
+    return level;
+#else
+    return simd_level::scalar;
+#endif
+}
+
+const idct_kernels &get_idct_kernels(simd_level level)
+{
+    if ((int)level > (int)detect_simd_level()) {
+        level = detect_simd_level();
+    }
+    for (int i = sizeof(g_kernels) / sizeof(g_kernels[0]) - 1; i > 0; i--) {
+        if ((int)g_kernels[i].level <= (int)level) {
+            return g_kernels[i];
+        }
+    }
+    return g_kernels[0];
+}
+
+const char *to_string(idct_method method)
+{
+    switch (method) {
+    case idct_method::separable_float: return "separable_float";
+    case idct_method::fast_float: return "fast_float";
+    case idct_method::fast_int: return "fast_int";
+    default: return "unknown";
+    }
+}
+
+void prepare_idct_qtable(const uint16_t *quant, idct_qtable &qt)
+{
+    for (int v = 0; v < 8; v++) {
+        for (int u = 0; u < 8; u++) {
+            qt.q[v * 8 + u] = (int16_t)quant[v * 8 + u];
+            qt.fq[v * 8 + u] = quant[v * 8 + u] * aan_scale[v] * aan_scale[u] / 8.0f;
+        }
+    }
+}
+
+void idct_engine::transform(const int16_t *coef, const idct_qtable &qt, int last_nz,
+                            uint8_t *out, int stride) const
+{
+    switch (m_method) {
+    case idct_method::separable_float:
+        if (last_nz == 0) {
+            fill_block(clamp_u8(coef[0] * (float)qt.q[0] / 8.0f), out, stride);
+        } else {
+            idct_separable_float(coef, qt, last_nz, out, stride);
+        }
+        break;
+    case idct_method::fast_float:
+        if (last_nz == 0) {
+            fill_block(clamp_u8(coef[0] * qt.fq[0]), out, stride);
+        } else {
+            idct_fast_float(coef, qt, last_nz, out, stride);
+        }
+        break;
+    case idct_method::fast_int:
+    default:
+        if (last_nz != 0 && m_kernels->level != simd_level::scalar) {
+            m_kernels->idct_int(coef, qt.q, out, stride);
+        } else {
+            idct_fast_int(coef, qt, last_nz, out, stride);
+        }
+        break;
+    }
+}
+
+void idct_engine::transform_scaled(const int16_t *coef, const idct_qtable &qt, int last_nz, int size,
+                                   uint8_t *out, int stride) const
+{
+    switch (size) {
+    case 1:
+        idct_scaled<1>(coef, qt, 0, out, stride);
+        break;
+    case 2:
+        idct_scaled<2>(coef, qt, last_nz, out, stride);
+        break;
+    case 4:
+        idct_scaled<4>(coef, qt, last_nz, out, stride);
+        break;
+    default:
+        transform(coef, qt, last_nz, out, stride);
+        break;
+    }
+}
+
+void idct_8x8_float(const float *in, float *out)
+{
+    float tmp[64];
+    for (int v = 0; v < 8; v++) {
+        for (int x = 0; x < 8; x++) {
+            float sum = 0.0f;
+            for (int u = 0; u < 8; u++) {
+                sum += in[v * 8 + u] * g_cos.t[x][u];
+            }
+            tmp[v * 8 + x] = sum;
+        }
+    }
+    for (int y = 0; y < 8; y++) {
+        for (int x = 0; x < 8; x++) {
+            float sum = 0.0f;
+            for (int v = 0; v < 8; v++) {
+                sum += g_cos.t[y][v] * tmp[v * 8 + x];
+            }
+            out[y * 8 + x] = sum;
+        }
+    }
+}
+
+void prepare_fdct_divisors(const uint16_t *quant, fdct_divisors &div)
+{
+    for (int i = 0; i < 64; i++) {
+        // reciprocal of d with r significant bits, as libjpeg-turbo's compute_reciprocal
+        uint32_t d = 8u * quant[i];
+        int r = 16 + (31 - __builtin_clz(d));
+        uint32_t fq = (1u << r) / d;
+        uint32_t fr = (1u << r) % d;
+        uint32_t c = d / 2;
+        if (fr == 0) {
+            // power of two: fq would not fit 16 bits
+            fq >>= 1;
+            r--;
+        } else if (fr <= d / 2) {
+            c++;
+        } else {
+            fq++;
+        }
+        div.recip[i] = (uint16_t)fq;
+        div.corr[i] = (uint16_t)c;
+        div.scale[i] = (uint16_t)(1u << (32 - r));
+    }
+}
+
+void fdct_8x8_int(const uint8_t *in, int stride, int16_t *out)
+{
+    fdct_fast_int(in, stride, out);
+}
+
+void fdct_8x8_float(const float *in, float *out)
+{
+    float tmp[64];
+    // rows: tmp[y][u] = sum_x f[y][x] * t[x][u]
+    for (int y = 0; y < 8; y++) {
+        for (int u = 0; u < 8; u++) {
+            float sum = 0.0f;
+            for (int x = 0; x < 8; x++) {
+                sum += in[y * 8 + x] * g_cos.t[x][u];
+            }
+            tmp[y * 8 + u] = sum;
+        }
+    }
+    // columns: F[v][u] = sum_y t[y][v] * tmp[y][u]
+    for (int v = 0; v < 8; v++) {
+        for (int u = 0; u < 8; u++) {
+            float sum = 0.0f;
+            for (int y = 0; y < 8; y++) {
+                sum += g_cos.t[y][v] * tmp[y * 8 + u];
+            }
+            out[v * 8 + u] = sum;
+        }
+    }
+}
+
+    } // namespace jpeg
+} // namespace zzwlib
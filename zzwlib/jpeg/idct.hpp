@@ -0,0 +1,129 @@
+
+//
+// 8x8 idct engine, shared by the decoder (jpeg.cpp) and the dct test program (dct.cpp).
+//
+// coefficient blocks are in natural order: coef[v * 8 + u], v is the vertical
+// frequency (row), u the horizontal frequency (column).
+//
+// methods:
+// 1. separable_float: row / column passes with a precomputed cosine table, 1024 multiply-adds;
+// 2. fast_float: AAN, the dequantization table carries the AAN scale factors;
+// 3. fast_int: 16-bit fixed point LLM (as jidctint), dequantization fused into the first pass.
+//
+// shortcuts, selected by the zigzag index of the last non zero coefficient:
+// DC only blocks are a single fill, blocks with coefficients only in zigzag 0..9
+// (the top left 4x4) skip the zero columns and the zero inputs of the row pass.
+//
+// scaled decoding (1/2, 1/4, 1/8) uses 4x4, 2x2 and 1x1 transforms whose basis
+// is the 8 point one averaged over the samples an output covers, 1x1 is the DC alone.
+//
+
+#pragma once
+
+#include <stdint.h>
+
+namespace zzwlib{
+    namespace jpeg {
+
+enum class idct_method : int {
+    separable_float = 0,
+    fast_float,
+    fast_int,
+};
+
+const char *to_string(idct_method method);
+
+// SIMD kernels are picked at runtime from CPUID.
+// SSE2 / AVX2 on x86, other targets (NEON included) use the scalar kernels.
+enum class simd_level : int {
+    scalar = 0,
+    sse2,
+    avx2,
+};
+
+const char *to_string(simd_level level);
+
+// best level supported by this cpu
+simd_level detect_simd_level();
+
+// divisors of the encoder's quantization as 16-bit reciprocals (as libjpeg-turbo's
+// jcdctmgr): out = sign(c) * ((((|c| + corr) * recip) >> 16) * scale >> 16),
+// which is c / (8 * q) rounded to nearest for the 8x scaled fdct output. natural order.
+struct fdct_divisors {
+    uint16_t recip[64];
+    uint16_t corr[64];
+    uint16_t scale[64];
+};
+
+// quant: 64 quantization values (1 - 255) in natural order
+void prepare_fdct_divisors(const uint16_t *quant, fdct_divisors &div);
+
+// per block kernels, every level gives bit for bit the same results as scalar.
+struct idct_kernels {
+    simd_level level;
+    // zz: 64 coefficients in zigzag order, natural: the same in natural order
+    void (*dezigzag)(const int16_t *zz, int16_t *natural);
+    // coef[i] *= q[i], 16-bit wrap around
+    void (*dequant)(int16_t *coef, const int16_t *q);
+    // fast_int idct of a whole block, dequantization fused into the first pass
+    void (*idct_int)(const int16_t *coef, const int16_t *q, uint8_t *out, int stride);
+    // encoder side: fdct_8x8_int, and quantization of its output into zigzag order.
+    // quantize returns the mask of the non zero zz[k] (bit k).
+    void (*fdct_int)(const uint8_t *in, int stride, int16_t *out);
+    uint64_t (*quantize)(const int16_t *coef, const fdct_divisors &div, int16_t *zz);
+};
+
+// kernels for level, falls back to the best supported level below it
+const idct_kernels &get_idct_kernels(simd_level level);
+
+// quantization table prepared for the idct, natural order
+struct idct_qtable {
+    int16_t q[64];
+    float   fq[64];     // q * AAN scale factors / 8, for fast_float
+};
+
+// quant: 64 quantization values in natural order
+void prepare_idct_qtable(const uint16_t *quant, idct_qtable &qt);
+
+class idct_engine final {
+public:
+    explicit idct_engine(idct_method method = idct_method::fast_int,
+                         simd_level level = detect_simd_level()) :
+        m_method(method),
+        m_kernels(&get_idct_kernels(level)) {}
+
+    idct_method method() const { return m_method; }
+    void set_method(idct_method method) { m_method = method; }
+
+    const idct_kernels &kernels() const { return *m_kernels; }
+    void set_simd_level(simd_level level) { m_kernels = &get_idct_kernels(level); }
+
+    // coef: 64 quantized coefficients, natural order
+    // last_nz: zigzag index of the last non zero coefficient, 0 for DC only blocks
+    // out: 8x8 samples, level shifted (+128) and clamped to 0 - 255
+    void transform(const int16_t *coef, const idct_qtable &qt, int last_nz,
+                   uint8_t *out, int stride) const;
+
+    // scaled decoding: the block reduced to size x size samples (1, 2, 4; 8 is transform()).
+    // the result is the 8x8 transform box filtered down, size 1 only reads coef[0].
+    // reduced sizes always use fixed point, whatever the method.
+    void transform_scaled(const int16_t *coef, const idct_qtable &qt, int last_nz, int size,
+                          uint8_t *out, int stride) const;
+
+private:
+    idct_method m_method;
+    const idct_kernels *m_kernels;
+};
+
+// float domain transforms on 64 values, natural order, without level shift.
+// in / out may not overlap.
+void idct_8x8_float(const float *in, float *out);
+void fdct_8x8_float(const float *in, float *out);
+
+// fixed point forward transform for the encoder (LLM, as jfdctint).
+// in: 8x8 samples, the level shift (-128) is done here.
+// out: natural order coefficients, 8 times the DCT values (|out| < 2^14).
+void fdct_8x8_int(const uint8_t *in, int stride, int16_t *out);
+
+    } // namespace jpeg
+} // namespace zzwlib
@@ -1,886 +1,1666 @@
-
-/*
- * 解码过程： jpeg 标准中， image,frame,scan 之间的关系为：
- * 1. image 中包含1 个 或 多个 frame；
- *  对于 顺序（sequential）模式和 progressive 模式， 一个 image 中只有 1 个 frame；
- *  对于 hierarchical 模式， 一个 image 中包含多个 frame；
- * 2. frame 中包含 1 个 或 多个 scan；
- * 3. jpeg 编码的最小单元 MCU （Minimum Coding Unit）， 一个scan 包含 1 个或多个 MCU；
- * 4. 一个 MCU 由 1个或多个数据单元（data unit)构成，数据单元是 8x8 的数据块。
- *  对于非交错存放方式， MCU 由 1 个数据单元构成；对于交错存放方式，MCU 由 多个数据单元构成
- *  每通道 一个 或多个；
- * 举例：
- * 图 1 中，第一个MCU 包括 A1 B1 C1 三个数据单元；
- * 图 2 中，第一个MCU 包含 A1 A2 B1 C1 4个数据单元
-*/
-
-#include <stdint.h>
-#include <memory>
-#include <vector>
-#include <array>
-#include <cmath>
-
-#include "jpeg.hpp"
-#include "../logger.hpp"
-
-zzwlib::logger  jpeg_logger("jpeg", zzwlib::loglevel::log_verbose_level);
-
-namespace zzwlib{
-    namespace jpeg {
-
-class jpeg_marker {
-public:
-    // must based on uint, convert MARKER start with 0xFx correctly.
-    enum class type : uint32_t {
-        M_SOF0  = 0xC0,
-        M_SOF1  = 0xC1,
-        M_SOF2  = 0xC2,
-        M_SOF3  = 0xC3,
-        M_DHT   = 0xC4,
-        M_SOF5  = 0xC5,
-        M_SOF6  = 0xC6,
-        M_SOF7  = 0xC7,
-        M_JPG   = 0xC8,
-        M_SOF9  = 0xC9,
-        M_SOF10 = 0xCA,
-        M_SOF11 = 0xCB,
-        M_DAC   = 0xCC,
-        M_SOF13 = 0xCD,
-        M_SOF14 = 0xCE,
-        M_SOF15 = 0xCF,
-        M_RST0  = 0xD0,
-        M_RST1  = 0xD1,
-        M_RST2  = 0xD2,
-        M_RST3  = 0xD3,
-        M_RST4  = 0xD4,
-        M_RST5  = 0xD5,
-        M_RST6  = 0xD6,
-        M_RST7  = 0xD7,
-        M_SOI   = 0xD8,
-        M_EOI   = 0xD9,
-        M_SOS   = 0xDA,
-        M_DQT   = 0xDB,
-        M_DNL   = 0xDC,
-        M_DRI   = 0xDD,
-        M_DHP   = 0xDE,
-        M_EXP   = 0xDF,
-        M_APP0  = 0xE0,
-        M_APP1  = 0xE1,
-        M_APP2  = 0xE2,
-        M_APP3  = 0xE3,
-        M_APP4  = 0xE4,
-        M_APP5  = 0xE5,
-        M_APP6  = 0xE6,
-        M_APP7  = 0xE7,
-        M_APP8  = 0xE8,
-        M_APP9  = 0xE9,
-        M_APP15 = 0xEF,
-        M_JPG0  = 0xF0,
-        M_JPG13 = 0xFD,
-        M_COM   = 0xFE,
-
-        M_TEM   = 0x01,
-        M_ERROR = 0x100,
-        RST0   = 0xD0
-    };
-    static const char *to_string(type t) {
-        switch (t) {
-        case type::M_SOF0: return "SOF0";
-        case type::M_SOF1: return "SOF1";
-        case type::M_SOF2: return "SOF2";
-        case type::M_SOF3: return "SOF3";
-        case type::M_DHT: return "DHT";
-        case type::M_SOF5: return "SOF5";
-        case type::M_SOF6: return "SOF6";
-        case type::M_SOF7: return "SOF7";
-        case type::M_JPG: return "JPG";
-        case type::M_SOF9: return "SOF9";
-        case type::M_SOF10: return "SOF10";
-        case type::M_SOF11: return "SOF11";
-        case type::M_DAC: return "DAC";
-        case type::M_SOF13: return "SOF13";
-        case type::M_SOF14: return "SOF14";
-        case type::M_SOF15: return "SOF15";
-        case type::M_RST0: return "RST0";
-        case type::M_RST1: return "RST1";
-        case type::M_RST2: return "RST2";
-        case type::M_RST3: return "RST3";
-        case type::M_RST4: return "RST4";
-        case type::M_RST5: return "RST5";
-        case type::M_RST6: return "RST6";
-        case type::M_RST7: return "RST7";
-        case type::M_SOI: return "SOI";
-        case type::M_EOI: return "EOI";
-        case type::M_SOS: return "SOS";
-        case type::M_DQT: return "DQT";
-        case type::M_DNL: return "DNL";
-        case type::M_DRI: return "DRI";
-        case type::M_DHP: return "DHP";
-        case type::M_EXP: return "EXP";
-        case type::M_APP0: return "APP0";
-        case type::M_APP1: return "APP1";
-        case type::M_APP2: return "APP2";
-        case type::M_APP3: return "APP3";
-        case type::M_APP4: return "APP4";
-        case type::M_APP5: return "APP5";
-        case type::M_APP6: return "APP6";
-        case type::M_APP7: return "APP7";
-        case type::M_APP8: return "APP8";
-        case type::M_APP9: return "APP9";
-        case type::M_APP15: return "APP15";
-        case type::M_JPG0: return "JPG0";
-        case type::M_JPG13: return "JPG13";
-        case type::M_COM: return "COM";
-        case type::M_TEM: return "TEM";
-        case type::M_ERROR: return "ERROR";
-        default: return "UNKNOWN";
-        }
-    }
-};
-
-const std::pair<int, int> zzOrderToMatIndices(int zzIndex)
-{
-    static const std::pair<int, int> zzOrderToMatIndices[64] = {
-        { 0, 0 },
-        { 0, 1 }, { 1, 0 },
-        { 2, 0 }, { 1, 1 }, { 0, 2 },
-        { 0, 3 }, { 1, 2 }, { 2, 1 }, { 3, 0 },
-        { 4, 0 }, { 3, 1 }, { 2, 2 }, { 1, 3 }, { 0, 4 },
-        { 0, 5 }, { 1, 4 }, { 2, 3 }, { 3, 2 }, { 4, 1 }, { 5, 0 },
-        { 6, 0 }, { 5, 1 }, { 4, 2 }, { 3, 3 }, { 2, 4 }, { 1, 5 }, { 0, 6 },
-        { 0, 7 }, { 1, 6 }, { 2, 5 }, { 3, 4 }, { 4, 3 }, { 5, 2 }, { 6, 1 }, { 7, 0 },
-        { 7, 1 }, { 6, 2 }, { 5, 3 }, { 4, 4 }, { 3, 5 }, { 2, 6 }, { 1, 7 },
-        { 2, 7 }, { 3, 6 }, { 4, 5 }, { 5, 4 }, { 6, 3 }, { 7, 2 },
-        { 7, 3 }, { 6, 4 }, { 5, 5 }, { 4, 6 }, { 3, 7 },
-        { 4, 7 }, { 5, 6 }, { 6, 5 }, { 7, 4 },
-        { 7, 5 }, { 6, 6 }, { 5, 7 },
-        { 6, 7 }, { 7, 6 },
-        { 7, 7 }
-    };
-    return zzOrderToMatIndices[zzIndex];
-}
-
-int valCategory(int val)
-{
-    if (val < 0) {
-        val = -val;
-    }
-    if (val == 0) {
-        return 0;
-    }
-    int n = 0;
-    while (val > 0) {
-        n++;
-        val >>= 1;
-    }
-    return n;
-}
-
-int matIndicesToZOrder(int i, int j)
-{
-    static const int matZOrder[8][8] = {
-        { 0, 1, 5, 6, 14, 15, 27, 28 },
-        { 2, 4, 7, 13, 16, 26, 29, 42 },
-        { 3, 8, 12, 17, 25, 30, 41, 43 },
-        { 9, 11, 18, 24, 31, 40, 44, 53 },
-        { 10, 19, 23, 32, 39, 45, 52, 54 },
-        { 20, 22, 33, 38, 46, 51, 55, 60 },
-        { 21, 34, 37, 47, 50, 56, 59, 61 },
-        { 35, 36, 48, 49, 57, 58, 62, 63 }
-    };
-    return matZOrder[i][j];
-}
-
-struct Node {
-    bool root;
-    bool leaf;
-    std::string code;
-    int  value;
-    std::shared_ptr<Node> left;
-    std::shared_ptr<Node> right;
-    std::shared_ptr<Node> parent;
-    Node() :
-        root(false),
-        leaf(false),
-        code(""),
-        value(0),
-        left(nullptr),
-        right(nullptr),
-        parent(nullptr)
-    {}
-    Node(const std::string &code_, int value_) :
-        root(false),
-        leaf(false),
-        code(code_),
-        value(value_),
-        left(nullptr),
-        right(nullptr),
-        parent(nullptr)
-    {}
-};
-
-// Alias for a node
-typedef std::shared_ptr<Node> NodePtr;
-
-NodePtr create_root_node(int value)
-{
-    NodePtr root = std::make_shared<Node>("",value);
-    root->root = true;
-    return root;
-}
-
-void insert_left(NodePtr node, int value)
-{
-    if (node == nullptr) {
-        LOGE(jpeg_logger, "insert_left, node is null");
-        return;
-    }
-    if (node->left != nullptr) {
-        LOGE(jpeg_logger, "insert_left, node already has left child");
-        return;
-    }
-    NodePtr left_node = std::make_shared<Node>(node->code + "0", value);
-    node->left = left_node;
-    left_node->parent = node;
-}
-
-
-void insert_right(NodePtr node, int value)
-{
-    if (node == nullptr) {
-        LOGE(jpeg_logger, "insert_right, node is null");
-        return;
-    }
-    if (node->right!= nullptr) {
-        LOGE(jpeg_logger, "insert_right, node already has right child");
-        return;
-    }
-    NodePtr right_node = std::make_shared<Node>(node->code + "1", value);
-    node->right = right_node;
-    right_node->parent = node;
-}
-
-NodePtr same_level_right(NodePtr node)
-{
-    if (node == nullptr) {
-        LOGE(jpeg_logger, "same_level_right, node is null");
-        return nullptr;
-    }
-    if (node->parent == nullptr) {
-        LOGE(jpeg_logger, "same_level_right, node has no parent");
-        return nullptr;
-    }
-    // node is the left child of its parent, so its right sibling is its parent's right child
-    if (node ==  node->parent->left) {
-        return node->parent->right;
-    }
-
-    // node is the right child of its parent, traverse back the tree to find the first right sibling
-    int count = 0;
-    NodePtr p = node;
-    while(p->parent != nullptr && p->parent->right == p) {
-        count++;
-        p = p->parent;
-    }
-    // while loop ends when p->parent == nullptr
-    if (p->parent == nullptr) {
-        return nullptr;
-    }
-    // while loop ends when p->parent->right != p; p is its parent's left child.
-    // get its parent's right child
-    p = p->parent->right;
-    // traverse down the tree to find the first left child
-    while (count > 0) {
-        p = p->left;
-        count--;
-    }
-
-    return p;
-}
-
-void in_order_traverse(NodePtr node)
-{
-    if (node == nullptr) {
-        return;
-    }
-    in_order_traverse(node->left);
-    if (node->leaf) {
-        LOGD(jpeg_logger, "node->code: %s, node->value: %d", node->code.c_str(), node->value);
-    }
-    in_order_traverse(node->right);
-}
-
-struct HuffmanRow {
-    int num;
-    std::vector<uint8_t> val_list;
-};
-
-typedef std::vector<HuffmanRow> HuffmanTable;
-
-class HuffmanTree
-{
-    public:
-        HuffmanTree(): m_root(nullptr) {}
-
-        HuffmanTree( const HuffmanTable& htable )
-        {
-            constructHuffmanTree( htable );
-        }
-        void constructHuffmanTree(const HuffmanTable &table)
-        {
-            m_root = create_root_node(0);
-            insert_left(m_root, 0);
-            insert_right(m_root, 0);
-
-            NodePtr left_most = m_root->left;
-            // if the count is 0, add left & right children for all nodes;
-            for (auto i = 1; i <= 16; ++i) {
-                if (table[i-1].num == 0) {
-                    for (NodePtr p_nd = left_most; p_nd != nullptr; p_nd = same_level_right(p_nd)) {
-                        insert_left(p_nd, 0);
-                        insert_right(p_nd, 0);
-                    }
-                    left_most = left_most->left;
-                } else {
-                    // assign codes starting from left_most in the tree
-                    for (auto && value : table[i-1].val_list) {
-                        left_most->value = value;
-                        left_most->leaf = true;
-                        left_most = same_level_right(left_most);
-                    }
-
-                    insert_left(left_most, 0);
-                    insert_right(left_most, 0);
-                    NodePtr p_nd = same_level_right(left_most);
-                    left_most = left_most->left;
-
-                    while (p_nd!= nullptr) {
-                        insert_left(p_nd, 0);
-                        insert_right(p_nd, 0);
-                        p_nd = same_level_right(p_nd);
-                    }
-                }
-            }
-        }
-        const NodePtr getTree() const { return m_root;}
-
-        // decode the huffman code,
-        // return the value if the code is valid,
-        // because 0x0000 and 0xffff are both values that are used in the
-        // normal range. so can not use a return type of int
-        // to represent the condition "code are not found in the tree".
-        // otherwise return ""
-        const std::string contains(const std::string &huffCode) {
-            //int i = 0;
-            NodePtr p_nd = m_root;
-            for (auto && c : huffCode) {
-                if (c == '0') {
-                    p_nd = p_nd->left;
-                } else {
-                    p_nd = p_nd->right;
-                }
-            }
-            if (p_nd == nullptr) {
-                return "";
-            }
-            if (p_nd->leaf) {
-                return std::to_string(p_nd->value);
-            }
-            return "";
-        }
-
-    private:
-        NodePtr m_root;
-};
-
-struct MCU {
-    MCU() = default;
-
-    MCU(const std::vector<int>& compRLE,
-        const std::vector<uint16_t>& QTable,
-        int &dc_sum) {
-            constructMCU(compRLE, QTable, dc_sum);
-    }
-
-    void constructMCU(const std::vector<int>& compRLE,
-                      const std::vector<uint16_t>& QTable, int &dc_sum) {
-
-        LOGD(jpeg_logger, "constructMCU, index: %d", m_index);
-    
-        // initialize the zzorder with all zeros
-        std::array<int, 64> zzorder;
-        std::fill(zzorder.begin(), zzorder.end(), 0);
-        int j = -1;
-
-        // construct the zzorder array
-        for (int i = 0; i <= compRLE.size() - 2; i += 2) {
-            if (compRLE[i] == 0 && compRLE[i + 1] == 0) {
-                break;
-            }
-            // skip the number of zeros
-            j = j + compRLE[i] + 1;
-            zzorder[j] = compRLE[i + 1];
-        }
-
-        // DC_i = DC_i-1 + diff
-        zzorder[0] += dc_sum;
-        dc_sum = zzorder[0];
-
-        for (int i = 0; i < 64; i++) {
-            zzorder[i] *= QTable[i];
-        }
-
-        // compute the zigzag order
-        for (int i = 0; i < 64; i++) {
-            auto [row, col] = zzOrderToMatIndices(i);
-            m_dct_dst[row][col] = zzorder[i];
-        }
-        computeIDCT();
-    }
-
-    void computeIDCT() {
-        for (int y = 0; y < 8; y++) {
-            for (int x = 0; x < 8; x++) {
-                float sum = 0.0f;
-                for (int u = 0; u < 8; u++) {
-                    for (int v = 0; v < 8; v++) {
-                        float alpha = (u == 0) ? 1.0f / std::sqrt(2.0f) : 1.0f;
-                        float beta =  (v == 0) ? 1.0f / std::sqrt(2.0f) : 1.0f;
-                        sum += alpha * beta * m_dct_dst[u][v] * std::cos((2 * x + 1) * u * M_PI / 16.0) * std::cos((2 * y + 1) * v * M_PI / 16.0);
-                    }
-                }
-                m_dct_src[y][x] = std::roundf( sum / 4.0f) + 128;
-            }
-        }
-    }
-
-    std::array<std::array<uint8_t, 8>, 8> m_dct_src;
-    std::array<std::array<float, 8>, 8>  m_dct_dst;
-    int m_index;
-};
-
-
-int m_image_x_size;
-int m_image_y_size;
-int m_comps_in_frame;            // # of components in frame
-int m_comp_h_samp[4];       // component's horizontal sampling factor
-int m_comp_v_samp[4];       // component's vertical sampling factor
-int m_comp_quant[4];        // component's quantization table selector
-int m_comp_ident[4];        // component's ID
-
-std::vector<std::vector<uint16_t>> m_quant_tbl;
-HuffmanTable m_huffmanTable[2][2];
-HuffmanTree m_huffmanTree[2][2];
-
-int m_comps_in_scan;
-std::vector<uint8_t> m_scan_bytes;
-
-// return: 0 or positive, next marker pos.
-uint32_t next_marker(uint8_t *data, int len, int &pos) {
-    pos = 0;
-    while (pos < len - 1) {
-        if (data[pos] == 0xff) {
-            uint32_t marker = data[pos + 1];
-            if (marker == 0xff) {
-                pos += 1;
-                continue;
-            }
-            if (marker == 0x00) {
-                pos += 2;
-                continue;
-            }
-            return marker;
-        }
-        pos++;
-    }
-    return 0;
-}
-
-int dqt_marker(uint8_t *data, int len, int &marker_len)
-{
-    // 2 bytes marker
-    // 2 bytes - len
-    // 1 byte - low 4 bits: table id; high 4 bits: precision (0: 8-bit, 1: 16-bit)
-    // 64 * (precision + 1) bytes - table data
-
-    int cur_pos = 0;
-    int left_bytes = len;
-    // skip marker & length
-    cur_pos += 2;
-    left_bytes -= 2;
-
-    marker_len = (data[cur_pos] << 8) | data[cur_pos + 1];
-    cur_pos += 2;
-
-    if (left_bytes < marker_len) {
-        LOGD(jpeg_logger, "left bytes %d < marker len %d", left_bytes, marker_len);
-        return -1;
-    }
-    left_bytes = marker_len - 2;
-
-    // 1 byte - low 4 bits: table id; high 4 bits: precision (0: 8-bit, 1: 16-bit)
-    auto table_id = data[cur_pos] & 0x0f;
-    auto precision = (data[cur_pos] >> 4) & 0x0f;
-    cur_pos += 1;
-
-    LOGD(jpeg_logger, "table id %d, precision %d, table:", table_id, precision);
-
-    while (m_quant_tbl.size() <= table_id) {
-        m_quant_tbl.push_back(std::vector<uint16_t>());
-    }
-    for (int i = 0; i < 64; i++) {
-        uint16_t val = 0;
-        if (precision == 0) {
-            val = data[cur_pos];
-            cur_pos += 1;
-        } else if (precision == 1) {
-            val = (data[cur_pos] << 8) | data[cur_pos + 1];
-            cur_pos += 2;
-        } else {
-            LOGD(jpeg_logger, "invalid precision %d", precision);
-        }
-        LOGD(jpeg_logger, " 0x%x ", val);
-        m_quant_tbl[table_id].push_back(val);
-    }
-
-    return 0;
-}
-
-int dht_marker(uint8_t *data, int len, int &marker_len)
-{
-    // 2 bytes marker
-    // 2 bytes - len
-    // 1 byte - low 4 bits: table id; high 4 bits: table type (0 : DC, 1: AC)
-    // 16 bytes - table data
-
-    int cur_pos = 0;
-    int left_bytes = len;
-    // skip marker & length
-    cur_pos += 2;
-    left_bytes -= 2;
-
-    marker_len = (data[cur_pos] << 8) | data[cur_pos + 1];
-    cur_pos += 2;
-
-    if (left_bytes < marker_len) {
-        LOGD(jpeg_logger, "left bytes %d < marker len %d", left_bytes, marker_len);
-        return -1;
-    }
-    left_bytes = marker_len - 2;
-
-    // 1 byte - low 4 bits: table id; high 4 bits: table type (0 : DC, 1: AC)
-    auto table_id = data[cur_pos] & 0x0f;
-    auto table_type = (data[cur_pos] >> 4) & 0x0f;
-    cur_pos += 1;
-    LOGD(jpeg_logger, "table id %d, table type %d(%s), table:", table_id, table_type, table_type == 0 ? "DC" : "AC");
-
-    int count = 0;
-
-    for (int i = 1; i <= 16; i++) {
-        HuffmanRow row;
-        row.num = data[cur_pos];
-        cur_pos += 1;
-        m_huffmanTable[table_type][table_id].push_back(row);
-
-        count += row.num;
-        LOGD(jpeg_logger, " 0x%x ", row.num);
-    }
-    int row_idx = 0;
-    for (int i = 0; i < count; i++) {
-        uint8_t code = data[cur_pos];
-        cur_pos += 1;
-
-        while(m_huffmanTable[table_type][table_id][row_idx].num == 0) {
-            row_idx++;
-        }
-        m_huffmanTable[table_type][table_id][row_idx].val_list.push_back(code);
-        if (m_huffmanTable[table_type][table_id][row_idx].num == m_huffmanTable[table_type][table_id][row_idx].val_list.size())
-            row_idx++;
-
-        LOGD(jpeg_logger, " 0x%x ", code);
-    }
-
-    m_huffmanTree[table_type][table_id].constructHuffmanTree(m_huffmanTable[table_type][table_id]);
-
-    return 0;
-};
-
-int sof0_marker(uint8_t *data, int len, int &marker_len)
-{
-    // 2 bytes marker
-    // 2 bytes - len
-    // 1 byte - sample_precision
-    // 2 bytes - height
-    // 2 bytes - width
-    // 1 byte - num_components
-    // num_components bytes * 3 - component info
-
-    int cur_pos = 0;
-    int left_bytes = len;
-
-    // skip marker & length
-    cur_pos += 2;
-    left_bytes -= 2;
-
-    marker_len = (data[cur_pos] << 8) | data[cur_pos + 1];
-    cur_pos += 2;
-
-    if (left_bytes < marker_len) {
-        LOGD(jpeg_logger, "left bytes %d < marker len %d", left_bytes, marker_len);
-        return -1;
-    }
-    left_bytes = marker_len - 2;
-
-    auto precision = data[cur_pos];
-    cur_pos += 1;
-    if (precision != 8) {
-        LOGD(jpeg_logger, "sample precision %d, only support precision 8", precision);
-    }
-
-    m_image_y_size = (data[cur_pos] << 8) | data[cur_pos + 1];
-    cur_pos += 2;
-
-    m_image_x_size = (data[cur_pos] << 8) | data[cur_pos + 1];
-    cur_pos += 2;
-
-    m_comps_in_frame = data[cur_pos];
-    cur_pos += 1;
-
-    for (int i = 0; i < m_comps_in_frame; i++)
-    {
-        m_comp_ident[i]  = data[cur_pos]; cur_pos += 1;
-        m_comp_h_samp[i] = data[cur_pos] & 0x0f;
-        m_comp_v_samp[i] = (data[cur_pos] >> 4) & 0x0f;
-        cur_pos += 1;
-        m_comp_quant[i]  = data[cur_pos]; cur_pos += 1;
-        LOGD(jpeg_logger, "component %d, h_samp %d, v_samp %d, quant %d",
-            m_comp_ident[i], m_comp_h_samp[i], m_comp_v_samp[i], m_comp_quant[i]);
-    }
-    LOGD(jpeg_logger, "image size %dx%d, %d components", m_image_x_size, m_image_y_size, m_comps_in_frame);
-
-    if (marker_len != cur_pos - 2)  {
-        LOGD(jpeg_logger, "sof0 marker len %d, actual len %d", marker_len, cur_pos - 2);
-    }
-    return 0;
-}
-
-int sos_marker(uint8_t *data, int len, int &marker_len)
-{
-    // 2 bytes marker
-    // 2 bytes - len
-    // 1 byte - num_components
-    // num_components bytes * 2 - component info
-    // 1 byte spectral start
-    // 1 byte spectral end
-    // 1 byte low 4 bits: successive_high; high 4 bits: successive_low
-
-    int cur_pos = 0;
-    int left_bytes = len;
-
-    // skip marker & length
-    cur_pos += 2;
-    left_bytes -= 2;
-
-    marker_len = (data[cur_pos] << 8) | data[cur_pos + 1];
-    cur_pos += 2;
-
-    if (left_bytes < marker_len) {
-        LOGD(jpeg_logger, "left bytes %d < marker len %d", left_bytes, marker_len);
-        return -1;
-    }
-    left_bytes = marker_len - 2;
-
-    m_comps_in_scan = data[cur_pos];
-    cur_pos += 1;
-
-    for (int i = 0; i < m_comps_in_scan; i++) {
-        // 1byte的颜色分量id，
-        // 1byte的直流/交流系数表号（高4位：直流分量所使用的哈夫曼树编号，低4位：交流分量使用的哈夫曼树的编号）
-        auto comp_id = data[cur_pos]; cur_pos += 1;
-
-        auto ac_huff_table_id = data[cur_pos] & 0x0f;
-        auto dc_huff_table_id = (data[cur_pos] >> 4) & 0x0f;
-        cur_pos += 1;
-
-        LOGD(jpeg_logger, "component %d, ac_huff_table_id %d, dc_huff_table_id %d",
-            comp_id, ac_huff_table_id, dc_huff_table_id);
-    }
-
-    return 0;
-}
-
-int scan_image_data(uint8_t *data, int len, int &data_len)
-{
-    int cur_pos = 0;
-    int left_bytes = len;
-
-    data_len = 0;
-    LOGD(jpeg_logger, "scan_image_data, len %d", len);
-    while(left_bytes > 0) {
-        if (data[cur_pos] == 0xff && data[cur_pos + 1] == 0x00) {
-            m_scan_bytes.push_back(0xff);
-            left_bytes -= 2;
-            cur_pos += 2;
-            LOGD(jpeg_logger, "find 0xff 0x00");
-        } else if (data[cur_pos] == 0xff && data[cur_pos + 1] == 0xd9) {
-            data_len = cur_pos;
-            LOGD(jpeg_logger, "find 0xff 0xd9, data_len %d", data_len);
-            return 0;
-        } else {
-            m_scan_bytes.push_back(data[cur_pos]);
-            left_bytes -= 1;
-            cur_pos += 1;
-        }
-    }
-    return 0;
-}
-
-int decode_scan_data(std::vector<uint8_t> &scan_data)
-{
-    int cur_pos = 0;
-    int left_bytes = m_scan_bytes.size();
-    std::string bitsScanned = "";
-    int HuffTableID = 0;
-    int bit_k = 0;
-    auto get_bit = [&scan_data](int k) -> char {
-        int byte_idx = k / 8;
-        int bit_idx = k % 8;
-        return (scan_data[byte_idx] >> (7 - bit_idx)) & 0x01;
-    };
-
-    auto get_next_n_bits = [&scan_data, &get_bit](int k, int n) -> int16_t {
-        int16_t val = 0;
-        for (int i = 0; i < n; i++) {
-            val = (val << 1) | get_bit(k + i);
-        }
-        return val;
-    };
-    std::vector<int16_t> RLE;
-    while(1) {
-        bitsScanned += get_bit(bit_k);
-        auto value = m_huffmanTree[0][HuffTableID].contains(bitsScanned);
-        if (value != "") {
-            int zeroCount = uint8_t(std::stoi(value)) >> 4;
-            int category = uint8_t(std::stoi(value)) & 0x0f;
-
-            int dc_coeff = get_next_n_bits(bit_k + 1, category);
-            bit_k += 1 + category;
-
-            bitsScanned = "";
-
-            LOGD(jpeg_logger, "dc_coeff %d, zeroCount %d", dc_coeff, zeroCount);
-            RLE.push_back(zeroCount);
-            RLE.push_back(dc_coeff);
-            break;
-        } else {
-            bit_k += 1;
-        }
- 
-}
-
-int decode(uint8_t *data, int len)
-{
-    int cur_pos = 0;
-    int left_bytes = len;
-
-    while(left_bytes > 0) {
-        int marker_pre_offset = 0;
-
-        auto marker = static_cast<jpeg_marker::type>(
-            next_marker(data + cur_pos, left_bytes, marker_pre_offset));
-
-        LOGD(jpeg_logger, "next marker 0x%X (%s), cur 0x%X marker_pre_offset %d, pos 0x%x",
-            marker, jpeg_marker::to_string(marker),
-            cur_pos, marker_pre_offset,
-            cur_pos + marker_pre_offset);
-
-        switch ((marker)) {
-            case jpeg_marker::type::M_SOI:
-            case jpeg_marker::type::M_EOI:
-                cur_pos += (marker_pre_offset + 2);
-                left_bytes -= (marker_pre_offset + 2);
-                break;
-            case jpeg_marker::type::M_DQT: {
-                int marker_len = 0;
-                dqt_marker(data + cur_pos + marker_pre_offset, left_bytes, marker_len);
-                cur_pos += (marker_pre_offset + 2 + marker_len);
-                left_bytes -= (marker_pre_offset + 2 + marker_len);
-            } break;
-            case jpeg_marker::type::M_SOF0: {
-                int marker_len = 0;
-                sof0_marker(data + cur_pos + marker_pre_offset, left_bytes, marker_len);
-                cur_pos += (marker_pre_offset + 2 + marker_len);
-                left_bytes -= (marker_pre_offset + 2 + marker_len);
-            } break;
-            case jpeg_marker::type::M_DHT: {
-                int marker_len = 0;
-                dht_marker(data + cur_pos + marker_pre_offset, left_bytes, marker_len);
-                cur_pos += (marker_pre_offset + 2 + marker_len);
-                left_bytes -= (marker_pre_offset + 2 + marker_len);
-            } break;
-            case jpeg_marker::type::M_SOS: {
-                int marker_len = 0;
-                sos_marker(data + cur_pos + marker_pre_offset, left_bytes, marker_len);
-                cur_pos += (marker_pre_offset + 2 + marker_len);
-                left_bytes -= (marker_pre_offset + 2 + marker_len);
-
-                int data_len = 0;
-                scan_image_data(data + cur_pos, left_bytes, data_len);
-                cur_pos += data_len;
-                left_bytes -= data_len;
-            } break;
-            default:
-                cur_pos += (marker_pre_offset + 2);
-                left_bytes -= (marker_pre_offset + 2);
-                int app_len = (data[cur_pos] << 8) | data[cur_pos + 1];
-                LOGD(jpeg_logger, "%s len %d", jpeg_marker::to_string(marker), app_len);
-                cur_pos += app_len;
-                left_bytes -= app_len;
-                break;
-        }
-    }
-
-    if (m_scan_bytes.size() == 0) {
-        LOGD(jpeg_logger, "scan bytes is empty");
-        return -1;
-    } else {
-        LOGD(jpeg_logger, "scan bytes size %d", m_scan_bytes.size());
-        // process scan data via huffman tree
-        decode_scan_data(m_scan_bytes);
-    }
-    return 0;
-}
-
-} // namespace jpeg
-
-} // zzwlib
-
-std::shared_ptr<uint8_t[]> read_file(const char *path, int &len)
-{
-    std::shared_ptr<uint8_t[]> invalid_data(nullptr);
-    FILE *fp = fopen(path, "rb");
-    if (fp == nullptr) {
-        LOGE(jpeg_logger, "open file %s failed", path);
-        return invalid_data;
-    }
-    fseek(fp, 0, SEEK_END);
-    len = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-    std::shared_ptr<uint8_t[]> data(new uint8_t[len]);
-    auto read_bytes = fread(data.get(), 1, len, fp);
-    fclose(fp);
-    if (read_bytes != len) {
-        LOGE(jpeg_logger, "read file %s failed, read %d bytes, expect %d bytes", path, read_bytes, len);
-        return invalid_data;
-    }
-    return data;
-}
-
-
-int main(int argc, char *argv[])
-{
-    int file_len = 0;
-    auto data = read_file("test.jpg", file_len);
-    zzwlib::jpeg::decode(data.get(), file_len);
-    return 0;
-}
+
+/*
+ * 解码过程： jpeg 标准中， image,frame,scan 之间的关系为：
+ * 1. image 中包含1 个 或 多个 frame；
+ *  对于 顺序（sequential）模式和 progressive 模式， 一个 image 中只有 1 个 frame；
+ *  对于 hierarchical 模式， 一个 image 中包含多个 frame；
+ * 2. frame 中包含 1 个 或 多个 scan；
+ * 3. jpeg 编码的最小单元 MCU （Minimum Coding Unit）， 一个scan 包含 1 个或多个 MCU；
+ * 4. 一个 MCU 由 1个或多个数据单元（data unit)构成，数据单元是 8x8 的数据块。
+ *  对于非交错存放方式， MCU 由 1 个数据单元构成；对于交错存放方式，MCU 由 多个数据单元构成
+ *  每通道 一个 或多个；
+ * 举例：
+ * 图 1 中，第一个MCU 包括 A1 B1 C1 三个数据单元；
+ * 图 2 中，第一个MCU 包含 A1 A2 B1 C1 4个数据单元
+*/
+
+#include <stdint.h>
+#include <memory>
+#include <vector>
+#include <array>
+#include <cmath>
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <atomic>
+
+#include "jpeg.hpp"
+#include "huffman.hpp"
+#include "bit_reader.hpp"
+#include "idct.hpp"
+#include "../logger.hpp"
+#include "../thread_pool.hpp"
+
+zzwlib::logger  jpeg_logger("jpeg", zzwlib::loglevel::log_verbose_level);
+
+namespace zzwlib{
+    namespace jpeg {
+
+class jpeg_marker {
+public:
+    // must based on uint, convert MARKER start with 0xFx correctly.
+    enum class type : uint32_t {
+        M_SOF0  = 0xC0,
+        M_SOF1  = 0xC1,
+        M_SOF2  = 0xC2,
+        M_SOF3  = 0xC3,
+        M_DHT   = 0xC4,
+        M_SOF5  = 0xC5,
+        M_SOF6  = 0xC6,
+        M_SOF7  = 0xC7,
+        M_JPG   = 0xC8,
+        M_SOF9  = 0xC9,
+        M_SOF10 = 0xCA,
+        M_SOF11 = 0xCB,
+        M_DAC   = 0xCC,
+        M_SOF13 = 0xCD,
+        M_SOF14 = 0xCE,
+        M_SOF15 = 0xCF,
+        M_RST0  = 0xD0,
+        M_RST1  = 0xD1,
+        M_RST2  = 0xD2,
+        M_RST3  = 0xD3,
+        M_RST4  = 0xD4,
+        M_RST5  = 0xD5,
+        M_RST6  = 0xD6,
+        M_RST7  = 0xD7,
+        M_SOI   = 0xD8,
+        M_EOI   = 0xD9,
+        M_SOS   = 0xDA,
+        M_DQT   = 0xDB,
+        M_DNL   = 0xDC,
+        M_DRI   = 0xDD,
+        M_DHP   = 0xDE,
+        M_EXP   = 0xDF,
+        M_APP0  = 0xE0,
+        M_APP1  = 0xE1,
+        M_APP2  = 0xE2,
+        M_APP3  = 0xE3,
+        M_APP4  = 0xE4,
+        M_APP5  = 0xE5,
+        M_APP6  = 0xE6,
+        M_APP7  = 0xE7,
+        M_APP8  = 0xE8,
+        M_APP9  = 0xE9,
+        M_APP15 = 0xEF,
+        M_JPG0  = 0xF0,
+        M_JPG13 = 0xFD,
+        M_COM   = 0xFE,
+
+        M_TEM   = 0x01,
+        M_ERROR = 0x100,
+        RST0   = 0xD0
+    };
+    static const char *to_string(type t) {
+        switch (t) {
+        case type::M_SOF0: return "SOF0";
+        case type::M_SOF1: return "SOF1";
+        case type::M_SOF2: return "SOF2";
+        case type::M_SOF3: return "SOF3";
+        case type::M_DHT: return "DHT";
+        case type::M_SOF5: return "SOF5";
+        case type::M_SOF6: return "SOF6";
+        case type::M_SOF7: return "SOF7";
+        case type::M_JPG: return "JPG";
+        case type::M_SOF9: return "SOF9";
+        case type::M_SOF10: return "SOF10";
+        case type::M_SOF11: return "SOF11";
+        case type::M_DAC: return "DAC";
+        case type::M_SOF13: return "SOF13";
+        case type::M_SOF14: return "SOF14";
+        case type::M_SOF15: return "SOF15";
+        case type::M_RST0: return "RST0";
+        case type::M_RST1: return "RST1";
+        case type::M_RST2: return "RST2";
+        case type::M_RST3: return "RST3";
+        case type::M_RST4: return "RST4";
+        case type::M_RST5: return "RST5";
+        case type::M_RST6: return "RST6";
+        case type::M_RST7: return "RST7";
+        case type::M_SOI: return "SOI";
+        case type::M_EOI: return "EOI";
+        case type::M_SOS: return "SOS";
+        case type::M_DQT: return "DQT";
+        case type::M_DNL: return "DNL";
+        case type::M_DRI: return "DRI";
+        case type::M_DHP: return "DHP";
+        case type::M_EXP: return "EXP";
+        case type::M_APP0: return "APP0";
+        case type::M_APP1: return "APP1";
+        case type::M_APP2: return "APP2";
+        case type::M_APP3: return "APP3";
+        case type::M_APP4: return "APP4";
+        case type::M_APP5: return "APP5";
+        case type::M_APP6: return "APP6";
+        case type::M_APP7: return "APP7";
+        case type::M_APP8: return "APP8";
+        case type::M_APP9: return "APP9";
+        case type::M_APP15: return "APP15";
+        case type::M_JPG0: return "JPG0";
+        case type::M_JPG13: return "JPG13";
+        case type::M_COM: return "COM";
+        case type::M_TEM: return "TEM";
+        case type::M_ERROR: return "ERROR";
+        default: return "UNKNOWN";
+        }
+    }
+};
+
+const std::pair<int, int> zzOrderToMatIndices(int zzIndex)
+{
+    static const std::pair<int, int> zzOrderToMatIndices[64] = {
+        { 0, 0 },
+        { 0, 1 }, { 1, 0 },
+        { 2, 0 }, { 1, 1 }, { 0, 2 },
+        { 0, 3 }, { 1, 2 }, { 2, 1 }, { 3, 0 },
+        { 4, 0 }, { 3, 1 }, { 2, 2 }, { 1, 3 }, { 0, 4 },
+        { 0, 5 }, { 1, 4 }, { 2, 3 }, { 3, 2 }, { 4, 1 }, { 5, 0 },
+        { 6, 0 }, { 5, 1 }, { 4, 2 }, { 3, 3 }, { 2, 4 }, { 1, 5 }, { 0, 6 },
+        { 0, 7 }, { 1, 6 }, { 2, 5 }, { 3, 4 }, { 4, 3 }, { 5, 2 }, { 6, 1 }, { 7, 0 },
+        { 7, 1 }, { 6, 2 }, { 5, 3 }, { 4, 4 }, { 3, 5 }, { 2, 6 }, { 1, 7 },
+        { 2, 7 }, { 3, 6 }, { 4, 5 }, { 5, 4 }, { 6, 3 }, { 7, 2 },
+        { 7, 3 }, { 6, 4 }, { 5, 5 }, { 4, 6 }, { 3, 7 },
+        { 4, 7 }, { 5, 6 }, { 6, 5 }, { 7, 4 },
+        { 7, 5 }, { 6, 6 }, { 5, 7 },
+        { 6, 7 }, { 7, 6 },
+        { 7, 7 }
+    };
+    return zzOrderToMatIndices[zzIndex];
+}
+
+int valCategory(int val)
+{
+    if (val < 0) {
+        val = -val;
+    }
+    if (val == 0) {
+        return 0;
+    }
+    int n = 0;
+    while (val > 0) {
+        n++;
+        val >>= 1;
+    }
+    return n;
+}
+
+int matIndicesToZOrder(int i, int j)
+{
+    static const int matZOrder[8][8] = {
+        { 0, 1, 5, 6, 14, 15, 27, 28 },
+        { 2, 4, 7, 13, 16, 26, 29, 42 },
+        { 3, 8, 12, 17, 25, 30, 41, 43 },
+        { 9, 11, 18, 24, 31, 40, 44, 53 },
+        { 10, 19, 23, 32, 39, 45, 52, 54 },
+        { 20, 22, 33, 38, 46, 51, 55, 60 },
+        { 21, 34, 37, 47, 50, 56, 59, 61 },
+        { 35, 36, 48, 49, 57, 58, 62, 63 }
+    };
+    return matZOrder[i][j];
+}
+
+// MCUs a restart interval thread gets at least
+const int min_mcus_per_thread = 64;
+
+// return: 0 or positive, next marker pos.
+static uint32_t next_marker(const uint8_t *data, int len, int &pos) {
+    pos = 0;
+    while (pos < len - 1) {
+        if (data[pos] == 0xff) {
+            uint32_t marker = data[pos + 1];
+            if (marker == 0xff) {
+                pos += 1;
+                continue;
+            }
+            if (marker == 0x00) {
+                pos += 2;
+                continue;
+            }
+            return marker;
+        }
+        pos++;
+    }
+    return 0;
+}
+
+int probe(const uint8_t *data, int len, image_info &info)
+{
+    info = image_info();
+    if (len < 2) {
+        return 1;
+    }
+    if (data[0] != 0xff || data[1] != (uint8_t)jpeg_marker::type::M_SOI) {
+        LOGD(jpeg_logger, "probe, no SOI");
+        return -1;
+    }
+
+    int pos = 2;
+    while (pos < len) {
+        int marker_pre_offset = 0;
+        uint32_t marker = next_marker(data + pos, len - pos, marker_pre_offset);
+        if (marker == 0) {
+            return 1;
+        }
+        pos += marker_pre_offset;
+
+        auto type = static_cast<jpeg_marker::type>(marker);
+        if (type == jpeg_marker::type::M_SOS || type == jpeg_marker::type::M_EOI) {
+            LOGD(jpeg_logger, "probe, %s before SOF", jpeg_marker::to_string(type));
+            return -1;
+        }
+        if (type == jpeg_marker::type::M_TEM || (marker >= 0xD0 && marker <= 0xD8)) {
+            // RSTn / SOI / TEM, no length
+            pos += 2;
+            continue;
+        }
+
+        // 2 bytes marker, 2 bytes - len
+        if (len - pos < 4) {
+            return 1;
+        }
+        int seg_len = 2 + ((data[pos + 2] << 8) | data[pos + 3]);
+        if (seg_len < 4) {
+            LOGD(jpeg_logger, "probe, %s invalid length %d", jpeg_marker::to_string(type), seg_len - 2);
+            return -1;
+        }
+
+        // SOFn: 0xC0 - 0xCF without DHT (0xC4), JPG (0xC8) and DAC (0xCC)
+        bool sof = (marker & 0xf0) == 0xc0 && marker != 0xc4 && marker != 0xc8 && marker != 0xcc;
+        if (!sof) {
+            // the segment may end past data, the next marker is found once it is there
+            pos += seg_len;
+            continue;
+        }
+        if (len - pos < seg_len) {
+            return 1;
+        }
+
+        // 1 byte - sample_precision, 2 bytes - height, 2 bytes - width, 1 byte - num_components,
+        // num_components * 3 bytes - id, h_samp << 4 | v_samp, quant table
+        const uint8_t *seg = data + pos + 4;
+        int comps = seg_len >= 10 ? seg[5] : 0;
+        if (comps < 1 || comps > 4 || seg_len < 10 + 3 * comps) {
+            LOGD(jpeg_logger, "probe, %s with %d components", jpeg_marker::to_string(type), comps);
+            return -1;
+        }
+        info.precision = seg[0];
+        info.height = (seg[1] << 8) | seg[2];
+        info.width = (seg[3] << 8) | seg[4];
+        info.components = comps;
+        for (int i = 0; i < comps; i++) {
+            const uint8_t *c = seg + 6 + 3 * i;
+            info.component_id[i] = c[0];
+            info.h_samp[i] = c[1] >> 4;
+            info.v_samp[i] = c[1] & 0x0f;
+            if (info.h_samp[i] < 1 || info.h_samp[i] > 4 || info.v_samp[i] < 1 || info.v_samp[i] > 4) {
+                LOGD(jpeg_logger, "probe, invalid component %d", c[0]);
+                return -1;
+            }
+        }
+        info.sof_marker = (int)marker;
+        info.progressive = (marker & 0x03) == 0x02;
+        info.supported = marker <= 0xc2 && info.precision == 8 && info.width > 0 && info.height > 0;
+        info.header_len = pos + seg_len;
+        return 0;
+    }
+    return 1;
+}
+
+int jpeg_decoder::dqt_marker(const uint8_t *data, int len, int &marker_len)
+{
+    // 2 bytes marker
+    // 2 bytes - len
+    // n times:
+    // 1 byte - low 4 bits: table id; high 4 bits: precision (0: 8-bit, 1: 16-bit)
+    // 64 * (precision + 1) bytes - table data
+
+    int cur_pos = 0;
+    int left_bytes = len;
+    // skip marker & length
+    cur_pos += 2;
+    left_bytes -= 2;
+
+    marker_len = (data[cur_pos] << 8) | data[cur_pos + 1];
+    cur_pos += 2;
+
+    if (left_bytes < marker_len) {
+        LOGD(jpeg_logger, "left bytes %d < marker len %d", left_bytes, marker_len);
+        return -1;
+    }
+    left_bytes = marker_len - 2;
+
+    // one DQT may carry several tables
+    while (left_bytes > 0) {
+        // 1 byte - low 4 bits: table id; high 4 bits: precision (0: 8-bit, 1: 16-bit)
+        auto table_id = data[cur_pos] & 0x0f;
+        auto precision = (data[cur_pos] >> 4) & 0x0f;
+        cur_pos += 1;
+        left_bytes -= 1;
+
+        LOGD(jpeg_logger, "table id %d, precision %d", table_id, precision);
+
+        if (table_id > 3 || precision > 1 || left_bytes < 64 * (precision + 1)) {
+            LOGE(jpeg_logger, "invalid quant table id %d, precision %d", table_id, precision);
+            return -1;
+        }
+        // a table id may be redefined by a later DQT
+        for (int i = 0; i < 64; i++) {
+            uint16_t val = 0;
+            if (precision == 0) {
+                val = data[cur_pos];
+                cur_pos += 1;
+            } else {
+                val = (data[cur_pos] << 8) | data[cur_pos + 1];
+                cur_pos += 2;
+            }
+            m_quant_tbl[table_id][i] = val;
+        }
+        left_bytes -= 64 * (precision + 1);
+
+        // the table is stored in zigzag order
+        uint16_t natural[64];
+        for (int i = 0; i < 64; i++) {
+            auto [row, col] = zzOrderToMatIndices(i);
+            natural[row * 8 + col] = m_quant_tbl[table_id][i];
+        }
+        prepare_idct_qtable(natural, m_idct_qtbl[table_id]);
+        m_quant_defined[table_id] = true;
+    }
+
+    return 0;
+}
+
+int jpeg_decoder::dht_marker(const uint8_t *data, int len, int &marker_len)
+{
+    // 2 bytes marker
+    // 2 bytes - len
+    // n times:
+    // 1 byte - low 4 bits: table id; high 4 bits: table type (0 : DC, 1: AC)
+    // 16 bytes - # of codes of each length
+    // sum of the 16 counts bytes - symbols
+
+    int cur_pos = 0;
+    int left_bytes = len;
+    // skip marker & length
+    cur_pos += 2;
+    left_bytes -= 2;
+
+    marker_len = (data[cur_pos] << 8) | data[cur_pos + 1];
+    cur_pos += 2;
+
+    if (left_bytes < marker_len) {
+        LOGD(jpeg_logger, "left bytes %d < marker len %d", left_bytes, marker_len);
+        return -1;
+    }
+    left_bytes = marker_len - 2;
+
+    // one DHT may carry several tables
+    while (left_bytes > 0) {
+        // 1 byte - low 4 bits: table id; high 4 bits: table type (0 : DC, 1: AC)
+        auto table_id = data[cur_pos] & 0x0f;
+        auto table_type = (data[cur_pos] >> 4) & 0x0f;
+        cur_pos += 1;
+        left_bytes -= 1;
+        LOGD(jpeg_logger, "table id %d, table type %d(%s)", table_id, table_type, table_type == 0 ? "DC" : "AC");
+
+        if (table_id > 3 || table_type > 1 || left_bytes < 16) {
+            LOGE(jpeg_logger, "invalid huffman table, type %d id %d", table_type, table_id);
+            return -1;
+        }
+
+        int count = 0;
+
+        // a table id may be redefined by a later DHT, the rows keep their memory
+        HuffmanTable &table = m_huffmanTable[table_type][table_id];
+        table.resize(16);
+        for (int i = 0; i < 16; i++) {
+            HuffmanRow &row = table[i];
+            row.num = data[cur_pos];
+            row.val_list.clear();
+            cur_pos += 1;
+
+            count += row.num;
+        }
+        left_bytes -= 16;
+        if (left_bytes < count) {
+            LOGE(jpeg_logger, "huffman table, %d symbols, %d bytes left", count, left_bytes);
+            return -1;
+        }
+
+        int row_idx = 0;
+        for (int i = 0; i < count; i++) {
+            uint8_t code = data[cur_pos];
+            cur_pos += 1;
+
+            while(table[row_idx].num == 0) {
+                row_idx++;
+            }
+            table[row_idx].val_list.push_back(code);
+            if (table[row_idx].num == (int)table[row_idx].val_list.size())
+                row_idx++;
+        }
+        left_bytes -= count;
+
+        if (m_huffmanDecoder[table_type][table_id].build(table) != 0) {
+            LOGE(jpeg_logger, "invalid huffman table, type %d id %d", table_type, table_id);
+            return -1;
+        }
+        m_huffman_defined[table_type][table_id] = true;
+    }
+
+    return 0;
+}
+
+int jpeg_decoder::sof0_marker(const uint8_t *data, int len, int &marker_len)
+{
+    // 2 bytes marker
+    // 2 bytes - len
+    // 1 byte - sample_precision
+    // 2 bytes - height
+    // 2 bytes - width
+    // 1 byte - num_components
+    // num_components bytes * 3 - component info
+
+    int cur_pos = 0;
+    int left_bytes = len;
+
+    // skip marker & length
+    cur_pos += 2;
+    left_bytes -= 2;
+
+    marker_len = (data[cur_pos] << 8) | data[cur_pos + 1];
+    cur_pos += 2;
+
+    if (left_bytes < marker_len) {
+        LOGD(jpeg_logger, "left bytes %d < marker len %d", left_bytes, marker_len);
+        return -1;
+    }
+    left_bytes = marker_len - 2;
+
+    auto precision = data[cur_pos];
+    cur_pos += 1;
+    if (precision != 8) {
+        LOGE(jpeg_logger, "sample precision %d, only support precision 8", precision);
+        return -1;
+    }
+
+    m_image_y_size = (data[cur_pos] << 8) | data[cur_pos + 1];
+    cur_pos += 2;
+
+    m_image_x_size = (data[cur_pos] << 8) | data[cur_pos + 1];
+    cur_pos += 2;
+
+    m_comps_in_frame = data[cur_pos];
+    cur_pos += 1;
+
+    if (m_comps_in_frame < 1 || m_comps_in_frame > 4 || left_bytes < 6 + 3 * m_comps_in_frame
+        || m_image_x_size == 0 || m_image_y_size == 0) {
+        LOGE(jpeg_logger, "invalid frame %dx%d, %d components", m_image_x_size, m_image_y_size, m_comps_in_frame);
+        return -1;
+    }
+
+    m_max_h_samp = 1;
+    m_max_v_samp = 1;
+    for (int i = 0; i < m_comps_in_frame; i++)
+    {
+        // 1 byte - id, 1 byte - high 4 bits: h_samp; low 4 bits: v_samp, 1 byte - quant table
+        m_comp_ident[i]  = data[cur_pos]; cur_pos += 1;
+        m_comp_h_samp[i] = (data[cur_pos] >> 4) & 0x0f;
+        m_comp_v_samp[i] = data[cur_pos] & 0x0f;
+        cur_pos += 1;
+        m_comp_quant[i]  = data[cur_pos]; cur_pos += 1;
+        LOGD(jpeg_logger, "component %d, h_samp %d, v_samp %d, quant %d",
+            m_comp_ident[i], m_comp_h_samp[i], m_comp_v_samp[i], m_comp_quant[i]);
+        if (m_comp_h_samp[i] < 1 || m_comp_h_samp[i] > 4 || m_comp_v_samp[i] < 1 || m_comp_v_samp[i] > 4
+            || m_comp_quant[i] > 3) {
+            LOGE(jpeg_logger, "invalid component %d", m_comp_ident[i]);
+            return -1;
+        }
+        m_max_h_samp = std::max(m_max_h_samp, m_comp_h_samp[i]);
+        m_max_v_samp = std::max(m_max_v_samp, m_comp_v_samp[i]);
+    }
+    LOGD(jpeg_logger, "image size %dx%d, %d components", m_image_x_size, m_image_y_size, m_comps_in_frame);
+
+    if (marker_len != cur_pos - 2)  {
+        LOGD(jpeg_logger, "sof0 marker len %d, actual len %d", marker_len, cur_pos - 2);
+    }
+
+    // preallocate the output planes, MCU aligned so whole blocks can be written.
+    // scaled decoding: a block gives 8 / scale samples per side.
+    m_block_size = 8 / m_scale;
+    m_out_x_size = (m_image_x_size + m_scale - 1) / m_scale;
+    m_out_y_size = (m_image_y_size + m_scale - 1) / m_scale;
+    m_mcus_x = (m_image_x_size + 8 * m_max_h_samp - 1) / (8 * m_max_h_samp);
+    m_mcus_y = (m_image_y_size + 8 * m_max_v_samp - 1) / (8 * m_max_v_samp);
+    if (set_window() != 0) {
+        return -1;
+    }
+    for (int i = 0; i < m_comps_in_frame; i++) {
+        image_plane &plane = m_planes[i];
+        int comp_width = (m_image_x_size * m_comp_h_samp[i] + m_max_h_samp - 1) / m_max_h_samp;
+        int comp_height = (m_image_y_size * m_comp_v_samp[i] + m_max_v_samp - 1) / m_max_v_samp;
+        m_comp_blocks_x[i] = (comp_width + 7) / 8;
+        m_comp_blocks_y[i] = (comp_height + 7) / 8;
+        if (m_cropped) {
+            // the window starts on a MCU boundary: samples of the window's own size
+            plane.width = (m_out_x_size * m_comp_h_samp[i] + m_max_h_samp - 1) / m_max_h_samp;
+            plane.height = (m_out_y_size * m_comp_v_samp[i] + m_max_v_samp - 1) / m_max_v_samp;
+        } else {
+            plane.width = (comp_width + m_scale - 1) / m_scale;
+            plane.height = (comp_height + m_scale - 1) / m_scale;
+        }
+        plane.stride = m_win_mcus_x * m_comp_h_samp[i] * m_block_size;
+        if (m_coefficients_only) {
+            plane.data.clear();
+        } else {
+            plane.data.assign((size_t)plane.stride * m_win_mcus_y * m_comp_v_samp[i] * m_block_size, 0);
+        }
+        if (m_progressive || m_coefficients_only) {
+            // int16 blocks (zigzag order) of the whole component, row by row of blocks
+            m_coef_blocks_x[i] = m_mcus_x * m_comp_h_samp[i];
+            m_coefs[i].assign((size_t)m_coef_blocks_x[i] * m_mcus_y * m_comp_v_samp[i] * 64, 0);
+        }
+    }
+    m_scans_done = 0;
+    m_preview_ready = false;
+    return 0;
+}
+
+// MCU window of the planes, from the crop rectangle (in scaled image pixels)
+int jpeg_decoder::set_window()
+{
+    m_cropped = m_crop_req[2] > 0 && m_crop_req[3] > 0 && !m_coefficients_only;
+    m_crop_x = 0;
+    m_crop_y = 0;
+    m_win_mcu_x0 = 0;
+    m_win_mcu_y0 = 0;
+    m_win_mcus_x = m_mcus_x;
+    m_win_mcus_y = m_mcus_y;
+    if (!m_cropped) {
+        return 0;
+    }
+
+    int x1 = std::min(m_out_x_size, m_crop_req[0] + m_crop_req[2]);
+    int y1 = std::min(m_out_y_size, m_crop_req[1] + m_crop_req[3]);
+    if (m_crop_req[0] >= x1 || m_crop_req[1] >= y1) {
+        LOGE(jpeg_logger, "crop %d,%d %dx%d is outside the %dx%d image",
+            m_crop_req[0], m_crop_req[1], m_crop_req[2], m_crop_req[3], m_out_x_size, m_out_y_size);
+        return -1;
+    }
+    // image pixels per MCU
+    int mcu_w = m_block_size * m_max_h_samp;
+    int mcu_h = m_block_size * m_max_v_samp;
+    m_win_mcu_x0 = m_crop_req[0] / mcu_w;
+    m_win_mcu_y0 = m_crop_req[1] / mcu_h;
+    m_win_mcus_x = (x1 + mcu_w - 1) / mcu_w - m_win_mcu_x0;
+    m_win_mcus_y = (y1 + mcu_h - 1) / mcu_h - m_win_mcu_y0;
+    m_crop_x = m_win_mcu_x0 * mcu_w;
+    m_crop_y = m_win_mcu_y0 * mcu_h;
+    m_out_x_size = x1 - m_crop_x;
+    m_out_y_size = y1 - m_crop_y;
+    LOGD(jpeg_logger, "crop %d,%d %dx%d, MCUs %d,%d %dx%d", m_crop_x, m_crop_y, m_out_x_size, m_out_y_size,
+        m_win_mcu_x0, m_win_mcu_y0, m_win_mcus_x, m_win_mcus_y);
+    return 0;
+}
+
+// block bx, by (component block grid) is in the MCU window
+inline bool jpeg_decoder::block_in_window(int comp, int bx, int by) const
+{
+    int x = bx - m_win_mcu_x0 * m_comp_h_samp[comp];
+    int y = by - m_win_mcu_y0 * m_comp_v_samp[comp];
+    return x >= 0 && x < m_win_mcus_x * m_comp_h_samp[comp] && y >= 0 && y < m_win_mcus_y * m_comp_v_samp[comp];
+}
+
+int jpeg_decoder::sos_marker(const uint8_t *data, int len, int &marker_len)
+{
+    // 2 bytes marker
+    // 2 bytes - len
+    // 1 byte - num_components
+    // num_components bytes * 2 - component info
+    // 1 byte spectral start
+    // 1 byte spectral end
+    // 1 byte high 4 bits: successive_high; low 4 bits: successive_low
+
+    int cur_pos = 0;
+    int left_bytes = len;
+
+    // skip marker & length
+    cur_pos += 2;
+    left_bytes -= 2;
+
+    marker_len = (data[cur_pos] << 8) | data[cur_pos + 1];
+    cur_pos += 2;
+
+    if (left_bytes < marker_len) {
+        LOGD(jpeg_logger, "left bytes %d < marker len %d", left_bytes, marker_len);
+        return -1;
+    }
+    left_bytes = marker_len - 2;
+
+    m_comps_in_scan = data[cur_pos];
+    cur_pos += 1;
+
+    if (m_comps_in_scan < 1 || m_comps_in_scan > 4 || left_bytes < 4 + 2 * m_comps_in_scan) {
+        LOGE(jpeg_logger, "invalid scan, %d components", m_comps_in_scan);
+        return -1;
+    }
+
+    for (int i = 0; i < m_comps_in_scan; i++) {
+        // 1byte的颜色分量id，
+        // 1byte的直流/交流系数表号（高4位：直流分量所使用的哈夫曼树编号，低4位：交流分量使用的哈夫曼树的编号）
+        auto comp_id = data[cur_pos]; cur_pos += 1;
+
+        auto ac_huff_table_id = data[cur_pos] & 0x0f;
+        auto dc_huff_table_id = (data[cur_pos] >> 4) & 0x0f;
+        cur_pos += 1;
+
+        LOGD(jpeg_logger, "component %d, ac_huff_table_id %d, dc_huff_table_id %d",
+            comp_id, ac_huff_table_id, dc_huff_table_id);
+
+        m_scan_comp[i] = -1;
+        for (int c = 0; c < m_comps_in_frame; c++) {
+            if (m_comp_ident[c] == comp_id) {
+                m_scan_comp[i] = c;
+            }
+        }
+        if (m_scan_comp[i] < 0 || ac_huff_table_id > 3 || dc_huff_table_id > 3) {
+            LOGE(jpeg_logger, "invalid scan component %d", comp_id);
+            return -1;
+        }
+        m_scan_dc_tbl[i] = dc_huff_table_id;
+        m_scan_ac_tbl[i] = ac_huff_table_id;
+    }
+
+    m_spectral_start = data[cur_pos]; cur_pos += 1;
+    m_spectral_end = data[cur_pos]; cur_pos += 1;
+    m_succ_high = (data[cur_pos] >> 4) & 0x0f;
+    m_succ_low = data[cur_pos] & 0x0f;
+    cur_pos += 1;
+
+    if (m_progressive) {
+        // DC scans may be interleaved, AC scans have one component; Al < 14 keeps int16 in range
+        if (m_spectral_end > 63 || m_spectral_start > m_spectral_end || m_succ_low > 13
+            || (m_spectral_start == 0 && m_spectral_end != 0)
+            || (m_spectral_start > 0 && m_comps_in_scan != 1)
+            || (m_succ_high != 0 && m_succ_high != m_succ_low + 1)) {
+            LOGE(jpeg_logger, "invalid progressive scan, Ss %d Se %d Ah %d Al %d",
+                m_spectral_start, m_spectral_end, m_succ_high, m_succ_low);
+            return -1;
+        }
+    } else if (m_spectral_start != 0 || m_spectral_end != 63 || m_succ_high != 0 || m_succ_low != 0) {
+        LOGE(jpeg_logger, "not a sequential scan, Ss %d Se %d Ah %d Al %d",
+            m_spectral_start, m_spectral_end, m_succ_high, m_succ_low);
+        return -1;
+    }
+
+    // tables must come from this image, never from a previous one.
+    // progressive DC scans only use DC tables, AC scans only AC tables.
+    bool need_dc = m_spectral_start == 0 && m_succ_high == 0;
+    bool need_ac = m_spectral_start > 0 || !m_progressive;
+    for (int i = 0; i < m_comps_in_scan; i++) {
+        if ((need_dc && !m_huffman_defined[0][m_scan_dc_tbl[i]])
+            || (need_ac && !m_huffman_defined[1][m_scan_ac_tbl[i]])
+            || !m_quant_defined[m_comp_quant[m_scan_comp[i]]]) {
+            LOGE(jpeg_logger, "scan component %d uses undefined tables", m_comp_ident[m_scan_comp[i]]);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// find the end of the entropy coded segment: the first marker other than RSTn.
+// restarts: if not null, gets the offset where each restart interval starts (0 first).
+static int scan_image_data(const uint8_t *data, int len, int &data_len, std::vector<int> *restarts = nullptr)
+{
+    int cur_pos = 0;
+
+    data_len = len;
+    if (restarts != nullptr) {
+        restarts->clear();
+        restarts->push_back(0);
+    }
+    LOGD(jpeg_logger, "scan_image_data, len %d", len);
+    while (cur_pos < len - 1) {
+        auto *p = static_cast<const uint8_t *>(memchr(data + cur_pos, 0xff, len - 1 - cur_pos));
+        if (p == nullptr) {
+            break;
+        }
+        cur_pos = p - data;
+        uint8_t next = data[cur_pos + 1];
+        if (next == 0xff) {
+            cur_pos += 1;
+        } else if (next == 0x00) {
+            cur_pos += 2;
+        } else if (next >= 0xd0 && next <= 0xd7) {
+            cur_pos += 2;
+            if (restarts != nullptr) {
+                restarts->push_back(cur_pos);
+            }
+        } else {
+            data_len = cur_pos;
+            LOGD(jpeg_logger, "find 0xff 0x%x, data_len %d", next, data_len);
+            return 0;
+        }
+    }
+    LOGD(jpeg_logger, "no marker after scan data");
+    return -1;
+}
+
+// decode one block of a sequential scan into zigzag ordered coefficients.
+// zz must be zeroed by the caller.
+// return: zigzag index of the last non zero coefficient, -1 on a bad code.
+static inline int decode_block(bit_reader &reader, const huffman_decoder &dc, const huffman_decoder &ac,
+                        int &dc_pred, int16_t *zz)
+{
+    int code_len = 0;
+    int category = dc.decode(reader.peek(16), code_len);
+    if (category < 0) {
+        return -1;
+    }
+    reader.consume(code_len);
+
+    // DC_i = DC_i-1 + diff
+    dc_pred += reader.receive_extend(category & 0x0f);
+    zz[0] = (int16_t)dc_pred;
+
+    int last_nz = 0;
+    for (int k = 1; k < 64; k++) {
+        int value = ac.decode(reader.peek(16), code_len);
+        if (value < 0) {
+            return -1;
+        }
+        reader.consume(code_len);
+
+        int zeroCount = value >> 4;
+        int size = value & 0x0f;
+        if (size == 0) {
+            if (zeroCount != 15) {
+                // EOB
+                break;
+            }
+            // ZRL, 16 zeros
+            k += 15;
+            continue;
+        }
+        k += zeroCount;
+        if (k > 63) {
+            return -1;
+        }
+        zz[k] = (int16_t)reader.receive_extend(size);
+        last_nz = k;
+    }
+    return last_nz;
+}
+
+// entropy decode, dequantize and idct one block straight into the component plane
+inline int jpeg_decoder::decode_block_to_plane(bit_reader &reader, int scan_idx, int &dc_pred, int bx, int by)
+{
+    int comp = m_scan_comp[scan_idx];
+    image_plane &plane = m_planes[comp];
+    alignas(32) int16_t zz[64];
+    alignas(32) int16_t coef[64];
+
+    memset(zz, 0, sizeof(zz));
+    int last_nz = decode_block(reader,
+                               m_huffmanDecoder[0][m_scan_dc_tbl[scan_idx]],
+                               m_huffmanDecoder[1][m_scan_ac_tbl[scan_idx]],
+                               dc_pred, zz);
+    if (last_nz < 0) {
+        return -1;
+    }
+    if (m_coefficients_only) {
+        memcpy(m_coefs[comp].data() + ((size_t)by * m_coef_blocks_x[comp] + bx) * 64, zz, sizeof(zz));
+        return 0;
+    }
+    if (m_cropped) {
+        // outside the window the block only keeps the DC prediction going
+        if (!block_in_window(comp, bx, by)) {
+            return 0;
+        }
+        bx -= m_win_mcu_x0 * m_comp_h_samp[comp];
+        by -= m_win_mcu_y0 * m_comp_v_samp[comp];
+    }
+    int size = m_block_size;
+    uint8_t *out = plane.data.data() + (size_t)by * size * plane.stride + bx * size;
+    if (size == 1) {
+        // 1/8: the DC is all that is needed, zz[0] is also the natural order DC
+        m_idct.transform_scaled(zz, m_idct_qtbl[m_comp_quant[comp]], 0, 1, out, plane.stride);
+        return 0;
+    }
+    m_idct.kernels().dezigzag(zz, coef);
+    m_idct.transform_scaled(coef, m_idct_qtbl[m_comp_quant[comp]], last_nz, size, out, plane.stride);
+    return 0;
+}
+
+// progressive scans (jpeg spec G.1.2): coefficients are accumulated in m_coefs,
+// the idct runs once all scans are in (or for a preview).
+inline int jpeg_decoder::decode_block_progressive(bit_reader &reader, int scan_idx, int &dc_pred, int &eobrun,
+                                                  int bx, int by)
+{
+    int comp = m_scan_comp[scan_idx];
+    int16_t *coef = m_coefs[comp].data() + ((size_t)by * m_coef_blocks_x[comp] + bx) * 64;
+    int code_len = 0;
+
+    if (m_spectral_start == 0) {
+        if (m_succ_high == 0) {
+            // DC first scan: the DC difference, scaled by 2^Al
+            int category = m_huffmanDecoder[0][m_scan_dc_tbl[scan_idx]].decode(reader.peek(16), code_len);
+            if (category < 0) {
+                return -1;
+            }
+            reader.consume(code_len);
+            dc_pred += reader.receive_extend(category & 0x0f);
+            coef[0] = (int16_t)(dc_pred * (1 << m_succ_low));
+        } else if (reader.get_bits(1)) {
+            // DC refinement: one more bit
+            coef[0] |= (int16_t)(1 << m_succ_low);
+        }
+        return 0;
+    }
+
+    const huffman_decoder &ac = m_huffmanDecoder[1][m_scan_ac_tbl[scan_idx]];
+    int k = m_spectral_start;
+
+    if (m_succ_high == 0) {
+        // AC first scan
+        if (eobrun > 0) {
+            eobrun--;
+            return 0;
+        }
+        for (; k <= m_spectral_end; k++) {
+            int value = ac.decode(reader.peek(16), code_len);
+            if (value < 0) {
+                return -1;
+            }
+            reader.consume(code_len);
+            int r = value >> 4;
+            int size = value & 0x0f;
+            if (size != 0) {
+                k += r;
+                if (k > m_spectral_end) {
+                    return -1;
+                }
+                coef[k] = (int16_t)(reader.receive_extend(size) * (1 << m_succ_low));
+            } else if (r == 15) {
+                k += 15;
+            } else {
+                // EOBn: this and the next 2^r + bits - 1 blocks end here
+                eobrun = (1 << r) + (int)reader.get_bits(r) - 1;
+                break;
+            }
+        }
+        return 0;
+    }
+
+    // AC refinement: a correction bit for every non zero coefficient in the band,
+    // new coefficients are +-2^Al
+    int p1 = 1 << m_succ_low;
+    int m1 = -p1;
+    if (eobrun == 0) {
+        for (; k <= m_spectral_end; k++) {
+            int value = ac.decode(reader.peek(16), code_len);
+            if (value < 0) {
+                return -1;
+            }
+            reader.consume(code_len);
+            int r = value >> 4;
+            int size = value & 0x0f;
+            int new_coef = 0;
+            if (size != 0) {
+                if (size != 1) {
+                    return -1;
+                }
+                new_coef = reader.get_bits(1) ? p1 : m1;
+            } else if (r != 15) {
+                eobrun = (1 << r) + (int)reader.get_bits(r);
+                break;
+            }
+            // skip r zero coefficients, refining the non zero ones on the way
+            do {
+                int16_t &c = coef[k];
+                if (c != 0) {
+                    if (reader.get_bits(1) && (c & p1) == 0) {
+                        c += (int16_t)(c >= 0 ? p1 : m1);
+                    }
+                } else {
+                    if (--r < 0) {
+                        break;
+                    }
+                }
+                k++;
+            } while (k <= m_spectral_end);
+            if (new_coef != 0 && k <= m_spectral_end) {
+                coef[k] = (int16_t)new_coef;
+            }
+        }
+    }
+    if (eobrun > 0) {
+        // rest of the band in an EOB run: only correction bits
+        for (; k <= m_spectral_end; k++) {
+            int16_t &c = coef[k];
+            if (c != 0 && reader.get_bits(1) && (c & p1) == 0) {
+                c += (int16_t)(c >= 0 ? p1 : m1);
+            }
+        }
+        eobrun--;
+    }
+    return 0;
+}
+
+// idct of the accumulated coefficients into the planes
+void jpeg_decoder::render_coefficients()
+{
+    alignas(32) int16_t coef[64];
+    int size = m_block_size;
+
+    for (int c = 0; c < m_comps_in_frame; c++) {
+        image_plane &plane = m_planes[c];
+        const idct_qtable &qt = m_idct_qtbl[m_comp_quant[c]];
+        // the blocks of the window
+        int blocks_x = m_win_mcus_x * m_comp_h_samp[c];
+        int blocks_y = m_win_mcus_y * m_comp_v_samp[c];
+        for (int by = 0; by < blocks_y; by++) {
+            uint8_t *out = plane.data.data() + (size_t)by * size * plane.stride;
+            const int16_t *zz = m_coefs[c].data()
+                + ((size_t)(m_win_mcu_y0 * m_comp_v_samp[c] + by) * m_coef_blocks_x[c]
+                   + m_win_mcu_x0 * m_comp_h_samp[c]) * 64;
+            for (int bx = 0; bx < blocks_x; bx++, zz += 64) {
+                if (size == 1) {
+                    m_idct.transform_scaled(zz, qt, 0, 1, out + bx, plane.stride);
+                    continue;
+                }
+                int last_nz = 63;
+                while (last_nz > 0 && zz[last_nz] == 0) {
+                    last_nz--;
+                }
+                m_idct.kernels().dezigzag(zz, coef);
+                m_idct.transform_scaled(coef, qt, last_nz, size, out + bx * size, plane.stride);
+            }
+        }
+    }
+}
+
+// a progressive scan is complete: render a preview once every component has its DC
+void jpeg_decoder::progressive_scan_done()
+{
+    m_scans_done++;
+    if (m_spectral_start == 0 && m_succ_high == 0) {
+        for (int i = 0; i < m_comps_in_scan; i++) {
+            m_dc_done[m_scan_comp[i]] = true;
+        }
+    }
+    if (!m_preview_callback || m_coefficients_only) {
+        return;
+    }
+    for (int c = 0; c < m_comps_in_frame; c++) {
+        if (!m_dc_done[c]) {
+            return;
+        }
+    }
+    if (!m_preview_ready || m_preview_every_scan) {
+        m_preview_ready = true;
+        render_coefficients();
+        m_preview_callback(m_scans_done);
+    }
+}
+
+// decode MCU n of the current scan
+inline int jpeg_decoder::decode_mcu(bit_reader &reader, int n, int *dc_pred, int &eobrun)
+{
+    if (m_comps_in_scan == 1) {
+        // non interleaved: one block per MCU, the component's own block grid
+        int blocks_x = m_comp_blocks_x[m_scan_comp[0]];
+        int bx = n % blocks_x;
+        int by = n / blocks_x;
+        int ret = m_progressive ? decode_block_progressive(reader, 0, dc_pred[0], eobrun, bx, by)
+                                : decode_block_to_plane(reader, 0, dc_pred[0], bx, by);
+        if (ret != 0) {
+            LOGE(jpeg_logger, "bad huffman code, block %d,%d", bx, by);
+            return -1;
+        }
+        return 0;
+    }
+
+    // interleaved: each MCU has h_samp x v_samp blocks of every component
+    int mcu_x = n % m_mcus_x;
+    int mcu_y = n / m_mcus_x;
+    for (int i = 0; i < m_comps_in_scan; i++) {
+        int comp = m_scan_comp[i];
+        for (int v = 0; v < m_comp_v_samp[comp]; v++) {
+            for (int h = 0; h < m_comp_h_samp[comp]; h++) {
+                int bx = mcu_x * m_comp_h_samp[comp] + h;
+                int by = mcu_y * m_comp_v_samp[comp] + v;
+                int ret = m_progressive ? decode_block_progressive(reader, i, dc_pred[i], eobrun, bx, by)
+                                        : decode_block_to_plane(reader, i, dc_pred[i], bx, by);
+                if (ret != 0) {
+                    LOGE(jpeg_logger, "bad huffman code, MCU %d,%d", mcu_x, mcu_y);
+                    return -1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+// decode MCUs [first, first + count) of the current scan, in scan order.
+// the DC predictors and the EOB run start from 0, as at the start of a scan / restart interval.
+int jpeg_decoder::decode_mcus(bit_reader &reader, int first, int count)
+{
+    int dc_pred[4] = {0, 0, 0, 0};
+    int eobrun = 0;
+
+    for (int n = first; n < first + count; n++) {
+        if (decode_mcu(reader, n, dc_pred, eobrun) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// # of MCUs in the current scan
+int jpeg_decoder::scan_mcus() const
+{
+    if (m_comps_in_scan == 1) {
+        int comp = m_scan_comp[0];
+        return m_comp_blocks_x[comp] * m_comp_blocks_y[comp];
+    }
+    return m_mcus_x * m_mcus_y;
+}
+
+// the window in units of the current scan (MCUs, or blocks of a non interleaved scan):
+// grid_x units per row, window columns [x0, x1), rows [y0, y1)
+void jpeg_decoder::scan_window(int &grid_x, int &x0, int &x1, int &y0, int &y1) const
+{
+    int h = 1;
+    int v = 1;
+    grid_x = m_mcus_x;
+    int grid_y = m_mcus_y;
+    if (m_comps_in_scan == 1) {
+        int comp = m_scan_comp[0];
+        h = m_comp_h_samp[comp];
+        v = m_comp_v_samp[comp];
+        grid_x = m_comp_blocks_x[comp];
+        grid_y = m_comp_blocks_y[comp];
+    }
+    x0 = m_win_mcu_x0 * h;
+    x1 = std::min(grid_x, (m_win_mcu_x0 + m_win_mcus_x) * h);
+    y0 = m_win_mcu_y0 * v;
+    y1 = std::min(grid_y, (m_win_mcu_y0 + m_win_mcus_y) * v);
+}
+
+// some of the MCUs [first, first + count) of the current scan are in the window
+bool jpeg_decoder::mcus_in_window(int first, int count) const
+{
+    if (!m_cropped) {
+        return true;
+    }
+    int grid_x, x0, x1, y0, y1;
+    scan_window(grid_x, x0, x1, y0, y1);
+    int last = first + count - 1;
+    if (last / grid_x < y0 || first / grid_x >= y1) {
+        return false;
+    }
+    if (first / grid_x == last / grid_x) {
+        return last % grid_x >= x0 && first % grid_x < x1;
+    }
+    return true;
+}
+
+// the current scan has to be decoded up to this MCU (exclusive), the rest is outside the window
+int jpeg_decoder::scan_mcus_needed() const
+{
+    int total = scan_mcus();
+    if (!m_cropped) {
+        return total;
+    }
+    int grid_x, x0, x1, y0, y1;
+    scan_window(grid_x, x0, x1, y0, y1);
+    return std::min(total, (y1 - 1) * grid_x + x1);
+}
+
+// decode the restart intervals of a scan on the shared pool.
+// restarts: offset of every interval in scan_data, the first one is 0.
+// intervals are independent (the DC predictors are reset at RSTn) and cover
+// disjoint blocks of the planes, so workers just take the next interval in turn.
+int jpeg_decoder::decode_restart_intervals(const uint8_t *scan_data, int data_len)
+{
+    int total = scan_mcus();
+    int intervals = std::min((int)m_restarts.size(), (total + m_restart_interval - 1) / m_restart_interval);
+
+    // a lost or damaged RSTn would put every later interval in the wrong place
+    if ((int)m_restarts.size() * m_restart_interval < total) {
+        LOGE(jpeg_logger, "%d restart intervals, %d MCUs", (int)m_restarts.size(), total);
+        return -1;
+    }
+    for (int i = 1; i < intervals; i++) {
+        int marker = scan_data[m_restarts[i] - 1];
+        if (marker != 0xD0 + ((i - 1) & 7)) {
+            LOGE(jpeg_logger, "restart interval %d starts at RST%d", i, marker - 0xD0);
+            return -1;
+        }
+    }
+
+    int threads = m_decode_threads > 0 ? m_decode_threads : (int)std::thread::hardware_concurrency();
+    // a thread is only worth it for a good number of MCUs
+    threads = std::min(threads, total / min_mcus_per_thread);
+    threads = std::max(1, std::min(threads, intervals));
+
+    std::atomic<int> failed(0);
+    // a crop window needs the intervals up to its last MCU, the others are skipped below
+    int needed = scan_mcus_needed();
+    intervals = std::min(intervals, (needed + m_restart_interval - 1) / m_restart_interval);
+    auto worker = [&](int first_interval, int end_interval) {
+        bit_reader reader;
+        for (int i = first_interval; i < end_interval; i++) {
+            int begin = m_restarts[i];
+            int end = i + 1 < (int)m_restarts.size() ? m_restarts[i + 1] : data_len;
+            int first = i * m_restart_interval;
+            int count = std::min(m_restart_interval, needed - first);
+            if (!mcus_in_window(first, count)) {
+                continue;
+            }
+            reader.reset(scan_data + begin, end - begin);
+            if (decode_mcus(reader, first, count) != 0 || reader.exhausted()) {
+                LOGE(jpeg_logger, "restart interval %d failed", i);
+                failed = 1;
+            }
+        }
+    };
+
+    LOGD(jpeg_logger, "%d restart intervals, %d threads", intervals, threads);
+    zzwlib::thread_pool::shared().parallel_for(0, intervals, 1, worker, threads);
+    return failed ? -1 : 0;
+}
+
+// decode a sequential or progressive (huffman) scan.
+// return: bytes of entropy coded data, -1 on error.
+int jpeg_decoder::decode_scan_data(const uint8_t *scan_data, int len)
+{
+    if (m_restart_interval > 0) {
+        // find the RSTn boundaries first, then decode the intervals in parallel
+        int data_len = 0;
+        if (scan_image_data(scan_data, len, data_len, &m_restarts) != 0) {
+            data_len = len;
+        }
+        if (decode_restart_intervals(scan_data, data_len) != 0) {
+            return -1;
+        }
+        return data_len;
+    }
+
+    bit_reader reader(scan_data, len);
+    int needed = scan_mcus_needed();
+    if (decode_mcus(reader, 0, needed) != 0) {
+        return -1;
+    }
+    if (reader.exhausted()) {
+        LOGE(jpeg_logger, "scan data ends before MCU %d", needed);
+        return -1;
+    }
+    if (needed < scan_mcus()) {
+        // the rest of the scan is after the crop window, skip to its end
+        int pos = (int)reader.position();
+        int data_len = 0;
+        if (scan_image_data(scan_data + pos, len - pos, data_len) != 0) {
+            return len;
+        }
+        return pos + data_len;
+    }
+    // the scan ends at the next marker
+    reader.seek_marker();
+    return (int)reader.position();
+}
+
+void jpeg_decoder::reset()
+{
+    m_image_x_size = 0;
+    m_image_y_size = 0;
+    m_out_x_size = 0;
+    m_out_y_size = 0;
+    m_comps_in_frame = 0;
+    m_max_h_samp = 1;
+    m_max_v_samp = 1;
+    m_mcus_x = 0;
+    m_mcus_y = 0;
+    for (int i = 0; i < 4; i++) {
+        m_comp_h_samp[i] = 1;
+        m_comp_v_samp[i] = 1;
+        m_comp_quant[i] = 0;
+        m_comp_ident[i] = 0;
+        m_quant_defined[i] = false;
+        m_huffman_defined[0][i] = false;
+        m_huffman_defined[1][i] = false;
+    }
+    m_restart_interval = 0;
+    m_comps_in_scan = 0;
+    m_progressive = false;
+    for (int i = 0; i < 4; i++) {
+        m_dc_done[i] = false;
+    }
+}
+
+int jpeg_decoder::read_segment(const uint8_t *data, int len, int &consumed, int &marker)
+{
+    int marker_pre_offset = 0;
+
+    consumed = 0;
+    marker = (int)next_marker(data, len, marker_pre_offset);
+    if (marker == 0) {
+        // keep a last 0xff, it may be the first byte of the next marker
+        consumed = (len > 0 && data[len - 1] == 0xff) ? len - 1 : std::max(len, 0);
+        return 1;
+    }
+
+    LOGD(jpeg_logger, "next marker 0x%X (%s), marker_pre_offset %d",
+        marker, jpeg_marker::to_string(static_cast<jpeg_marker::type>(marker)), marker_pre_offset);
+
+    // fill bytes / garbage before the marker
+    consumed = marker_pre_offset;
+    const uint8_t *seg = data + marker_pre_offset;
+    int seg_left = len - marker_pre_offset;
+
+    auto type = static_cast<jpeg_marker::type>(marker);
+    switch (type) {
+        // markers without a length
+        case jpeg_marker::type::M_SOI:
+        case jpeg_marker::type::M_EOI:
+        case jpeg_marker::type::M_TEM:
+        case jpeg_marker::type::M_RST0:
+        case jpeg_marker::type::M_RST1:
+        case jpeg_marker::type::M_RST2:
+        case jpeg_marker::type::M_RST3:
+        case jpeg_marker::type::M_RST4:
+        case jpeg_marker::type::M_RST5:
+        case jpeg_marker::type::M_RST6:
+        case jpeg_marker::type::M_RST7:
+            consumed += 2;
+            return 0;
+        default:
+            break;
+    }
+
+    // 2 bytes marker, 2 bytes - len, the whole segment has to be there
+    if (seg_left < 4) {
+        return 1;
+    }
+    int seg_len = 2 + ((seg[2] << 8) | seg[3]);
+    if (seg_len < 4) {
+        LOGE(jpeg_logger, "%s, invalid length %d", jpeg_marker::to_string(type), seg_len - 2);
+        return -1;
+    }
+    if (seg_left < seg_len) {
+        return 1;
+    }
+
+    int marker_len = 0;
+    int ret = 0;
+    switch (type) {
+        case jpeg_marker::type::M_DQT:
+            ret = dqt_marker(seg, seg_len, marker_len);
+            break;
+        // SOF1 (extended sequential, 8-bit) is decoded like SOF0
+        case jpeg_marker::type::M_SOF0:
+        case jpeg_marker::type::M_SOF1:
+            m_progressive = false;
+            ret = sof0_marker(seg, seg_len, marker_len);
+            break;
+        case jpeg_marker::type::M_SOF2:
+            m_progressive = true;
+            ret = sof0_marker(seg, seg_len, marker_len);
+            break;
+        case jpeg_marker::type::M_SOF3:
+        case jpeg_marker::type::M_SOF5:
+        case jpeg_marker::type::M_SOF6:
+        case jpeg_marker::type::M_SOF7:
+        case jpeg_marker::type::M_SOF9:
+        case jpeg_marker::type::M_SOF10:
+        case jpeg_marker::type::M_SOF11:
+        case jpeg_marker::type::M_SOF13:
+        case jpeg_marker::type::M_SOF14:
+        case jpeg_marker::type::M_SOF15:
+            LOGE(jpeg_logger, "%s is not supported", jpeg_marker::to_string(type));
+            return -1;
+        case jpeg_marker::type::M_DHT:
+            ret = dht_marker(seg, seg_len, marker_len);
+            break;
+        case jpeg_marker::type::M_DRI:
+            // 2 bytes marker, 2 bytes - len (4), 2 bytes - restart interval in MCUs
+            if (seg_len < 6) {
+                return -1;
+            }
+            m_restart_interval = (seg[4] << 8) | seg[5];
+            LOGD(jpeg_logger, "restart interval %d", m_restart_interval);
+            break;
+        case jpeg_marker::type::M_SOS:
+            if (m_comps_in_frame == 0) {
+                LOGE(jpeg_logger, "SOS before SOF");
+                return -1;
+            }
+            ret = sos_marker(seg, seg_len, marker_len);
+            break;
+        default:
+            LOGD(jpeg_logger, "%s len %d", jpeg_marker::to_string(type), seg_len - 2);
+            break;
+    }
+    if (ret != 0) {
+        return -1;
+    }
+    consumed += seg_len;
+    return 0;
+}
+
+int jpeg_decoder::decode(const uint8_t *data, int len)
+{
+    int cur_pos = 0;
+
+    reset();
+
+    while (true) {
+        int consumed = 0;
+        int marker = 0;
+        int ret = read_segment(data + cur_pos, len - cur_pos, consumed, marker);
+        cur_pos += consumed;
+        if (ret < 0) {
+            return -1;
+        }
+        if (ret > 0) {
+            // the data ends early: the image is incomplete
+            LOGE(jpeg_logger, "no EOI marker");
+            return -1;
+        }
+        if (marker == (int)jpeg_marker::type::M_EOI) {
+            break;
+        }
+        if (marker == (int)jpeg_marker::type::M_SOS) {
+            int data_len = decode_scan_data(data + cur_pos, len - cur_pos);
+            if (data_len < 0) {
+                LOGE(jpeg_logger, "scan data at %d is corrupt", cur_pos);
+                return -1;
+            }
+            cur_pos += data_len;
+            if (m_progressive) {
+                progressive_scan_done();
+            }
+        }
+    }
+
+    if (m_comps_in_frame == 0) {
+        return -1;
+    }
+    if (m_progressive && !m_coefficients_only) {
+        render_coefficients();
+    }
+    return 0;
+}
+
+int jpeg_decoder::read_coefficients(const uint8_t *data, int len)
+{
+    m_coefficients_only = true;
+    int ret = decode(data, len);
+    m_coefficients_only = false;
+    return ret;
+}
+
+void jpeg_decoder::begin_stream(row_callback callback)
+{
+    reset();
+    m_row_callback = callback;
+    m_stream_state = stream_state::headers;
+    m_stream_finishing = false;
+    m_stream_buf.clear();
+    m_stream_pos = 0;
+    m_stream_rows = 0;
+    for (int i = 0; i < 4; i++) {
+        m_stream_block_rows[i] = 0;
+    }
+}
+
+// bytes of m_stream_buf the scan may read. a 0xff at the end is held back
+// until the next piece tells if it is stuffing or the start of a marker.
+int jpeg_decoder::stream_usable_len() const
+{
+    int len = (int)(m_stream_buf.size() - m_stream_pos);
+    if (!m_stream_finishing) {
+        while (len > 0 && m_stream_buf[m_stream_pos + len - 1] == 0xff) {
+            len--;
+        }
+    }
+    return len;
+}
+
+int jpeg_decoder::push(const uint8_t *data, size_t len)
+{
+    if (m_stream_state == stream_state::error) {
+        return -1;
+    }
+    if (m_stream_state == stream_state::done) {
+        return 1;
+    }
+
+    // drop what is decoded, the reader keeps its bits and goes on with the new buffer
+    if (m_stream_state == stream_state::scan) {
+        m_stream_pos += m_stream_reader.position();
+    }
+    m_stream_buf.erase(m_stream_buf.begin(), m_stream_buf.begin() + m_stream_pos);
+    m_stream_pos = 0;
+    m_stream_buf.insert(m_stream_buf.end(), data, data + len);
+    if (m_stream_state == stream_state::scan) {
+        m_stream_reader.rebase(m_stream_buf.data(), stream_usable_len());
+    }
+
+    return stream_run();
+}
+
+int jpeg_decoder::finish()
+{
+    if (m_stream_state == stream_state::error) {
+        return -1;
+    }
+    if (m_stream_state != stream_state::done) {
+        m_stream_finishing = true;
+        if (m_stream_state == stream_state::scan) {
+            // the held back 0xff bytes, if any
+            m_stream_pos += m_stream_reader.position();
+            m_stream_reader.rebase(m_stream_buf.data() + m_stream_pos, stream_usable_len());
+        }
+        if (stream_run() < 0) {
+            return -1;
+        }
+        if (m_stream_state != stream_state::done) {
+            LOGE(jpeg_logger, "no EOI marker");
+            if (m_comps_in_frame == 0) {
+                return -1;
+            }
+            // whatever is decoded is final now
+            stream_frame_done();
+        }
+    }
+    return m_comps_in_frame > 0 ? 0 : -1;
+}
+
+// end of the frame: progressive images get their idct now, all rows are reported
+void jpeg_decoder::stream_frame_done()
+{
+    if (m_progressive) {
+        render_coefficients();
+    }
+    if (m_out_y_size > m_stream_rows) {
+        if (m_row_callback) {
+            m_row_callback(m_stream_rows, m_out_y_size - m_stream_rows);
+        }
+        m_stream_rows = m_out_y_size;
+    }
+}
+
+int jpeg_decoder::stream_run()
+{
+    while (true) {
+        if (m_stream_state == stream_state::headers) {
+            int consumed = 0;
+            int marker = 0;
+            int ret = read_segment(m_stream_buf.data() + m_stream_pos, (int)(m_stream_buf.size() - m_stream_pos),
+                                   consumed, marker);
+            m_stream_pos += consumed;
+            if (ret < 0) {
+                m_stream_state = stream_state::error;
+                return -1;
+            }
+            if (ret > 0) {
+                return 0;
+            }
+            if (marker == (int)jpeg_marker::type::M_EOI) {
+                m_stream_state = stream_state::done;
+                if (m_comps_in_frame > 0) {
+                    stream_frame_done();
+                }
+                return 1;
+            }
+            if (marker == (int)jpeg_marker::type::M_SOS && m_progressive) {
+                m_stream_scan_seen = 0;
+                m_stream_state = stream_state::whole_scan;
+            } else if (marker == (int)jpeg_marker::type::M_SOS) {
+                m_stream_mcu = 0;
+                m_stream_restart_left = m_restart_interval;
+                for (int i = 0; i < 4; i++) {
+                    m_stream_dc_pred[i] = 0;
+                }
+                m_stream_reader.reset(m_stream_buf.data() + m_stream_pos, stream_usable_len());
+                m_stream_state = stream_state::scan;
+            }
+        } else if (m_stream_state == stream_state::scan) {
+            int ret = stream_scan();
+            if (ret < 0) {
+                m_stream_state = stream_state::error;
+                return -1;
+            }
+            if (ret > 0) {
+                return 0;
+            }
+            // back to the marker segments after the scan
+            m_stream_pos += m_stream_reader.position();
+            m_stream_state = stream_state::headers;
+        } else if (m_stream_state == stream_state::whole_scan) {
+            // progressive scans refine the coefficients in place and can not be
+            // decoded again from a saved state: wait for the whole scan.
+            // the bytes looked at by the last push are not searched again.
+            const uint8_t *scan_data = m_stream_buf.data() + m_stream_pos;
+            int avail = (int)(m_stream_buf.size() - m_stream_pos);
+            int from = std::max(0, m_stream_scan_seen - 1);
+            int data_len = 0;
+            if (scan_image_data(scan_data + from, avail - from, data_len) == 0) {
+                data_len += from;
+            } else if (m_stream_finishing) {
+                data_len = avail;
+            } else {
+                m_stream_scan_seen = avail;
+                return 0;
+            }
+            if (decode_scan_data(scan_data, data_len) < 0) {
+                LOGE(jpeg_logger, "progressive scan %d failed", m_scans_done);
+                m_stream_state = stream_state::error;
+                return -1;
+            }
+            m_stream_pos += data_len;
+            progressive_scan_done();
+            m_stream_state = stream_state::headers;
+        } else {
+            return m_stream_state == stream_state::done ? 1 : -1;
+        }
+    }
+}
+
+// decode the MCUs of the scan which are complete in the buffer.
+// return: 0 the scan is done (the reader is at the next marker), 1 more data is needed, -1 error.
+int jpeg_decoder::stream_scan()
+{
+    bit_reader &reader = m_stream_reader;
+    int total = scan_mcus_needed();
+
+    while (m_stream_mcu < total) {
+        if (m_restart_interval > 0 && m_stream_restart_left == 0) {
+            int marker = reader.seek_marker();
+            if (marker == 0) {
+                if (m_stream_finishing) {
+                    LOGE(jpeg_logger, "scan data ends before MCU %d of %d", m_stream_mcu, total);
+                    return -1;
+                }
+                return 1;
+            }
+            // a lost or damaged RSTn would put every later interval in the wrong place
+            int expected = 0xD0 + ((m_stream_mcu / m_restart_interval - 1) & 7);
+            if (marker != expected || !reader.restart()) {
+                LOGE(jpeg_logger, "expect RST%d, got marker 0x%x, MCU %d of %d", expected - 0xD0, marker,
+                     m_stream_mcu, total);
+                return -1;
+            }
+            m_stream_restart_left = m_restart_interval;
+            for (int i = 0; i < 4; i++) {
+                m_stream_dc_pred[i] = 0;
+            }
+        }
+
+        // the MCU is decoded again from here if its data is not all there yet
+        bit_reader saved = reader;
+        int saved_dc_pred[4] = {m_stream_dc_pred[0], m_stream_dc_pred[1], m_stream_dc_pred[2], m_stream_dc_pred[3]};
+
+        int eobrun = 0;
+        int ret = decode_mcu(reader, m_stream_mcu, m_stream_dc_pred, eobrun);
+        if (!m_stream_finishing && reader.overrun()) {
+            reader = saved;
+            memcpy(m_stream_dc_pred, saved_dc_pred, sizeof(saved_dc_pred));
+            return 1;
+        }
+        // the zero bits after a marker (or the end of the input) are no MCU data
+        if (ret != 0 || reader.exhausted()) {
+            return -1;
+        }
+        m_stream_mcu++;
+        m_stream_restart_left--;
+        stream_rows_done(m_stream_mcu);
+    }
+
+    // the scan ends at the next marker
+    if (reader.seek_marker() == 0) {
+        return m_stream_finishing ? 0 : 1;
+    }
+    return 0;
+}
+
+// n MCUs of the current scan are decoded, report the image rows which became complete
+void jpeg_decoder::stream_rows_done(int n)
+{
+    if (m_comps_in_scan == 1) {
+        int comp = m_scan_comp[0];
+        m_stream_block_rows[comp] = std::max(m_stream_block_rows[comp], n / m_comp_blocks_x[comp]);
+    } else {
+        for (int i = 0; i < m_comps_in_scan; i++) {
+            int comp = m_scan_comp[i];
+            m_stream_block_rows[comp] = std::max(m_stream_block_rows[comp], n / m_mcus_x * m_comp_v_samp[comp]);
+        }
+    }
+    if (n == scan_mcus_needed()) {
+        // the last, maybe partial, row is complete too
+        for (int i = 0; i < m_comps_in_scan; i++) {
+            m_stream_block_rows[m_scan_comp[i]] = m_mcus_y * m_comp_v_samp[m_scan_comp[i]];
+        }
+    }
+
+    // a component block row covers block size * max_v / v_samp image rows
+    int rows = m_out_y_size;
+    for (int c = 0; c < m_comps_in_frame; c++) {
+        int block_rows = std::max(0, m_stream_block_rows[c] - m_win_mcu_y0 * m_comp_v_samp[c]);
+        rows = std::min(rows, block_rows * m_block_size * m_max_v_samp / m_comp_v_samp[c]);
+    }
+    if (rows > m_stream_rows) {
+        if (m_row_callback) {
+            m_row_callback(m_stream_rows, rows - m_stream_rows);
+        }
+        m_stream_rows = rows;
+    }
+}
+
+} // namespace jpeg
+
+} // zzwlib
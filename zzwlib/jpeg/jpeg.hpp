@@ -0,0 +1,322 @@
+
+//
+// baseline jpeg decoder.
+//
+// components are decoded into separate planes at their own (subsampled) size,
+// e.g. 4:2:0 gives a full size Y plane and half width / half height Cb, Cr planes.
+//
+// all state lives in a jpeg_decoder object: one object per thread can decode
+// any number of images back to back, tables and buffers are reset / reused
+// between images, planes are only reallocated when an image needs more memory.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <span>
+#include <utility>
+#include <functional>
+
+#include "huffman.hpp"
+#include "bit_reader.hpp"
+#include "idct.hpp"
+
+namespace zzwlib{
+    namespace jpeg {
+
+// one decoded component.
+// the buffer is MCU aligned: stride and rows are padded up to whole MCUs,
+// only the top left width x height samples are image data.
+struct image_plane {
+    int width = 0;
+    int height = 0;
+    int stride = 0;
+    std::vector<uint8_t> data;
+};
+
+// zigzag index of row i, column j of a block
+int matIndicesToZOrder(int i, int j);
+
+// jpeg spec F.1.2.1: # of bits of the magnitude of val (the SSSS category)
+int valCategory(int val);
+
+// frame header of a jpeg file, as found by probe()
+struct image_info {
+    int width = 0;
+    int height = 0;             // 0: given by a DNL marker after the first scan
+    int components = 0;
+    int component_id[4] = {0, 0, 0, 0};
+    int h_samp[4] = {0, 0, 0, 0};
+    int v_samp[4] = {0, 0, 0, 0};
+    int precision = 0;          // bits per sample
+    int sof_marker = 0;         // SOFn, 0xC0 - 0xCF
+    bool progressive = false;   // SOF2, 6, 10, 14
+    bool supported = false;     // jpeg_decoder can decode it: SOF0 - 2, 8 bit
+    int header_len = 0;         // bytes up to the end of SOF
+};
+
+// read the frame header only: walks the marker segments by their lengths up to
+// the first SOFn, without looking into them or allocating anything. segments
+// before SOF (APPn, DQT, ...) do not have to be in data, e.g. a few kB of the
+// start of the file are usually enough; the SOF segment itself has to be.
+// return: 0 info is set, 1 data ends before the end of SOF, -1 not a jpeg / bad header.
+int probe(const uint8_t *data, int len, image_info &info);
+
+inline int probe(std::span<const uint8_t> data, image_info &info) {
+    return probe(data.data(), (int)data.size(), info);
+}
+
+class jpeg_decoder final {
+public:
+    jpeg_decoder() = default;
+
+    // planes may be large, a decoder is meant to stay with its thread
+    jpeg_decoder(const jpeg_decoder&) = delete;
+    jpeg_decoder& operator=(const jpeg_decoder&) = delete;
+
+    // return: 0 on success, -1 on error: bad headers, corrupt scan data, or data
+    // which ends before the EOI marker (the planes hold what was decoded so far).
+    int decode(const uint8_t *data, int len);
+
+    int decode(std::span<const uint8_t> data) {
+        return decode(data.data(), (int)data.size());
+    }
+
+    // streaming decode, for data which arrives in pieces (e.g. from a socket):
+    // begin_stream(), then push() every piece as it comes, then finish().
+    // pieces may end anywhere, in a marker segment or in the middle of scan data;
+    // only the bytes not decoded yet are kept, a few hundred bytes during a scan.
+    // callback(y, rows): image rows [y, y + rows) are complete in every plane.
+    typedef std::function<void(int y, int rows)> row_callback;
+    void begin_stream(row_callback callback = nullptr);
+
+    // return: 0 more data is expected, 1 the image is complete (EOI), -1 error.
+    int push(const uint8_t *data, size_t len);
+
+    // end of the input, decode what is left.
+    // return: 0 if the image was decoded (a missing EOI is tolerated, scan data
+    //         cut short is not), -1 otherwise.
+    int finish();
+
+    // size of the decoded image, the frame size divided by the scale (rounded up)
+    int width() const { return m_out_x_size; }
+    int height() const { return m_out_y_size; }
+
+    // frame size as in SOF
+    int frame_width() const { return m_image_x_size; }
+    int frame_height() const { return m_image_y_size; }
+
+    // sampling factors of the last decoded frame
+    int h_samp(int comp) const { return m_comp_h_samp[comp]; }
+    int v_samp(int comp) const { return m_comp_v_samp[comp]; }
+    int max_h_samp() const { return m_max_h_samp; }
+    int max_v_samp() const { return m_max_v_samp; }
+
+    // # of components of the last decoded frame
+    int components() const { return m_comps_in_frame; }
+
+    // plane of component comp (frame order), nullptr if out of range
+    const image_plane *plane(int comp) const {
+        return comp >= 0 && comp < m_comps_in_frame ? &m_planes[comp] : nullptr;
+    }
+
+    // exchange the decoded plane of comp with plane, the decoder reuses the
+    // buffer it gets back for the next image. used to hand planes out without a copy.
+    void swap_plane(int comp, image_plane &plane) {
+        if (comp >= 0 && comp < 4) {
+            std::swap(m_planes[comp], plane);
+        }
+    }
+
+    // threads used to decode the restart intervals (DRI / RSTn) of a scan in parallel.
+    // 0: one per cpu (default), 1: decode on the calling thread only.
+    void set_decode_threads(int threads) { m_decode_threads = threads; }
+
+    void set_idct_method(idct_method method) { m_idct.set_method(method); }
+
+    // decode at 1/denom of the frame size, denom 1, 2, 4 or 8 (e.g. for thumbnails).
+    // the downscale is done in the DCT domain: blocks go through 4x4, 2x2 or
+    // DC only (1/8) transforms, the planes are allocated at the reduced size.
+    // applies to the images decoded after the call.
+    // return: 0, -1 if denom is not supported.
+    int set_scale(int denom) {
+        if (denom != 1 && denom != 2 && denom != 4 && denom != 8) {
+            return -1;
+        }
+        m_scale = denom;
+        return 0;
+    }
+    int scale() const { return m_scale; }
+
+    // decode only the rectangle (x, y) w x h of the (scaled) image, w or h 0: the whole image.
+    // the origin is moved left / up to a MCU boundary so the planes start with whole
+    // blocks: crop_x() / crop_y() tell where it ended up, width() / height() the size.
+    // only MCUs in the rectangle get the idct and plane memory, a scan is entropy
+    // decoded up to the last MCU needed and restart intervals outside it are skipped.
+    // applies to the images decoded after the call.
+    // return: 0, -1 if the rectangle is invalid.
+    int set_crop(int x, int y, int w, int h) {
+        if (x < 0 || y < 0 || w < 0 || h < 0) {
+            return -1;
+        }
+        m_crop_req[0] = x;
+        m_crop_req[1] = y;
+        m_crop_req[2] = w;
+        m_crop_req[3] = h;
+        return 0;
+    }
+    int crop_x() const { return m_crop_x; }
+    int crop_y() const { return m_crop_y; }
+
+    // entropy decode only: the quantized coefficients of every block go to the
+    // coefficient store, no idct and no planes (e.g. for lossless transforms).
+    // sequential and progressive frames; scale and crop do not apply.
+    // return: 0 on success, -1 on error.
+    int read_coefficients(const uint8_t *data, int len);
+
+    // coefficient store of comp after read_coefficients: blocks of 64 quantized
+    // coefficients in zigzag order, coef_blocks_x(comp) per row, MCU aligned
+    // (blocks past comp_blocks_x / comp_blocks_y are padding).
+    const int16_t *coefficients(int comp) const { return m_coefs[comp].data(); }
+    int coef_blocks_x(int comp) const { return m_coef_blocks_x[comp]; }
+    int coef_blocks_y(int comp) const { return m_mcus_y * m_comp_v_samp[comp]; }
+    // blocks which cover the component's samples
+    int comp_blocks_x(int comp) const { return m_comp_blocks_x[comp]; }
+    int comp_blocks_y(int comp) const { return m_comp_blocks_y[comp]; }
+    int component_id(int comp) const { return m_comp_ident[comp]; }
+    // quantization table of comp, zigzag order
+    const uint16_t *quant_table(int comp) const { return m_quant_tbl[m_comp_quant[comp]]; }
+    int quant_index(int comp) const { return m_comp_quant[comp]; }
+
+    // progressive images: render a preview into the planes once the DC of every
+    // component is in (a blocky 1/8 resolution image) and, with every_scan, after
+    // each later scan too. callback(scans) is called with the # of scans decoded,
+    // the planes can be read in the callback. the final image is always rendered.
+    typedef std::function<void(int scans)> preview_callback;
+    void set_preview_callback(preview_callback callback, bool every_scan = false) {
+        m_preview_callback = callback;
+        m_preview_every_scan = every_scan;
+    }
+
+private:
+    // forget everything about the previous image, keep the buffers
+    void reset();
+
+    // parse the marker segment at data, bytes before the marker are skipped.
+    // return: 0 parsed (consumed, marker are set), 1 the segment is not complete, -1 error.
+    int read_segment(const uint8_t *data, int len, int &consumed, int &marker);
+
+    int dqt_marker(const uint8_t *data, int len, int &marker_len);
+    int dht_marker(const uint8_t *data, int len, int &marker_len);
+    int sof0_marker(const uint8_t *data, int len, int &marker_len);
+    int sos_marker(const uint8_t *data, int len, int &marker_len);
+
+    int decode_block_to_plane(bit_reader &reader, int scan_idx, int &dc_pred, int bx, int by);
+    int decode_block_progressive(bit_reader &reader, int scan_idx, int &dc_pred, int &eobrun, int bx, int by);
+    void render_coefficients();
+    void progressive_scan_done();
+    int decode_mcu(bit_reader &reader, int n, int *dc_pred, int &eobrun);
+    int decode_mcus(bit_reader &reader, int first, int count);
+    int scan_mcus() const;
+    int set_window();
+    bool block_in_window(int comp, int bx, int by) const;
+    void scan_window(int &grid_x, int &x0, int &x1, int &y0, int &y1) const;
+    bool mcus_in_window(int first, int count) const;
+    int scan_mcus_needed() const;
+    int decode_restart_intervals(const uint8_t *scan_data, int data_len);
+    int decode_scan_data(const uint8_t *scan_data, int len);
+
+    enum class stream_state : int {
+        headers = 0,    // between marker segments
+        scan,           // in entropy coded data
+        whole_scan,     // collecting a progressive scan
+        done,           // EOI
+        error,
+    };
+    int stream_run();
+    int stream_scan();
+    void stream_rows_done(int n);
+    void stream_frame_done();
+    int stream_usable_len() const;
+
+    idct_engine m_idct{idct_method::fast_int};
+    int m_decode_threads = 0;   // threads for restart intervals, 0: one per cpu
+    int m_scale = 1;            // output is 1/m_scale of the frame size
+    int m_crop_req[4] = {0, 0, 0, 0};   // x, y, w, h as set by set_crop()
+
+    int m_image_x_size = 0;
+    int m_image_y_size = 0;
+    int m_out_x_size = 0;       // image size / m_scale
+    int m_out_y_size = 0;
+    int m_block_size = 8;       // samples per block side in the planes, 8 / scale of the frame
+    int m_comps_in_frame = 0;   // # of components in frame
+    int m_comp_h_samp[4];       // component's horizontal sampling factor
+    int m_comp_v_samp[4];       // component's vertical sampling factor
+    int m_comp_quant[4];        // component's quantization table selector
+    int m_comp_ident[4];        // component's ID
+    int m_comp_blocks_x[4];     // component's blocks per row / column, as in non interleaved scans
+    int m_comp_blocks_y[4];
+
+    int m_max_h_samp = 1;       // max sampling factors, a MCU covers 8*max_h x 8*max_v pixels
+    int m_max_v_samp = 1;
+    int m_mcus_x = 0;           // # of MCUs per row / column for interleaved scans
+    int m_mcus_y = 0;
+    image_plane m_planes[4];    // decoded components, (re)allocated at SOF
+
+    // MCUs which go to the planes: all of them, or those of the crop rectangle
+    bool m_cropped = false;
+    int m_crop_x = 0;           // position of the planes' first sample in the image
+    int m_crop_y = 0;
+    int m_win_mcu_x0 = 0;
+    int m_win_mcu_y0 = 0;
+    int m_win_mcus_x = 0;
+    int m_win_mcus_y = 0;
+
+    uint16_t m_quant_tbl[4][64];          // zigzag order
+    idct_qtable m_idct_qtbl[4];           // m_quant_tbl in natural order, prepared for the idct
+    bool m_quant_defined[4];
+    HuffmanTable m_huffmanTable[2][4];
+    huffman_decoder m_huffmanDecoder[2][4];
+    bool m_huffman_defined[2][4];
+
+    // progressive (SOF2) frames, or read_coefficients
+    bool m_progressive = false;
+    bool m_coefficients_only = false;   // read_coefficients: the blocks stay in m_coefs
+    std::vector<int16_t> m_coefs[4];    // per component, blocks of 64 coefficients in zigzag order
+    int m_coef_blocks_x[4];             // blocks per row in m_coefs
+    bool m_dc_done[4];                  // DC first scan of the component seen
+    int m_scans_done = 0;
+    bool m_preview_ready = false;
+    preview_callback m_preview_callback;
+    bool m_preview_every_scan = false;
+
+    int m_restart_interval = 0; // MCUs per restart interval, 0 if the image has no DRI
+    std::vector<int> m_restarts;    // offset of each restart interval in the scan data
+
+    int m_comps_in_scan = 0;
+    int m_scan_comp[4];         // frame component index of the scan's components
+    int m_scan_dc_tbl[4];
+    int m_scan_ac_tbl[4];
+    int m_spectral_start = 0;
+    int m_spectral_end = 0;
+    int m_succ_high = 0;
+    int m_succ_low = 0;
+
+    // streaming state
+    stream_state m_stream_state = stream_state::done;
+    bool m_stream_finishing = false;
+    std::vector<uint8_t> m_stream_buf;  // bytes not consumed yet, from m_stream_pos on
+    size_t m_stream_pos = 0;
+    bit_reader m_stream_reader;         // reads m_stream_buf from m_stream_pos during a scan
+    int m_stream_mcu = 0;               // next MCU of the scan
+    int m_stream_dc_pred[4];
+    int m_stream_restart_left = 0;      // MCUs until the next RSTn
+    int m_stream_block_rows[4];         // block rows of each component decoded so far
+    int m_stream_rows = 0;              // image rows already reported
+    int m_stream_scan_seen = 0;         // bytes of a progressive scan searched for its end
+    row_callback m_row_callback;
+};
+
+    } // namespace jpeg
+} // namespace zzwlib
@@ -0,0 +1,770 @@
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <vector>
+#include <algorithm>
+#include <thread>
+
+#include "jpeg_encoder.hpp"
+#include "jpeg.hpp"
+#include "idct.hpp"
+#include "../logger.hpp"
+#include "../thread_pool.hpp"
+
+zzwlib::logger  jpege_logger("jpege", zzwlib::loglevel::log_info_level);
+
+// MCUs a stripe (restart interval) gets at least
+const int min_mcus_per_stripe = 256;
+
+namespace zzwlib{
+    namespace jpeg {
+
+namespace {
+
+// jpeg spec annex K.1, natural order
+const uint8_t std_luma_quant[64] = {
+    16,  11,  10,  16,  24,  40,  51,  61,
+    12,  12,  14,  19,  26,  58,  60,  55,
+    14,  13,  16,  24,  40,  57,  69,  56,
+    14,  17,  22,  29,  51,  87,  80,  62,
+    18,  22,  37,  56,  68, 109, 103,  77,
+    24,  35,  55,  64,  81, 104, 113,  92,
+    49,  64,  78,  87, 103, 121, 120, 101,
+    72,  92,  95,  98, 112, 100, 103,  99,
+};
+
+const uint8_t std_chroma_quant[64] = {
+    17,  18,  24,  47,  99,  99,  99,  99,
+    18,  21,  26,  66,  99,  99,  99,  99,
+    24,  26,  56,  99,  99,  99,  99,  99,
+    47,  66,  99,  99,  99,  99,  99,  99,
+    99,  99,  99,  99,  99,  99,  99,  99,
+    99,  99,  99,  99,  99,  99,  99,  99,
+    99,  99,  99,  99,  99,  99,  99,  99,
+    99,  99,  99,  99,  99,  99,  99,  99,
+};
+
+// jpeg spec annex K.3: # of codes of each length 1 - 16, then the symbols
+const uint8_t std_dc_luma_bits[16] = {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0};
+const uint8_t std_dc_luma_vals[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+
+const uint8_t std_dc_chroma_bits[16] = {0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0};
+const uint8_t std_dc_chroma_vals[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+
+const uint8_t std_ac_luma_bits[16] = {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d};
+const uint8_t std_ac_luma_vals[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12,
+    0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08,
+    0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16,
+    0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39,
+    0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+    0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79,
+    0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98,
+    0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+    0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4,
+    0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea,
+    0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa,
+};
+
+const uint8_t std_ac_chroma_bits[16] = {0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77};
+const uint8_t std_ac_chroma_vals[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21,
+    0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91,
+    0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34,
+    0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38,
+    0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+    0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78,
+    0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96,
+    0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4,
+    0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2,
+    0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9,
+    0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa,
+};
+
+HuffmanTable make_huffman_table(const uint8_t *bits, const uint8_t *vals)
+{
+    HuffmanTable table(16);
+    int idx = 0;
+    for (int i = 0; i < 16; i++) {
+        table[i].num = bits[i];
+        table[i].val_list.assign(vals + idx, vals + idx + bits[i]);
+        idx += bits[i];
+    }
+    return table;
+}
+
+// huffman code lengths for the symbol frequencies freq[0 - 255], as libjpeg's
+// jpeg_gen_optimal_table (jpeg spec K.2): huffman's algorithm, then lengths over
+// 16 are folded into shorter ones. a reserved symbol 256 of frequency 1 keeps
+// any real code from being all 1 bits. freq is used as scratch.
+HuffmanTable make_optimal_table(uint32_t *freq)
+{
+    int codesize[257] = {};
+    int others[257];
+    std::fill(others, others + 257, -1);
+    freq[256] = 1;
+
+    for (;;) {
+        // the two least frequent trees, ties go to the larger symbol
+        int c1 = -1;
+        int c2 = -1;
+        uint32_t v1 = UINT32_MAX;
+        uint32_t v2 = UINT32_MAX;
+        for (int i = 0; i <= 256; i++) {
+            if (freq[i] == 0) {
+                continue;
+            }
+            if (freq[i] <= v1) {
+                v2 = v1;
+                c2 = c1;
+                v1 = freq[i];
+                c1 = i;
+            } else if (freq[i] <= v2) {
+                v2 = freq[i];
+                c2 = i;
+            }
+        }
+        if (c2 < 0) {
+            break;
+        }
+        // merge c2 into c1, every symbol of both trees gets one bit longer
+        freq[c1] += freq[c2];
+        freq[c2] = 0;
+        codesize[c1]++;
+        while (others[c1] >= 0) {
+            c1 = others[c1];
+            codesize[c1]++;
+        }
+        others[c1] = c2;
+        codesize[c2]++;
+        while (others[c2] >= 0) {
+            c2 = others[c2];
+            codesize[c2]++;
+        }
+    }
+
+    int bits[33] = {};
+    for (int i = 0; i <= 256; i++) {
+        if (codesize[i] > 0) {
+            bits[std::min(codesize[i], 32)]++;
+        }
+    }
+    // jpeg spec figure K.3: a pair of codes of length i becomes one of length
+    // i - 1 and one moves down from the longest shorter length j to j + 1
+    for (int i = 32; i > 16; i--) {
+        while (bits[i] > 0) {
+            int j = i - 2;
+            while (bits[j] == 0) {
+                j--;
+            }
+            bits[i] -= 2;
+            bits[i - 1]++;
+            bits[j + 1] += 2;
+            bits[j]--;
+        }
+    }
+    // drop the reserved symbol, it has the longest code
+    int longest = 16;
+    while (bits[longest] == 0) {
+        longest--;
+    }
+    bits[longest]--;
+
+    // symbols by code length, then by value
+    HuffmanTable table(16);
+    for (int len = 1; len <= 32; len++) {
+        for (int i = 0; i < 256; i++) {
+            if (codesize[i] == len) {
+                table[std::min(len, 16) - 1].val_list.push_back((uint8_t)i);
+            }
+        }
+    }
+    // lengths changed by the folding: reassign in order of the original lengths
+    std::vector<uint8_t> vals;
+    for (const HuffmanRow &row : table) {
+        vals.insert(vals.end(), row.val_list.begin(), row.val_list.end());
+    }
+    size_t idx = 0;
+    for (int len = 1; len <= 16; len++) {
+        table[len - 1].num = bits[len];
+        table[len - 1].val_list.assign(vals.begin() + idx, vals.begin() + idx + bits[len]);
+        idx += bits[len];
+    }
+    return table;
+}
+
+// encode_block's symbols go to a sink: put(table, symbol, bits, nbits), where
+// table is the huffman table index type * 2 + tbl (type 0: DC, 1: AC), bits
+// the nbits extra bits which follow the symbol's code.
+
+// straight into the scan data
+struct writer_sink {
+    bit_writer &writer;
+    const huffman_encoder *encoder;     // [4], by table index
+
+    inline void put(int table, int symbol, uint32_t bits, int nbits) {
+        const huffman_encoder &enc = encoder[table];
+        writer.put_bits((enc.code(symbol) << nbits) | bits, enc.size(symbol) + nbits);
+    }
+};
+
+// first pass of optimize_coding: symbol frequencies, and the symbols as
+// tokens (table << 29 | symbol << 21 | nbits << 16 | bits) for the second pass
+struct token_sink {
+    std::vector<uint32_t> &tokens;
+    uint32_t (*freq)[257];              // [4], by table index
+
+    inline void put(int table, int symbol, uint32_t bits, int nbits) {
+        freq[table][symbol]++;
+        tokens.push_back(((uint32_t)table << 29) | ((uint32_t)symbol << 21) | ((uint32_t)nbits << 16) | bits);
+    }
+};
+
+// zigzag index -> natural index, category and magnitude bits of small values
+struct coding_tables {
+    static constexpr int max_value = 2048;  // DC differences are < 2^11
+    uint8_t natural[64];
+    uint8_t category[max_value];
+
+    coding_tables() {
+        for (int i = 0; i < 8; i++) {
+            for (int j = 0; j < 8; j++) {
+                natural[matIndicesToZOrder(i, j)] = (uint8_t)(i * 8 + j);
+            }
+        }
+        for (int v = 0; v < max_value; v++) {
+            category[v] = (uint8_t)valCategory(v);
+        }
+    }
+};
+
+const coding_tables g_tables;
+
+// jpeg spec F.1.2.1: category of val and the bits which follow its symbol
+inline int encode_value(int val, uint32_t &bits)
+{
+    int mag = val < 0 ? -val : val;
+    int cat = mag < coding_tables::max_value ? g_tables.category[mag] : 32 - __builtin_clz(mag);
+    // negative values are sent as val - 1 in cat bits
+    bits = (uint32_t)(val < 0 ? val - 1 : val) & ((1u << cat) - 1);
+    return cat;
+}
+
+void put_u16(std::vector<uint8_t> &out, int val)
+{
+    out.push_back((uint8_t)(val >> 8));
+    out.push_back((uint8_t)val);
+}
+
+void put_marker(std::vector<uint8_t> &out, int marker)
+{
+    out.push_back(0xFF);
+    out.push_back((uint8_t)marker);
+}
+
+} // namespace
+
+const char *to_string(chroma_format format)
+{
+    switch (format) {
+    case chroma_format::gray: return "gray";
+    case chroma_format::yuv420: return "yuv420";
+    case chroma_format::yuv444: return "yuv444";
+    default: return "unknown";
+    }
+}
+
+yuv_frame make_yuv_frame(const uint8_t *data, int width, int height, chroma_format format)
+{
+    yuv_frame frame;
+    frame.width = width;
+    frame.height = height;
+    frame.format = format;
+    frame.planes[0] = data;
+    frame.strides[0] = width;
+    if (format != chroma_format::gray) {
+        int cw = format == chroma_format::yuv420 ? (width + 1) / 2 : width;
+        int ch = format == chroma_format::yuv420 ? (height + 1) / 2 : height;
+        frame.planes[1] = data + (size_t)width * height;
+        frame.planes[2] = frame.planes[1] + (size_t)cw * ch;
+        frame.strides[1] = cw;
+        frame.strides[2] = cw;
+    }
+    return frame;
+}
+
+size_t yuv_frame_size(int width, int height, chroma_format format)
+{
+    size_t luma = (size_t)width * height;
+    switch (format) {
+    case chroma_format::gray: return luma;
+    case chroma_format::yuv420: return luma + 2 * (size_t)((width + 1) / 2) * ((height + 1) / 2);
+    case chroma_format::yuv444: return 3 * luma;
+    default: return 0;
+    }
+}
+
+jpeg_encoder::jpeg_encoder() :
+    m_kernels(&get_idct_kernels(detect_simd_level()))
+{
+    set_standard_tables();
+    set_quality(m_quality);
+}
+
+void jpeg_encoder::set_standard_tables()
+{
+    m_huffman[0][0] = make_huffman_table(std_dc_luma_bits, std_dc_luma_vals);
+    m_huffman[0][1] = make_huffman_table(std_dc_chroma_bits, std_dc_chroma_vals);
+    m_huffman[1][0] = make_huffman_table(std_ac_luma_bits, std_ac_luma_vals);
+    m_huffman[1][1] = make_huffman_table(std_ac_chroma_bits, std_ac_chroma_vals);
+    for (int type = 0; type < 2; type++) {
+        for (int t = 0; t < 2; t++) {
+            m_encoder[type][t].build(m_huffman[type][t]);
+        }
+    }
+    m_standard_tables = true;
+}
+
+// freq: symbol frequencies by table index, see token_sink
+void jpeg_encoder::set_optimal_tables(uint32_t (*freq)[257])
+{
+    for (int type = 0; type < 2; type++) {
+        for (int t = 0; t < 2; t++) {
+            // a table no component uses (gray) keeps one symbol to stay valid
+            uint32_t *f = freq[type * 2 + t];
+            if (std::all_of(f, f + 256, [](uint32_t n) { return n == 0; })) {
+                f[0] = 1;
+            }
+            m_huffman[type][t] = make_optimal_table(f);
+            m_encoder[type][t].build(m_huffman[type][t]);
+        }
+    }
+    m_standard_tables = false;
+}
+
+int jpeg_encoder::set_quality(int quality)
+{
+    if (quality < 1 || quality > 100) {
+        return -1;
+    }
+    m_quality = quality;
+
+    // as libjpeg's jpeg_quality_scaling: 50 is the annex K table
+    int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+    const uint8_t *base[2] = {std_luma_quant, std_chroma_quant};
+    for (int t = 0; t < 2; t++) {
+        uint16_t quant[64];
+        for (int k = 0; k < 64; k++) {
+            int q = (base[t][g_tables.natural[k]] * scale + 50) / 100;
+            q = std::clamp(q, 1, 255);
+            m_quant[t][k] = (uint16_t)q;
+            quant[g_tables.natural[k]] = (uint16_t)q;
+        }
+        prepare_fdct_divisors(quant, m_div[t]);
+    }
+    return 0;
+}
+
+void jpeg_encoder::write_headers(std::vector<uint8_t> &out) const
+{
+    int tables = m_comps > 1 ? 2 : 1;     // huffman tables
+
+    put_marker(out, 0xD8);      // SOI
+
+    // APP0 JFIF 1.01, no thumbnail, aspect ratio 1:1
+    put_marker(out, 0xE0);
+    put_u16(out, 16);
+    static const uint8_t jfif[] = {'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0};
+    out.insert(out.end(), jfif, jfif + sizeof(jfif));
+
+    // DQT, 8-bit precision unless a value needs 16
+    for (int t = 0; t < 4; t++) {
+        if (m_dqt[t] == nullptr) {
+            continue;
+        }
+        const uint16_t *q = m_dqt[t];
+        int precision = std::any_of(q, q + 64, [](uint16_t v) { return v > 255; }) ? 1 : 0;
+        put_marker(out, 0xDB);
+        put_u16(out, 3 + 64 * (precision + 1));
+        out.push_back((uint8_t)((precision << 4) | t));
+        for (int k = 0; k < 64; k++) {
+            if (precision) {
+                out.push_back((uint8_t)(q[k] >> 8));
+            }
+            out.push_back((uint8_t)q[k]);
+        }
+    }
+
+    // SOF0
+    put_marker(out, 0xC0);
+    put_u16(out, 8 + 3 * m_comps);
+    out.push_back(8);
+    put_u16(out, m_height);
+    put_u16(out, m_width);
+    out.push_back((uint8_t)m_comps);
+    for (int c = 0; c < m_comps; c++) {
+        out.push_back((uint8_t)m_comp[c].id);
+        out.push_back((uint8_t)((m_comp[c].h_samp << 4) | m_comp[c].v_samp));
+        out.push_back((uint8_t)m_comp[c].quant);
+    }
+
+    // DHT
+    int dht_len = 2;
+    for (int type = 0; type < 2; type++) {
+        for (int t = 0; t < tables; t++) {
+            dht_len += 17;
+            for (const HuffmanRow &row : m_huffman[type][t]) {
+                dht_len += row.num;
+            }
+        }
+    }
+    put_marker(out, 0xC4);
+    put_u16(out, dht_len);
+    for (int type = 0; type < 2; type++) {
+        for (int t = 0; t < tables; t++) {
+            out.push_back((uint8_t)((type << 4) | t));
+            for (const HuffmanRow &row : m_huffman[type][t]) {
+                out.push_back((uint8_t)row.num);
+            }
+            for (const HuffmanRow &row : m_huffman[type][t]) {
+                out.insert(out.end(), row.val_list.begin(), row.val_list.end());
+            }
+        }
+    }
+
+    // DRI, restart interval in MCUs
+    if (m_restart_interval > 0) {
+        put_marker(out, 0xDD);
+        put_u16(out, 4);
+        put_u16(out, m_restart_interval);
+    }
+
+    // SOS, all components interleaved
+    put_marker(out, 0xDA);
+    put_u16(out, 6 + 2 * m_comps);
+    out.push_back((uint8_t)m_comps);
+    for (int c = 0; c < m_comps; c++) {
+        out.push_back((uint8_t)m_comp[c].id);
+        out.push_back((uint8_t)((m_comp[c].tbl << 4) | m_comp[c].tbl));
+    }
+    out.push_back(0);       // Ss
+    out.push_back(63);      // Se
+    out.push_back(0);       // Ah, Al
+}
+
+// fdct, quantization and huffman coding of block bx, by of comp
+template <typename sink>
+inline void jpeg_encoder::encode_block(sink &out, const component &comp, int bx, int by,
+                                       int &dc_pred) const
+{
+    alignas(32) uint8_t edge[64];
+    alignas(32) int16_t coef[64];
+    alignas(32) int16_t zz[64];
+
+    uint64_t nonzero = 0;
+    if (comp.coefs != nullptr) {
+        // quantized already (lossless transcoding)
+        memcpy(zz, comp.coefs + ((size_t)by * comp.coef_stride + bx) * 64, sizeof(zz));
+        for (int k = 0; k < 64; k++) {
+            nonzero |= (uint64_t)(zz[k] != 0) << k;
+        }
+    } else {
+        // blocks over the right / bottom edge repeat the last column / row
+        int x0 = bx * 8;
+        int y0 = by * 8;
+        const uint8_t *src = comp.data + (size_t)y0 * comp.stride + x0;
+        int src_stride = comp.stride;
+        if (x0 + 8 > comp.width || y0 + 8 > comp.height) {
+            for (int y = 0; y < 8; y++) {
+                const uint8_t *row = comp.data + (size_t)std::min(y0 + y, comp.height - 1) * comp.stride;
+                for (int x = 0; x < 8; x++) {
+                    edge[y * 8 + x] = row[std::min(x0 + x, comp.width - 1)];
+                }
+            }
+            src = edge;
+            src_stride = 8;
+        }
+        m_kernels->fdct_int(src, src_stride, coef);
+        nonzero = m_kernels->quantize(coef, m_div[comp.tbl], zz);
+    }
+
+    // DC difference
+    int dc = comp.tbl;
+    int ac = 2 + comp.tbl;
+    uint32_t bits = 0;
+    int cat = encode_value(zz[0] - dc_pred, bits);
+    dc_pred = zz[0];
+    out.put(dc, cat, bits, cat);
+
+    // AC: (zero run, category) symbols, runs over 15 as ZRL (0xF0)
+    nonzero >>= 1;
+    int k = 0;      // last coded zigzag index
+    while (nonzero != 0) {
+        int skip = __builtin_ctzll(nonzero);
+        int run = skip;
+        k += skip + 1;
+        nonzero >>= skip;
+        nonzero >>= 1;
+        while (run > 15) {
+            out.put(ac, 0xF0, 0, 0);
+            run -= 16;
+        }
+        cat = encode_value(zz[k], bits);
+        out.put(ac, (run << 4) | cat, bits, cat);
+    }
+    if (k < 63) {
+        out.put(ac, 0x00, 0, 0);    // EOB
+    }
+}
+
+// MCU rows [first_row, first_row + rows)
+// the DC predictors start from 0, as at the start of a scan / restart interval.
+template <typename sink>
+void jpeg_encoder::encode_mcus(sink &out, int first_row, int rows) const
+{
+    int dc_pred[4] = {0, 0, 0, 0};
+
+    for (int my = first_row; my < first_row + rows; my++) {
+        for (int mx = 0; mx < m_mcus_x; mx++) {
+            for (int c = 0; c < m_comps; c++) {
+                const component &comp = m_comp[c];
+                for (int v = 0; v < comp.v_samp; v++) {
+                    for (int h = 0; h < comp.h_samp; h++) {
+                        encode_block(out, comp, mx * comp.h_samp + h, my * comp.v_samp + v, dc_pred[c]);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// MCU rows of stripe index
+void jpeg_encoder::stripe_rows(int index, int &first_row, int &rows) const
+{
+    first_row = index * m_stripe_rows;
+    rows = std::min(m_stripe_rows, m_mcus_y - first_row);
+}
+
+// optimize_coding's first pass over a stripe
+void jpeg_encoder::count_stripe(int index)
+{
+    stripe &st = m_stripes[index];
+    int first_row, rows;
+    stripe_rows(index, first_row, rows);
+    memset(st.freq, 0, sizeof(st.freq));
+    st.tokens.clear();
+    token_sink tokens{st.tokens, st.freq};
+    encode_mcus(tokens, first_row, rows);
+}
+
+// entropy coded data of a stripe appended to out, padded to a byte
+void jpeg_encoder::code_stripe(int index, std::vector<uint8_t> &out) const
+{
+    bit_writer writer(out);
+    writer_sink direct{writer, &m_encoder[0][0]};
+    if (m_optimize) {
+        for (uint32_t token : m_stripes[index].tokens) {
+            direct.put(token >> 29, (token >> 21) & 0xFF, token & 0xFFFF, (token >> 16) & 0x1F);
+        }
+    } else {
+        int first_row, rows;
+        stripe_rows(index, first_row, rows);
+        encode_mcus(direct, first_row, rows);
+    }
+    writer.finish();
+}
+
+// fn(i) for every stripe i < stripes, on threads threads (the calling one included)
+// of the shared pool. stripes touch disjoint state, workers just take the next one in turn.
+template <typename F>
+void jpeg_encoder::run_stripes(int stripes, int threads, F fn)
+{
+    zzwlib::thread_pool::shared().parallel_for(0, stripes, 1, [&](int first, int end) {
+        for (int i = first; i < end; i++) {
+            fn(i);
+        }
+    }, threads);
+}
+
+int jpeg_encoder::encode(const yuv_frame &frame, std::vector<uint8_t> &out)
+{
+    if (frame.width < 1 || frame.width > 65535 || frame.height < 1 || frame.height > 65535) {
+        LOGE(jpege_logger, "invalid size %dx%d", frame.width, frame.height);
+        return -1;
+    }
+
+    bool sub = frame.format == chroma_format::yuv420;
+    m_width = frame.width;
+    m_height = frame.height;
+    m_comps = frame.format == chroma_format::gray ? 1 : 3;
+    m_max_h_samp = sub ? 2 : 1;
+    m_max_v_samp = sub ? 2 : 1;
+    m_mcus_x = (m_width + 8 * m_max_h_samp - 1) / (8 * m_max_h_samp);
+    m_mcus_y = (m_height + 8 * m_max_v_samp - 1) / (8 * m_max_v_samp);
+    for (int c = 0; c < m_comps; c++) {
+        component &comp = m_comp[c];
+        comp.id = c + 1;
+        comp.h_samp = c == 0 ? m_max_h_samp : 1;
+        comp.v_samp = c == 0 ? m_max_v_samp : 1;
+        comp.tbl = c == 0 ? 0 : 1;
+        comp.quant = comp.tbl;
+        comp.width = c == 0 || !sub ? m_width : (m_width + 1) / 2;
+        comp.height = c == 0 || !sub ? m_height : (m_height + 1) / 2;
+        comp.data = frame.planes[c];
+        comp.stride = frame.strides[c];
+        comp.coefs = nullptr;
+        comp.coef_stride = 0;
+        if (comp.data == nullptr || comp.stride < comp.width) {
+            LOGE(jpege_logger, "invalid plane %d, stride %d for width %d", c, comp.stride, comp.width);
+            return -1;
+        }
+    }
+
+    m_dqt[0] = m_quant[0];
+    m_dqt[1] = m_comps > 1 ? m_quant[1] : nullptr;
+    m_dqt[2] = nullptr;
+    m_dqt[3] = nullptr;
+    return encode_frame(out);
+}
+
+int jpeg_encoder::encode_coefficients(const coefficient_frame &frame, std::vector<uint8_t> &out)
+{
+    if (frame.width < 1 || frame.width > 65535 || frame.height < 1 || frame.height > 65535
+        || frame.comps < 1 || frame.comps > 4) {
+        LOGE(jpege_logger, "invalid frame %dx%d, %d components", frame.width, frame.height, frame.comps);
+        return -1;
+    }
+
+    m_width = frame.width;
+    m_height = frame.height;
+    m_comps = frame.comps;
+    m_max_h_samp = 1;
+    m_max_v_samp = 1;
+    for (int c = 0; c < m_comps; c++) {
+        m_max_h_samp = std::max(m_max_h_samp, frame.comp[c].h_samp);
+        m_max_v_samp = std::max(m_max_v_samp, frame.comp[c].v_samp);
+    }
+    m_mcus_x = (m_width + 8 * m_max_h_samp - 1) / (8 * m_max_h_samp);
+    m_mcus_y = (m_height + 8 * m_max_v_samp - 1) / (8 * m_max_v_samp);
+    for (int t = 0; t < 4; t++) {
+        m_dqt[t] = nullptr;
+    }
+    for (int c = 0; c < m_comps; c++) {
+        const coefficient_component &src = frame.comp[c];
+        component &comp = m_comp[c];
+        comp.id = src.id;
+        // a single component scan is not interleaved: one block per MCU
+        comp.h_samp = m_comps == 1 ? 1 : src.h_samp;
+        comp.v_samp = m_comps == 1 ? 1 : src.v_samp;
+        comp.tbl = c == 0 ? 0 : 1;
+        comp.quant = src.quant;
+        comp.width = (m_width * src.h_samp + m_max_h_samp - 1) / m_max_h_samp;
+        comp.height = (m_height * src.v_samp + m_max_v_samp - 1) / m_max_v_samp;
+        comp.data = nullptr;
+        comp.stride = 0;
+        comp.coefs = src.coefs;
+        comp.coef_stride = src.blocks_x;
+        if (src.h_samp < 1 || src.h_samp > 4 || src.v_samp < 1 || src.v_samp > 4
+            || src.quant < 0 || src.quant > 3 || frame.quant[src.quant] == nullptr
+            || src.coefs == nullptr || src.blocks_x < m_mcus_x * comp.h_samp) {
+            LOGE(jpege_logger, "invalid component %d", c);
+            return -1;
+        }
+        m_dqt[src.quant] = frame.quant[src.quant];
+    }
+    if (m_comps == 1) {
+        m_max_h_samp = 1;
+        m_max_v_samp = 1;
+        m_mcus_x = (m_width + 7) / 8;
+        m_mcus_y = (m_height + 7) / 8;
+    }
+    return encode_frame(out);
+}
+
+// entropy coding of the frame set up by encode / encode_coefficients
+int jpeg_encoder::encode_frame(std::vector<uint8_t> &out)
+{
+    // stripes of whole MCU rows, each a restart interval, for the threads
+    int threads = m_encode_threads > 0 ? m_encode_threads : (int)std::thread::hardware_concurrency();
+    int stripes = 1;
+    if (threads > 1) {
+        // a few stripes per thread to even out the load, a stripe only for a
+        // good number of MCUs, and the interval (in MCUs) has to fit DRI
+        stripes = std::min(threads * 4, m_mcus_x * m_mcus_y / min_mcus_per_stripe);
+        stripes = std::clamp(stripes, 1, m_mcus_y);
+        int rows = (m_mcus_y + stripes - 1) / stripes;
+        rows = std::min(rows, 65535 / m_mcus_x);
+        stripes = (m_mcus_y + rows - 1) / rows;
+        m_stripe_rows = rows;
+    } else {
+        m_stripe_rows = m_mcus_y;
+    }
+    m_restart_interval = stripes > 1 ? m_stripe_rows * m_mcus_x : 0;
+    threads = std::max(1, std::min(threads, stripes));
+    if ((int)m_stripes.size() < stripes) {
+        m_stripes.resize(stripes);
+    }
+
+    if (m_optimize) {
+        // pass 1: transform and quantize, keep the symbols and count them.
+        // pass 2 only codes the tokens with the tables made from the counts.
+        run_stripes(stripes, threads, [this](int i) { count_stripe(i); });
+        uint32_t freq[4][257] = {};
+        for (int i = 0; i < stripes; i++) {
+            for (int t = 0; t < 4; t++) {
+                for (int k = 0; k < 257; k++) {
+                    freq[t][k] += m_stripes[i].freq[t][k];
+                }
+            }
+        }
+        set_optimal_tables(freq);
+    } else if (!m_standard_tables) {
+        set_standard_tables();
+    }
+
+    out.clear();
+    write_headers(out);
+
+    if (stripes == 1) {
+        code_stripe(0, out);
+    } else {
+        run_stripes(stripes, threads, [this](int i) {
+            m_stripes[i].data.clear();
+            code_stripe(i, m_stripes[i].data);
+        });
+        // every stripe ends on a byte boundary, RSTn between them
+        for (int i = 0; i < stripes; i++) {
+            if (i > 0) {
+                put_marker(out, 0xD0 + ((i - 1) & 7));
+            }
+            out.insert(out.end(), m_stripes[i].data.begin(), m_stripes[i].data.end());
+        }
+    }
+
+    put_marker(out, 0xD9);      // EOI
+    return 0;
+}
+
+    } // namespace jpeg
+} // namespace zzwlib
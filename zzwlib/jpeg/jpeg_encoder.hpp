@@ -0,0 +1,166 @@
+
+//
+// baseline jpeg encoder.
+//
+// input is planar YUV (full range YCbCr, as JFIF): 4:4:4, 4:2:0 or gray,
+// e.g. the output of bmp2yuv444p or jpeg_decoder's planes.
+// per block: fixed point forward dct and quantization by reciprocal multiply
+// (the SIMD idct_kernels of the cpu), gathered into zigzag order, then huffman coding with the standard
+// tables of jpeg spec annex K, or with optimize_coding tables made for the image;
+// the zero runs are found from a bit mask of the non zero coefficients. the
+// entropy coded data goes through bit_writer.
+//
+// like jpeg_decoder, an encoder object keeps its tables and buffers and can
+// encode any number of images, one object per thread.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "huffman.hpp"
+#include "bit_writer.hpp"
+#include "idct.hpp"
+
+namespace zzwlib{
+    namespace jpeg {
+
+enum class chroma_format : int {
+    gray = 0,   // Y only
+    yuv420,     // Cb, Cr at half width and half height (rounded up)
+    yuv444,     // Cb, Cr at full size
+};
+
+const char *to_string(chroma_format format);
+
+// planar input, plane sizes follow from width, height and format
+struct yuv_frame {
+    const uint8_t *planes[3] = {nullptr, nullptr, nullptr};
+    int strides[3] = {0, 0, 0};
+    int width = 0;
+    int height = 0;
+    chroma_format format = chroma_format::yuv420;
+};
+
+// frame over a tightly packed buffer: Y, then Cb, then Cr (e.g. a .yuv file)
+yuv_frame make_yuv_frame(const uint8_t *data, int width, int height, chroma_format format);
+
+// bytes of a tightly packed frame
+size_t yuv_frame_size(int width, int height, chroma_format format);
+
+// already quantized blocks, for lossless transcoding (see jpeg_transform)
+struct coefficient_component {
+    int id = 0;                     // component id in SOF / SOS
+    int h_samp = 1;
+    int v_samp = 1;
+    int quant = 0;                  // quantization table index, into coefficient_frame::quant
+    const int16_t *coefs = nullptr; // blocks of 64 coefficients in zigzag order, MCU aligned
+    int blocks_x = 0;               // blocks per row of coefs
+};
+
+struct coefficient_frame {
+    int width = 0;
+    int height = 0;
+    int comps = 0;                  // 1 - 4
+    coefficient_component comp[4];
+    const uint16_t *quant[4] = {nullptr, nullptr, nullptr, nullptr};  // zigzag order, as in DQT
+};
+
+class jpeg_encoder final {
+public:
+    jpeg_encoder();
+
+    jpeg_encoder(const jpeg_encoder&) = delete;
+    jpeg_encoder& operator=(const jpeg_encoder&) = delete;
+
+    // 1 - 100, libjpeg scaling of the annex K quantization tables, default 75.
+    // return: 0, -1 if out of range.
+    int set_quality(int quality);
+    int quality() const { return m_quality; }
+
+    // two pass mode: huffman tables made for the image (jpeg spec K.2) instead of
+    // the standard ones, usually 5 - 10% smaller files. the first pass keeps the
+    // coded symbols, the second only puts their bits: no second fdct.
+    void set_optimize_coding(bool optimize) { m_optimize = optimize; }
+    bool optimize_coding() const { return m_optimize; }
+
+    // threads for large images: the frame is cut into stripes of whole MCU rows,
+    // each a restart interval (DRI / RSTn) coded with its own bit_writer.
+    // 0: one per cpu, 1: the calling thread only and no restart markers (default).
+    void set_encode_threads(int threads) { m_encode_threads = threads; }
+
+    // encode frame, out is replaced by the jpeg file.
+    // return: 0 on success, -1 on bad input.
+    int encode(const yuv_frame &frame, std::vector<uint8_t> &out);
+
+    // entropy code blocks which are quantized already, with their own quantization
+    // tables: no fdct, the image data is not changed. quality does not apply.
+    // return: 0 on success, -1 on bad input.
+    int encode_coefficients(const coefficient_frame &frame, std::vector<uint8_t> &out);
+
+private:
+    // quantization and huffman coding of the frame's components
+    struct component {
+        int id;
+        int h_samp;
+        int v_samp;
+        int tbl;            // huffman table, and the quality's quantization table (0: luma, 1: chroma)
+        int quant;          // quantization table index in DQT / SOF
+        int width;          // plane size
+        int height;
+        const uint8_t *data;
+        int stride;
+        const int16_t *coefs;   // quantized blocks instead of samples (encode_coefficients)
+        int coef_stride;        // blocks per row of coefs
+    };
+
+    // a restart interval of whole MCU rows, coded on its own
+    struct stripe {
+        std::vector<uint8_t> data;      // entropy coded data, padded to a byte
+        std::vector<uint32_t> tokens;   // optimize_coding's first pass
+        uint32_t freq[4][257];          // symbol counts of tokens, by huffman table
+    };
+
+    void set_standard_tables();
+    void set_optimal_tables(uint32_t (*freq)[257]);
+    void write_headers(std::vector<uint8_t> &out) const;
+    int encode_frame(std::vector<uint8_t> &out);
+    void stripe_rows(int index, int &first_row, int &rows) const;
+    void count_stripe(int index);
+    void code_stripe(int index, std::vector<uint8_t> &out) const;
+    template <typename F>
+    void run_stripes(int stripes, int threads, F fn);
+    // sink: where the huffman symbols go, the bit_writer or the first pass tokens
+    template <typename sink>
+    void encode_mcus(sink &out, int first_row, int rows) const;
+    template <typename sink>
+    void encode_block(sink &out, const component &comp, int bx, int by, int &dc_pred) const;
+
+    int m_quality = 75;
+    uint16_t m_quant[2][64];        // zigzag order, as in DQT
+    fdct_divisors m_div[2];         // natural order
+    const idct_kernels *m_kernels;
+    HuffmanTable m_huffman[2][2];   // [DC / AC][luma / chroma]
+    huffman_encoder m_encoder[2][2];
+    bool m_standard_tables = true;
+    bool m_optimize = false;
+    int m_encode_threads = 1;
+    std::vector<stripe> m_stripes;
+
+    // current frame
+    int m_width = 0;
+    int m_height = 0;
+    int m_comps = 0;
+    component m_comp[4];
+    const uint16_t *m_dqt[4] = {nullptr, nullptr, nullptr, nullptr};   // tables for DQT, by index
+    int m_max_h_samp = 1;
+    int m_max_v_samp = 1;
+    int m_mcus_x = 0;
+    int m_mcus_y = 0;
+    int m_stripe_rows = 0;          // MCU rows per stripe
+    int m_restart_interval = 0;     // MCUs, 0: no restart markers
+};
+
+    } // namespace jpeg
+} // namespace zzwlib
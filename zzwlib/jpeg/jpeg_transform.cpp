@@ -0,0 +1,205 @@
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+#include "jpeg_transform.hpp"
+#include "../logger.hpp"
+
+zzwlib::logger  jpegt_logger("jpegt", zzwlib::loglevel::log_info_level);
+
+namespace zzwlib{
+    namespace jpeg {
+
+namespace {
+
+// every op is a transpose (or not) followed by mirroring of the result
+struct op_geometry {
+    bool transpose;
+    bool flip_x;
+    bool flip_y;
+};
+
+op_geometry geometry(transform_op op)
+{
+    switch (op) {
+    case transform_op::flip_h: return {false, true, false};
+    case transform_op::flip_v: return {false, false, true};
+    case transform_op::transpose: return {true, false, false};
+    case transform_op::transverse: return {true, true, true};
+    case transform_op::rotate_90: return {true, true, false};
+    case transform_op::rotate_180: return {false, true, true};
+    case transform_op::rotate_270: return {true, false, true};
+    default: return {false, false, false};
+    }
+}
+
+// output coefficient k (zigzag) = sign[k] * input coefficient source[k] (zigzag)
+struct coef_map {
+    uint8_t source[64];
+    int8_t sign[64];
+
+    explicit coef_map(op_geometry g) {
+        for (int v = 0; v < 8; v++) {
+            for (int u = 0; u < 8; u++) {
+                int k = matIndicesToZOrder(v, u);
+                source[k] = (uint8_t)(g.transpose ? matIndicesToZOrder(u, v) : k);
+                // a mirrored cosine of odd frequency changes its sign
+                bool negate = (g.flip_x && (u & 1)) != (g.flip_y && (v & 1));
+                sign[k] = negate ? -1 : 1;
+            }
+        }
+    }
+};
+
+} // anonymous namespace
+
+const char *to_string(transform_op op)
+{
+    switch (op) {
+    case transform_op::none: return "none";
+    case transform_op::flip_h: return "flip_h";
+    case transform_op::flip_v: return "flip_v";
+    case transform_op::transpose: return "transpose";
+    case transform_op::transverse: return "transverse";
+    case transform_op::rotate_90: return "rotate_90";
+    case transform_op::rotate_180: return "rotate_180";
+    case transform_op::rotate_270: return "rotate_270";
+    default: return "unknown";
+    }
+}
+
+jpeg_transformer::jpeg_transformer()
+{
+    m_encoder.set_optimize_coding(true);
+}
+
+int jpeg_transformer::transform(const uint8_t *data, int len, transform_op op, std::vector<uint8_t> &out)
+{
+    if (m_decoder.read_coefficients(data, len) != 0) {
+        return -1;
+    }
+    const jpeg_decoder &dec = m_decoder;
+    op_geometry g = geometry(op);
+    coef_map map(g);
+    int comps = dec.components();
+
+    // the transposed image: size, sampling factors, MCU size
+    int width = g.transpose ? dec.frame_height() : dec.frame_width();
+    int height = g.transpose ? dec.frame_width() : dec.frame_height();
+    int h_samp[4], v_samp[4];
+    int max_h = 1;
+    int max_v = 1;
+    for (int c = 0; c < comps; c++) {
+        h_samp[c] = comps == 1 ? 1 : (g.transpose ? dec.v_samp(c) : dec.h_samp(c));
+        v_samp[c] = comps == 1 ? 1 : (g.transpose ? dec.h_samp(c) : dec.v_samp(c));
+        max_h = std::max(max_h, h_samp[c]);
+        max_v = std::max(max_v, v_samp[c]);
+    }
+    int mcu_w = 8 * max_h;
+    int mcu_h = 8 * max_v;
+
+    // a mirrored edge has to be whole MCUs: trim the partial one
+    if (g.flip_x) {
+        width -= width % mcu_w;
+    }
+    if (g.flip_y) {
+        height -= height % mcu_h;
+    }
+    if (width == 0 || height == 0) {
+        LOGE(jpegt_logger, "%s: %dx%d image is smaller than a MCU (%dx%d)", to_string(op),
+             dec.frame_width(), dec.frame_height(), mcu_w, mcu_h);
+        return -1;
+    }
+
+    int trimmed_w = width;
+    int trimmed_h = height;
+
+    // crop window in MCUs of the output
+    int mcu_x0 = 0;
+    int mcu_y0 = 0;
+    if (m_crop[2] > 0 && m_crop[3] > 0) {
+        int x1 = std::min(width, m_crop[0] + m_crop[2]);
+        int y1 = std::min(height, m_crop[1] + m_crop[3]);
+        if (m_crop[0] >= x1 || m_crop[1] >= y1) {
+            LOGE(jpegt_logger, "crop %d,%d %dx%d is outside the %dx%d image",
+                 m_crop[0], m_crop[1], m_crop[2], m_crop[3], width, height);
+            return -1;
+        }
+        mcu_x0 = m_crop[0] / mcu_w;
+        mcu_y0 = m_crop[1] / mcu_h;
+        width = x1 - mcu_x0 * mcu_w;
+        height = y1 - mcu_y0 * mcu_h;
+    }
+    int mcus_x = (width + mcu_w - 1) / mcu_w;
+    int mcus_y = (height + mcu_h - 1) / mcu_h;
+
+    coefficient_frame frame;
+    frame.width = width;
+    frame.height = height;
+    frame.comps = comps;
+    for (int c = 0; c < comps; c++) {
+        // a mirror is around the trimmed image (whole MCUs), before the crop
+        int mirror_x = trimmed_w / mcu_w * h_samp[c];
+        int mirror_y = trimmed_h / mcu_h * v_samp[c];
+
+        int blocks_x = mcus_x * h_samp[c];
+        int blocks_y = mcus_y * v_samp[c];
+        int src_x = dec.coef_blocks_x(c);
+        int src_y = dec.coef_blocks_y(c);
+        const int16_t *src = dec.coefficients(c);
+        std::vector<int16_t> &blocks = m_blocks[c];
+        blocks.resize((size_t)blocks_x * blocks_y * 64);
+
+        for (int by = 0; by < blocks_y; by++) {
+            for (int bx = 0; bx < blocks_x; bx++) {
+                int16_t *dst = blocks.data() + ((size_t)by * blocks_x + bx) * 64;
+                // block in the transposed image, then in the source
+                int tx = bx + mcu_x0 * h_samp[c];
+                int ty = by + mcu_y0 * v_samp[c];
+                if (g.flip_x) {
+                    tx = mirror_x - 1 - tx;
+                }
+                if (g.flip_y) {
+                    ty = mirror_y - 1 - ty;
+                }
+                int sx = g.transpose ? ty : tx;
+                int sy = g.transpose ? tx : ty;
+                if (sx < 0 || sy < 0 || sx >= src_x || sy >= src_y) {
+                    // MCU padding past the source's blocks
+                    memset(dst, 0, 64 * sizeof(int16_t));
+                    continue;
+                }
+                const int16_t *in = src + ((size_t)sy * src_x + sx) * 64;
+                for (int k = 0; k < 64; k++) {
+                    dst[k] = (int16_t)(map.sign[k] * in[map.source[k]]);
+                }
+            }
+        }
+
+        coefficient_component &comp = frame.comp[c];
+        comp.id = dec.component_id(c);
+        comp.h_samp = h_samp[c];
+        comp.v_samp = v_samp[c];
+        comp.quant = dec.quant_index(c);
+        comp.coefs = blocks.data();
+        comp.blocks_x = blocks_x;
+        // a transposed coefficient keeps its quantization value: transpose the table too
+        const uint16_t *quant = dec.quant_table(c);
+        for (int k = 0; k < 64; k++) {
+            m_quant[comp.quant][k] = quant[map.source[k]];
+        }
+        frame.quant[comp.quant] = m_quant[comp.quant];
+    }
+
+    if (m_encoder.encode_coefficients(frame, out) != 0) {
+        return -1;
+    }
+    m_width = width;
+    m_height = height;
+    LOGD(jpegt_logger, "%s: %dx%d -> %dx%d", to_string(op), dec.frame_width(), dec.frame_height(), width, height);
+    return 0;
+}
+
+    } // namespace jpeg
+} // namespace zzwlib
@@ -0,0 +1,86 @@
+
+//
+// lossless jpeg transforms: rotate, flip, transpose and crop in the DCT domain.
+//
+// the source is only entropy decoded (jpeg_decoder::read_coefficients), the
+// quantized blocks are moved around and entropy coded again by jpeg_encoder with
+// the source's quantization tables: no idct, no fdct, no requantization, the
+// image data stays exactly what it was.
+//
+// a block is rotated / flipped with its coefficients: transposing the block
+// transposes the coefficient matrix (and the quantization tables with it),
+// mirroring it negates the odd frequencies of that direction. edges which end
+// in a partial MCU can not move to the left or top, such a partial MCU column /
+// row is trimmed (as jpegtran -trim).
+//
+// the output is a baseline JFIF file; APPn (e.g. EXIF) segments are not copied.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "jpeg.hpp"
+#include "jpeg_encoder.hpp"
+
+namespace zzwlib{
+    namespace jpeg {
+
+enum class transform_op : int {
+    none = 0,
+    flip_h,         // mirror left / right
+    flip_v,         // mirror top / bottom
+    transpose,      // across the top left to bottom right diagonal
+    transverse,     // across the top right to bottom left diagonal
+    rotate_90,      // clockwise
+    rotate_180,
+    rotate_270,
+};
+
+const char *to_string(transform_op op);
+
+class jpeg_transformer final {
+public:
+    jpeg_transformer();
+
+    jpeg_transformer(const jpeg_transformer&) = delete;
+    jpeg_transformer& operator=(const jpeg_transformer&) = delete;
+
+    // keep only the rectangle (x, y) w x h of the transformed image, w or h 0: all of it.
+    // the origin is moved left / up to a MCU boundary of the output.
+    // return: 0, -1 if the rectangle is invalid.
+    int set_crop(int x, int y, int w, int h) {
+        if (x < 0 || y < 0 || w < 0 || h < 0) {
+            return -1;
+        }
+        m_crop[0] = x;
+        m_crop[1] = y;
+        m_crop[2] = w;
+        m_crop[3] = h;
+        return 0;
+    }
+
+    // huffman tables made for the output (default), or the standard ones
+    void set_optimize_coding(bool optimize) { m_encoder.set_optimize_coding(optimize); }
+
+    // transform the jpeg file data, out is replaced by the new jpeg file.
+    // return: 0 on success, -1 on error.
+    int transform(const uint8_t *data, int len, transform_op op, std::vector<uint8_t> &out);
+
+    // size of the last output
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+
+private:
+    jpeg_decoder m_decoder;
+    jpeg_encoder m_encoder;
+    int m_crop[4] = {0, 0, 0, 0};
+    std::vector<int16_t> m_blocks[4];   // output blocks per component
+    uint16_t m_quant[4][64];            // output quantization tables, zigzag order
+    int m_width = 0;
+    int m_height = 0;
+};
+
+    } // namespace jpeg
+} // namespace zzwlib
@@ -0,0 +1,497 @@
+
+//
+// jpgbench: decoder benchmark over a corpus of jpeg files.
+//
+// every file goes through the decoder stages one at a time, then end to end:
+//   markers   the marker segments up to the first SOS (tables, frame, scan header)
+//   huffman   entropy decoding into the coefficient store (read_coefficients)
+//   idct      dequantization + idct of the stored blocks into planes
+//   color     upsampling + YCbCr to BGRX of the decoded planes
+//   decode    jpeg_decoder::decode, planes only
+//   e2e       decode + color, jpeg file to BGRX pixels
+// each stage runs rounds times after one warm up run; reported are the median
+// time as MP/s and ns per 8x8 block, cycles and instructions per pixel (perf
+// events, n/a where the kernel does not allow them) and heap allocations per run.
+// a summary per stage over the whole corpus closes the report.
+//
+// -g dir writes a synthetic corpus: several sizes, gray / 4:2:0 / 4:4:4 and
+// quality 50 / 75 / 95, made with jpeg_encoder.
+//
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <new>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include <filesystem>
+#include <functional>
+
+#include "jpeg.hpp"
+#include "jpeg_encoder.hpp"
+#include "color_convert.hpp"
+#include "idct.hpp"
+#include "../input_file.hpp"
+#include "../perf_counters.hpp"
+#include "../logger.hpp"
+
+zzwlib::logger  jpgbench_logger("jpgbench", zzwlib::loglevel::log_verbose_level);
+extern zzwlib::logger jpeg_logger;
+
+// heap allocations of the whole process, the stages are run one at a time
+static std::atomic<uint64_t> g_allocs{0};
+
+void *operator new(size_t size)
+{
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    void *p = malloc(size ? size : 1);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    return malloc(size ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    return operator new(size, std::nothrow);
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+namespace {
+
+using namespace zzwlib::jpeg;
+
+enum stage : int {
+    stage_markers = 0,
+    stage_huffman,
+    stage_idct,
+    stage_color,
+    stage_decode,
+    stage_e2e,
+    stage_count,
+};
+
+const char *stage_names[stage_count] = {"markers", "huffman", "idct", "color", "decode", "e2e"};
+
+struct stage_result {
+    bool done = false;
+    double ns = 0;          // median of the rounds
+    double cycles = 0;      // per run, 0: not available
+    double instructions = 0;
+    double allocs = 0;      // per run
+};
+
+// corpus totals of a stage
+struct stage_total {
+    int files = 0;
+    double ns = 0;
+    double pixels = 0;
+    double blocks = 0;
+    double cycles = 0;
+    double instructions = 0;
+    double allocs = 0;
+};
+
+uint64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// run fn once to warm up, then rounds times.
+// return: 0, -1 if fn failed.
+int run_stage(zzwlib::perf_counters &perf, int rounds, const std::function<int()> &fn, stage_result &result)
+{
+    if (fn() != 0) {
+        return -1;
+    }
+    std::vector<double> times;
+    times.reserve(rounds);
+    double cycles = 0;
+    double instructions = 0;
+    uint64_t allocs = g_allocs.load();
+    for (int r = 0; r < rounds; r++) {
+        perf.start();
+        uint64_t begin = now_ns();
+        int ret = fn();
+        uint64_t end = now_ns();
+        perf.stop();
+        if (ret != 0) {
+            return -1;
+        }
+        times.push_back((double)(end - begin));
+        cycles += (double)perf.value(zzwlib::perf_counters::cycles);
+        instructions += (double)perf.value(zzwlib::perf_counters::instructions);
+    }
+    std::sort(times.begin(), times.end());
+    result.done = true;
+    result.ns = times[times.size() / 2];
+    result.cycles = cycles / rounds;
+    result.instructions = instructions / rounds;
+    result.allocs = (double)(g_allocs.load() - allocs) / rounds;
+    return 0;
+}
+
+// bytes from the start of the file to the end of the first SOS segment
+int headers_len(const uint8_t *data, int len)
+{
+    int pos = 2;
+    while (pos + 4 <= len) {
+        if (data[pos] != 0xff) {
+            return -1;
+        }
+        int marker = data[pos + 1];
+        if (marker == 0xff) {
+            pos++;
+            continue;
+        }
+        int seg_len = 2 + ((data[pos + 2] << 8) | data[pos + 3]);
+        if (marker == 0xda) {
+            return pos + seg_len <= len ? pos + seg_len : -1;
+        }
+        pos += seg_len;
+    }
+    return -1;
+}
+
+// stages of one file
+class file_bench final {
+public:
+    file_bench(int rounds, int threads, const bool *stages) :
+        m_rounds(rounds),
+        m_stages(stages) {
+        m_decoder.set_decode_threads(threads);
+        m_coef_decoder.set_decode_threads(threads);
+    }
+
+    int run(const char *path, stage_total *totals) {
+        zzwlib::input_file file;
+        if (file.open(path) != 0) {
+            LOGE(jpgbench_logger, "open file %s failed, %s", path, strerror(errno));
+            return -1;
+        }
+        const uint8_t *data = file.data().data();
+        int len = (int)file.size();
+        image_info info;
+        if (probe(data, len, info) != 0 || !info.supported) {
+            LOGE(jpgbench_logger, "%s: not a supported jpeg file", path);
+            return -1;
+        }
+        // the coefficients for idct, the planes for color
+        if (m_coef_decoder.read_coefficients(data, len) != 0 || m_decoder.decode(data, len) != 0) {
+            LOGE(jpgbench_logger, "%s: decode failed", path);
+            return -1;
+        }
+        m_pixels = (double)info.width * info.height;
+        m_blocks = 0;
+        for (int c = 0; c < info.components; c++) {
+            m_blocks += (double)m_coef_decoder.comp_blocks_x(c) * m_coef_decoder.comp_blocks_y(c);
+        }
+        int header_bytes = headers_len(data, len);
+
+        stage_result results[stage_count];
+        std::function<int()> fns[stage_count] = {
+            [&]() {
+                m_stream_decoder.begin_stream();
+                return m_stream_decoder.push(data, header_bytes) < 0 ? -1 : 0;
+            },
+            [&]() { return m_coef_decoder.read_coefficients(data, len); },
+            [&]() { return idct_planes(); },
+            [&]() { return color(); },
+            [&]() { return m_decoder.decode(data, len); },
+            [&]() { return m_decoder.decode(data, len) != 0 ? -1 : color(); },
+        };
+        prepare_idct();
+        m_bgrx.resize((size_t)info.width * 4 * info.height);
+
+        char sampling[32] = "";
+        for (int c = 0, n = 0; c < info.components; c++) {
+            n += snprintf(sampling + n, sizeof(sampling) - n, "%s%dx%d", c ? "," : "", info.h_samp[c], info.v_samp[c]);
+        }
+        std::string name = std::filesystem::path(path).filename().string();
+        for (int s = 0; s < stage_count; s++) {
+            if (!m_stages[s] || (s == stage_markers && header_bytes < 0)) {
+                continue;
+            }
+            stage_result &r = results[s];
+            if (run_stage(m_perf, m_rounds, fns[s], r) != 0) {
+                LOGE(jpgbench_logger, "%s: stage %s failed", path, stage_names[s]);
+                return -1;
+            }
+            print_row(name.c_str(), info, sampling, stage_names[s], r);
+
+            stage_total &t = totals[s];
+            t.files++;
+            t.ns += r.ns;
+            t.pixels += m_pixels;
+            t.blocks += m_blocks;
+            t.cycles += r.cycles;
+            t.instructions += r.instructions;
+            t.allocs += r.allocs;
+        }
+        return 0;
+    }
+
+    bool perf_available() const { return m_perf.available(); }
+
+private:
+    void print_row(const char *name, const image_info &info, const char *sampling,
+                   const char *stage, const stage_result &r) const {
+        char counters[64] = "     n/a      n/a";
+        if (r.cycles > 0) {
+            snprintf(counters, sizeof(counters), "%8.2f %8.2f", r.cycles / m_pixels, r.instructions / m_pixels);
+        }
+        printf("%-28s %5dx%-5d %-17s %-8s %10.3f %9.1f %9.2f %s %8.1f\n",
+            name, info.width, info.height, sampling, stage, r.ns / 1e6,
+            m_pixels / (r.ns / 1e3), r.ns / m_blocks, counters, r.allocs);
+    }
+
+    // quantization tables and plane buffers for the idct stage
+    void prepare_idct() {
+        for (int c = 0; c < m_coef_decoder.components(); c++) {
+            const uint16_t *zz = m_coef_decoder.quant_table(c);
+            uint16_t natural[64];
+            for (int i = 0; i < 8; i++) {
+                for (int j = 0; j < 8; j++) {
+                    natural[i * 8 + j] = zz[matIndicesToZOrder(i, j)];
+                }
+            }
+            prepare_idct_qtable(natural, m_qtables[c]);
+            m_planes[c].resize((size_t)m_coef_decoder.coef_blocks_x(c) * 8 * m_coef_decoder.coef_blocks_y(c) * 8);
+        }
+    }
+
+    // what the decoder does per block after entropy decoding
+    int idct_planes() {
+        const idct_kernels &kernels = m_idct.kernels();
+        alignas(32) int16_t natural[64];
+        for (int c = 0; c < m_coef_decoder.components(); c++) {
+            const int16_t *coefs = m_coef_decoder.coefficients(c);
+            int blocks_x = m_coef_decoder.coef_blocks_x(c);
+            int stride = blocks_x * 8;
+            for (int by = 0; by < m_coef_decoder.comp_blocks_y(c); by++) {
+                for (int bx = 0; bx < m_coef_decoder.comp_blocks_x(c); bx++) {
+                    const int16_t *zz = coefs + ((size_t)by * blocks_x + bx) * 64;
+                    int last_nz = 63;
+                    while (last_nz > 0 && zz[last_nz] == 0) {
+                        last_nz--;
+                    }
+                    kernels.dezigzag(zz, natural);
+                    m_idct.transform(natural, m_qtables[c], last_nz,
+                        m_planes[c].data() + (size_t)by * 8 * stride + bx * 8, stride);
+                }
+            }
+        }
+        return 0;
+    }
+
+    int color() {
+        auto frame = make_ycbcr_frame(m_decoder);
+        return m_converter.convert_rows(frame, 0, frame.height, m_bgrx.data(), frame.width * 4);
+    }
+
+    int m_rounds;
+    const bool *m_stages;
+    zzwlib::perf_counters m_perf;
+    jpeg_decoder m_decoder;             // decode, e2e and the planes of color
+    jpeg_decoder m_coef_decoder;        // huffman, and the blocks of idct
+    jpeg_decoder m_stream_decoder;      // markers
+    idct_engine m_idct;
+    idct_qtable m_qtables[4];
+    std::vector<uint8_t> m_planes[4];
+    color_converter m_converter;
+    std::vector<uint8_t> m_bgrx;
+    double m_pixels = 0;
+    double m_blocks = 0;
+};
+
+// jpeg files of the arguments, directories are searched (not recursively)
+void collect_files(const char *arg, std::vector<std::string> &files)
+{
+    std::error_code ec;
+    if (!std::filesystem::is_directory(arg, ec)) {
+        files.push_back(arg);
+        return;
+    }
+    std::vector<std::string> found;
+    for (const auto &entry : std::filesystem::directory_iterator(arg, ec)) {
+        std::string ext = entry.path().extension().string();
+        std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char ch) { return (char)tolower(ch); });
+        if (entry.is_regular_file(ec) && (ext == ".jpg" || ext == ".jpeg")) {
+            found.push_back(entry.path().string());
+        }
+    }
+    std::sort(found.begin(), found.end());
+    files.insert(files.end(), found.begin(), found.end());
+}
+
+// smooth gradients, edges and some noise: something between a photo and a test card
+void synthetic_plane(uint8_t *plane, int width, int height, int seed)
+{
+    uint32_t noise = 0x9e3779b9u * (uint32_t)(seed + 1);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            noise = noise * 1664525u + 1013904223u;
+            int v = (x * 160 / width) + (y * 64 / height) + seed * 16;
+            if (((x / 48) + (y / 48)) % 5 == 0) {
+                v += 48;
+            }
+            v += (int)(((x * x + y * 3 * y) >> 6) & 15);
+            v += (int)(noise >> 29) - 4;
+            plane[(size_t)y * width + x] = (uint8_t)std::clamp(v, 0, 255);
+        }
+    }
+}
+
+int generate_corpus(const char *dir)
+{
+    static const int sizes[][2] = {{320, 240}, {1001, 667}, {1920, 1080}, {4000, 3000}};
+    static const chroma_format formats[] = {chroma_format::gray, chroma_format::yuv420, chroma_format::yuv444};
+    static const int qualities[] = {50, 75, 95};
+
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    jpeg_encoder encoder;
+    std::vector<uint8_t> yuv;
+    std::vector<uint8_t> out;
+    for (const auto &size : sizes) {
+        for (auto format : formats) {
+            int width = size[0];
+            int height = size[1];
+            yuv.resize(yuv_frame_size(width, height, format));
+            auto frame = make_yuv_frame(yuv.data(), width, height, format);
+            int comps = format == chroma_format::gray ? 1 : 3;
+            for (int c = 0; c < comps; c++) {
+                int w = c == 0 || format == chroma_format::yuv444 ? width : (width + 1) / 2;
+                int h = c == 0 || format == chroma_format::yuv444 ? height : (height + 1) / 2;
+                synthetic_plane(const_cast<uint8_t *>(frame.planes[c]), w, h, c);
+            }
+            for (int quality : qualities) {
+                encoder.set_quality(quality);
+                if (encoder.encode(frame, out) != 0) {
+                    LOGE(jpgbench_logger, "encode %dx%d failed", width, height);
+                    return -1;
+                }
+                std::string path = std::string(dir) + "/" + std::to_string(width) + "x" + std::to_string(height)
+                    + "_" + to_string(format) + "_q" + std::to_string(quality) + ".jpg";
+                FILE *fp = fopen(path.c_str(), "wb");
+                if (fp == nullptr || fwrite(out.data(), 1, out.size(), fp) != out.size()) {
+                    LOGE(jpgbench_logger, "write %s failed", path.c_str());
+                    if (fp != nullptr) {
+                        fclose(fp);
+                    }
+                    return -1;
+                }
+                fclose(fp);
+                LOGI(jpgbench_logger, "%s: %zu bytes", path.c_str(), out.size());
+            }
+        }
+    }
+    return 0;
+}
+
+} // anonymous namespace
+
+/*
+ * ./jpgbench.elf [-r rounds] [-t threads] [-s stage,...] corpus_dir|file.jpg ...
+ *  rounds: timed runs per stage and file (default 5), the median is reported
+ *  threads: decode threads for restart intervals (default 1, 0: one per cpu)
+ *  stage: markers, huffman, idct, color, decode, e2e (default all)
+ * ./jpgbench.elf -g corpus_dir
+ *  writes a synthetic corpus of sizes x gray / 420 / 444 x quality 50 / 75 / 95
+ */
+int main(int argc, char *argv[])
+{
+    if (argc == 3 && strcmp(argv[1], "-g") == 0) {
+        return generate_corpus(argv[2]);
+    }
+
+    int rounds = 5;
+    int threads = 1;
+    bool stages[stage_count];
+    std::fill(stages, stages + stage_count, true);
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            rounds = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            threads = std::max(0, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            std::fill(stages, stages + stage_count, false);
+            std::string list = argv[++i];
+            for (size_t pos = 0; pos <= list.size();) {
+                size_t end = std::min(list.find(',', pos), list.size());
+                std::string name = list.substr(pos, end - pos);
+                auto it = std::find_if(stage_names, stage_names + stage_count,
+                    [&](const char *s) { return name == s; });
+                if (it == stage_names + stage_count) {
+                    LOGE(jpgbench_logger, "stage %s, expect markers, huffman, idct, color, decode or e2e", name.c_str());
+                    return -1;
+                }
+                stages[it - stage_names] = true;
+                pos = end + 1;
+            }
+        } else {
+            collect_files(argv[i], files);
+        }
+    }
+    if (files.empty()) {
+        LOGE(jpgbench_logger, "usage: %s [-r rounds] [-t threads] [-s stage,...] corpus_dir|file.jpg ...", argv[0]);
+        LOGE(jpgbench_logger, "       %s -g corpus_dir", argv[0]);
+        return -1;
+    }
+
+    // the decoder's debug log would be most of what is measured
+    jpeg_logger.set_loglevel(zzwlib::loglevel::log_warn_level);
+
+    file_bench bench(rounds, threads, stages);
+    LOGI(jpgbench_logger, "%zu files, %d rounds, %d decode threads, simd %s, perf counters %s",
+        files.size(), rounds, threads, to_string(detect_simd_level()),
+        bench.perf_available() ? "on" : "not available");
+    printf("%-28s %-11s %-17s %-8s %10s %9s %9s %8s %8s %8s\n",
+        "file", "size", "sampling", "stage", "ms", "MP/s", "ns/block", "cyc/px", "ins/px", "allocs");
+
+    stage_total totals[stage_count];
+    int failed = 0;
+    for (const auto &path : files) {
+        if (bench.run(path.c_str(), totals) != 0) {
+            failed++;
+        }
+    }
+
+    printf("\n%-8s %6s %12s %9s %9s %8s %8s %8s\n",
+        "stage", "files", "ms", "MP/s", "ns/block", "cyc/px", "ins/px", "allocs");
+    for (int s = 0; s < stage_count; s++) {
+        const stage_total &t = totals[s];
+        if (t.files == 0) {
+            continue;
+        }
+        char counters[64] = "     n/a      n/a";
+        if (t.cycles > 0) {
+            snprintf(counters, sizeof(counters), "%8.2f %8.2f", t.cycles / t.pixels, t.instructions / t.pixels);
+        }
+        printf("%-8s %6d %12.3f %9.1f %9.2f %s %8.1f\n", stage_names[s], t.files, t.ns / 1e6,
+            t.pixels / (t.ns / 1e3), t.ns / t.blocks, counters, t.allocs / t.files);
+    }
+    return failed == 0 ? 0 : -1;
+}
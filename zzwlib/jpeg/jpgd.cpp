@@ -0,0 +1,315 @@
+
+//
+// jpgd: decode a jpeg file, optionally dump the component planes.
+//
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <vector>
+#include <algorithm>
+
+#include "jpeg.hpp"
+#include "jpeg_encoder.hpp"
+#include "batch_decoder.hpp"
+#include "color_convert.hpp"
+#include "../input_file.hpp"
+#include "../logger.hpp"
+
+zzwlib::logger  jpgd_logger("jpgd", zzwlib::loglevel::log_verbose_level);
+
+// map / read a whole file, "-" is stdin
+int open_input(const char *path, zzwlib::input_file &file)
+{
+    if (file.open(path) != 0) {
+        LOGE(jpgd_logger, "open file %s failed, %s", path, strerror(errno));
+        return -1;
+    }
+    LOGD(jpgd_logger, "%s: %zu bytes, %s", path, file.size(), file.mapped() ? "mapped" : "read");
+    return 0;
+}
+
+/*
+ * ./jpgd.elf -b rounds threads a.jpg b.jpg ...
+ *  decodes the files as one batch, rounds times, on a pool of threads (0: one per cpu)
+ */
+int batch_main(int argc, char *argv[])
+{
+    if (argc < 5) {
+        LOGE(jpgd_logger, "usage: %s -b rounds threads a.jpg ...", argv[0]);
+        return -1;
+    }
+    int rounds = atoi(argv[2]);
+    zzwlib::jpeg::batch_decoder batch(atoi(argv[3]));
+
+    std::vector<zzwlib::input_file> files(argc - 4);
+    std::vector<zzwlib::jpeg::jpeg_input> inputs;
+    for (int i = 4; i < argc; i++) {
+        auto &file = files[i - 4];
+        if (open_input(argv[i], file) != 0) {
+            return -1;
+        }
+        inputs.push_back({file.data().data(), file.size()});
+    }
+
+    std::vector<zzwlib::jpeg::decoded_image> outputs;
+    for (int r = 0; r < rounds; r++) {
+        zzwlib::jpeg::batch_stats stats;
+        int ret = batch.decode(inputs, outputs, &stats);
+        LOGI(jpgd_logger, "round %d: %d images, %d failed, %d threads, %.1f images/s, %.1f MP/s, "
+            "latency us min %.1f avg %.1f p50 %.1f p99 %.1f max %.1f",
+            r, stats.images, stats.failed, batch.threads(), stats.images_per_sec, stats.megapixels_per_sec,
+            stats.latency_min_ns / 1e3, stats.latency_avg_ns / 1e3, stats.latency_p50_ns / 1e3,
+            stats.latency_p99_ns / 1e3, stats.latency_max_ns / 1e3);
+        if (ret != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * ./jpgd.elf -p a.jpg ...
+ *  prints the frame header of the files, from the first 4 kB only (more if an
+ *  APPn segment is larger)
+ */
+int probe_main(int argc, char *argv[])
+{
+    for (int i = 2; i < argc; i++) {
+        zzwlib::input_file file;
+        if (open_input(argv[i], file) != 0) {
+            return -1;
+        }
+        zzwlib::jpeg::image_info info;
+        size_t len = std::min<size_t>(file.size(), 4096);
+        int ret;
+        while ((ret = zzwlib::jpeg::probe(file.data().first(len), info)) == 1 && len < file.size()) {
+            len = std::min(file.size(), len * 4);
+        }
+        if (ret != 0) {
+            LOGE(jpgd_logger, "%s: no frame header", argv[i]);
+            continue;
+        }
+        char sampling[32] = "";
+        for (int c = 0, n = 0; c < info.components; c++) {
+            n += snprintf(sampling + n, sizeof(sampling) - n, "%s%dx%d", c ? "," : "", info.h_samp[c], info.v_samp[c]);
+        }
+        LOGI(jpgd_logger, "%s: %dx%d, %d components %s, SOF%d%s, %d bit, header %d bytes%s",
+            argv[i], info.width, info.height, info.components, sampling, info.sof_marker - 0xC0,
+            info.progressive ? " progressive" : "", info.precision, info.header_len,
+            info.supported ? "" : ", not supported");
+    }
+    return 0;
+}
+
+// a noisy 4:2:0 image from the encoder; threads > 1 codes it in restart intervals
+std::vector<uint8_t> make_test_jpeg(int threads)
+{
+    const int width = 1024;
+    const int height = 512;
+    auto format = zzwlib::jpeg::chroma_format::yuv420;
+    std::vector<uint8_t> yuv(zzwlib::jpeg::yuv_frame_size(width, height, format));
+    uint32_t seed = 1;
+    for (size_t i = 0; i < yuv.size(); i++) {
+        seed = seed * 1664525u + 1013904223u;
+        yuv[i] = (uint8_t)(i % width + (seed >> 28));
+    }
+    zzwlib::jpeg::jpeg_encoder encoder;
+    encoder.set_encode_threads(threads);
+    std::vector<uint8_t> jpeg;
+    encoder.encode(zzwlib::jpeg::make_yuv_frame(yuv.data(), width, height, format), jpeg);
+    return jpeg;
+}
+
+// jpeg with segment inserted before the first marker 0xff, marker
+std::vector<uint8_t> insert_segment(const std::vector<uint8_t> &jpeg, uint8_t marker,
+                                    const std::vector<uint8_t> &segment)
+{
+    std::vector<uint8_t> out = jpeg;
+    for (size_t i = 2; i + 1 < jpeg.size(); i++) {
+        if (jpeg[i] == 0xff && jpeg[i + 1] == marker) {
+            out.insert(out.begin() + i, segment.begin(), segment.end());
+            break;
+        }
+    }
+    return out;
+}
+
+// DHT of DC table 0 with count codes of length 1
+std::vector<uint8_t> one_bit_dht(int count)
+{
+    int len = 2 + 1 + 16 + count;
+    std::vector<uint8_t> segment = {0xff, 0xc4, (uint8_t)(len >> 8), (uint8_t)len, 0x00, (uint8_t)count};
+    segment.resize(4 + 1 + 16 + count, 0);
+    return segment;
+}
+
+// jpeg cut at percent of its (first) scan's data, with an EOI marker after the cut
+std::vector<uint8_t> truncate_scan(const std::vector<uint8_t> &jpeg, int percent)
+{
+    size_t start = 0;
+    for (size_t i = 2; i + 3 < jpeg.size(); i++) {
+        if (jpeg[i] == 0xff && jpeg[i + 1] == 0xda) {
+            start = i + 2 + ((jpeg[i + 2] << 8) | jpeg[i + 3]);
+            break;
+        }
+    }
+    size_t cut = start + (jpeg.size() - 2 - start) * percent / 100;
+    // not in the middle of a 0xff00 / RSTn
+    while (cut > start && jpeg[cut - 1] == 0xff) {
+        cut--;
+    }
+    std::vector<uint8_t> out(jpeg.begin(), jpeg.begin() + cut);
+    out.push_back(0xff);
+    out.push_back(0xd9);
+    return out;
+}
+
+// jpeg without its n-th (from 0) RSTn marker
+std::vector<uint8_t> drop_restart(const std::vector<uint8_t> &jpeg, int n)
+{
+    std::vector<uint8_t> out = jpeg;
+    for (size_t i = 0; i + 1 < out.size(); i++) {
+        if (out[i] == 0xff && out[i + 1] >= 0xd0 && out[i + 1] <= 0xd7 && n-- == 0) {
+            out.erase(out.begin() + i, out.begin() + i + 2);
+            break;
+        }
+    }
+    return out;
+}
+
+// decode and stream decode (in 1000 byte pieces) of jpeg.
+// return: 0 if both give expected (0 or -1), -1 otherwise
+int check_decode(const char *name, const std::vector<uint8_t> &jpeg, int expected)
+{
+    zzwlib::jpeg::jpeg_decoder decoder;
+    int decoded = decoder.decode(jpeg.data(), (int)jpeg.size());
+
+    decoder.begin_stream();
+    int streamed = 0;
+    for (size_t pos = 0; pos < jpeg.size() && streamed == 0; pos += 1000) {
+        streamed = decoder.push(jpeg.data() + pos, std::min<size_t>(1000, jpeg.size() - pos));
+    }
+    if (streamed >= 0) {
+        streamed = decoder.finish();
+    }
+
+    bool ok = decoded == expected && streamed == expected;
+    LOGI(jpgd_logger, "%-36s decode %2d, stream %2d: %s", name, decoded, streamed, ok ? "ok" : "FAILED");
+    return ok ? 0 : -1;
+}
+
+/*
+ * ./jpgd.elf -c
+ *  checks that broken files are rejected, by decode() and by the streaming decoder
+ */
+int check_main()
+{
+    int failed = 0;
+    std::vector<uint8_t> jpeg = make_test_jpeg(1);
+    failed += check_decode("valid", jpeg, 0) != 0;
+
+    // more codes than a length has: written past the lookup table once
+    failed += check_decode("DHT 200 one bit codes", insert_segment(jpeg, 0xc4, one_bit_dht(200)), -1) != 0;
+    failed += check_decode("DHT 12 one bit codes", insert_segment(jpeg, 0xc4, one_bit_dht(12)), -1) != 0;
+    // codes 0 and 1: the all ones code
+    failed += check_decode("DHT all ones code", insert_segment(jpeg, 0xc4, one_bit_dht(2)), -1) != 0;
+
+    // scan data cut short, the EOI marker right after: no MCU may take the zero bits
+    std::vector<uint8_t> restart_jpeg = make_test_jpeg(4);
+    failed += check_decode("valid, restart intervals", restart_jpeg, 0) != 0;
+    for (int percent : {30, 60, 95}) {
+        char name[64];
+        snprintf(name, sizeof(name), "truncated at %d%% + EOI", percent);
+        failed += check_decode(name, truncate_scan(jpeg, percent), -1) != 0;
+        snprintf(name, sizeof(name), "restarts, truncated at %d%% + EOI", percent);
+        failed += check_decode(name, truncate_scan(restart_jpeg, percent), -1) != 0;
+    }
+
+    // the intervals after a lost RSTn must not move up a slot
+    failed += check_decode("restarts, RST 0 lost", drop_restart(restart_jpeg, 0), -1) != 0;
+    failed += check_decode("restarts, RST 4 lost", drop_restart(restart_jpeg, 4), -1) != 0;
+
+    LOGI(jpgd_logger, "%d checks failed", failed);
+    return failed == 0 ? 0 : -1;
+}
+
+/*
+ * ./jpgd.elf test.jpg test.yuv [threads] [scale] [x,y,w,h]
+ *  test.jpg may be "-" to read from stdin
+ *  scale: 1 (default), 2, 4 or 8, decode at 1/scale of the image size
+ *  x,y,w,h: decode this rectangle only, the origin is rounded down to a MCU
+ *  an output name ending in .bgra gets 32 bit B G R A pixels instead,
+ *  converted in tiles on threads threads too:
+ *  ffplay -f rawvideo -pixel_format bgra -video_size 16x16 test.bgra
+ *  writes the decoded components as planes, e.g. for 4:2:0 input:
+ *  ffplay -f rawvideo -pixel_format yuv420p -video_size 16x16 test.yuv
+ */
+int main(int argc, char *argv[])
+{
+    if (argc > 1 && strcmp(argv[1], "-b") == 0) {
+        return batch_main(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "-p") == 0) {
+        return probe_main(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+        return check_main();
+    }
+
+    const char *jpeg_file = argc > 1 ? argv[1] : "test.jpg";
+    zzwlib::jpeg::jpeg_decoder decoder;
+    int threads = 0;
+    if (argc > 3) {
+        threads = atoi(argv[3]);
+        decoder.set_decode_threads(threads);
+    }
+    if (argc > 4 && decoder.set_scale(atoi(argv[4])) != 0) {
+        LOGE(jpgd_logger, "scale %s, expect 1, 2, 4 or 8", argv[4]);
+        return -1;
+    }
+    if (argc > 5) {
+        int x = 0, y = 0, w = 0, h = 0;
+        if (sscanf(argv[5], "%d,%d,%d,%d", &x, &y, &w, &h) != 4 || decoder.set_crop(x, y, w, h) != 0) {
+            LOGE(jpgd_logger, "crop %s, expect x,y,w,h", argv[5]);
+            return -1;
+        }
+    }
+    zzwlib::input_file file;
+    if (open_input(jpeg_file, file) != 0) {
+        return -1;
+    }
+    if (decoder.decode(file.data()) != 0) {
+        LOGE(jpgd_logger, "decode %s failed", jpeg_file);
+        return -1;
+    }
+    LOGI(jpgd_logger, "%dx%d at %d,%d", decoder.width(), decoder.height(), decoder.crop_x(), decoder.crop_y());
+    if (argc > 2) {
+        FILE *fp = fopen(argv[2], "wb");
+        size_t name_len = strlen(argv[2]);
+        if (fp != nullptr && name_len > 5 && strcmp(argv[2] + name_len - 5, ".bgra") == 0) {
+            auto frame = zzwlib::jpeg::make_ycbcr_frame(decoder);
+            std::vector<uint8_t> bgra((size_t)frame.width * 4 * frame.height);
+            zzwlib::jpeg::color_converter converter;
+            converter.convert_rows(frame, 0, frame.height, bgra.data(), frame.width * 4,
+                                   zzwlib::thread_pool::shared(), threads);
+            fwrite(bgra.data(), 1, bgra.size(), fp);
+            fclose(fp);
+            return 0;
+        }
+        if (fp == nullptr) {
+            LOGE(jpgd_logger, "open file %s failed", argv[2]);
+            return -1;
+        }
+        for (int c = 0; c < decoder.components(); c++) {
+            auto *plane = decoder.plane(c);
+            for (int y = 0; y < plane->height; y++) {
+                fwrite(plane->data.data() + (size_t)y * plane->stride, 1, plane->width, fp);
+            }
+        }
+        fclose(fp);
+    }
+    return 0;
+}
@@ -0,0 +1,104 @@
+//
+// jpge: encode planar YUV into a baseline jpeg file.
+//
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <vector>
+#include <chrono>
+
+#include "jpeg_encoder.hpp"
+#include "../input_file.hpp"
+#include "../logger.hpp"
+
+zzwlib::logger  jpge_logger("jpge", zzwlib::loglevel::log_verbose_level);
+
+/*
+ * ./jpge.elf in.yuv WxH format out.jpg [quality] [rounds] [opt] [threads=N]
+ *  format: 420, 444 or gray; in.yuv holds the planes back to back, e.g. from
+ *  bmp2yuv444.elf (444) or jpgd.elf (the decoded planes).
+ *  rounds > 1 encodes the frame again and again to measure the speed.
+ *  opt: two pass encoding with huffman tables made for the image.
+ *  threads=N: encode stripes (restart intervals) on N threads, 0: one per cpu.
+ */
+int main(int argc, char *argv[])
+{
+    if (argc < 5) {
+        LOGE(jpge_logger, "usage: %s in.yuv WxH 420|444|gray out.jpg [quality] [rounds] [opt] [threads=N]", argv[0]);
+        return -1;
+    }
+
+    int width = 0;
+    int height = 0;
+    if (sscanf(argv[2], "%dx%d", &width, &height) != 2) {
+        LOGE(jpge_logger, "size %s, expect WxH", argv[2]);
+        return -1;
+    }
+    zzwlib::jpeg::chroma_format format;
+    if (strcmp(argv[3], "420") == 0) {
+        format = zzwlib::jpeg::chroma_format::yuv420;
+    } else if (strcmp(argv[3], "444") == 0) {
+        format = zzwlib::jpeg::chroma_format::yuv444;
+    } else if (strcmp(argv[3], "gray") == 0) {
+        format = zzwlib::jpeg::chroma_format::gray;
+    } else {
+        LOGE(jpge_logger, "format %s, expect 420, 444 or gray", argv[3]);
+        return -1;
+    }
+
+    zzwlib::jpeg::jpeg_encoder encoder;
+    if (argc > 5 && encoder.set_quality(atoi(argv[5])) != 0) {
+        LOGE(jpge_logger, "quality %s, expect 1 - 100", argv[5]);
+        return -1;
+    }
+    int rounds = argc > 6 ? std::max(1, atoi(argv[6])) : 1;
+    for (int i = 7; i < argc; i++) {
+        int threads = 0;
+        if (strcmp(argv[i], "opt") == 0) {
+            encoder.set_optimize_coding(true);
+        } else if (sscanf(argv[i], "threads=%d", &threads) == 1 && threads >= 0) {
+            encoder.set_encode_threads(threads);
+        } else {
+            LOGE(jpge_logger, "%s, expect opt or threads=N", argv[i]);
+            return -1;
+        }
+    }
+
+    zzwlib::input_file file;
+    if (file.open(argv[1]) != 0) {
+        LOGE(jpge_logger, "open file %s failed, %s", argv[1], strerror(errno));
+        return -1;
+    }
+    if (width <= 0 || height <= 0 || file.size() < zzwlib::jpeg::yuv_frame_size(width, height, format)) {
+        LOGE(jpge_logger, "%s: %zu bytes, too short for %dx%d %s", argv[1], file.size(), width, height,
+             zzwlib::jpeg::to_string(format));
+        return -1;
+    }
+    auto frame = zzwlib::jpeg::make_yuv_frame(file.data().data(), width, height, format);
+
+    std::vector<uint8_t> jpeg;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        if (encoder.encode(frame, jpeg) != 0) {
+            LOGE(jpge_logger, "encode failed");
+            return -1;
+        }
+    }
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    LOGI(jpge_logger, "%dx%d %s q%d%s: %zu bytes, %.3f ms, %.1f MP/s", width, height,
+         zzwlib::jpeg::to_string(format), encoder.quality(), encoder.optimize_coding() ? " opt" : "",
+         jpeg.size(), sec * 1000.0 / rounds,
+         (double)width * height * rounds / sec / 1e6);
+
+    FILE *fp = fopen(argv[4], "wb");
+    if (fp == nullptr) {
+        LOGE(jpge_logger, "open file %s failed", argv[4]);
+        return -1;
+    }
+    fwrite(jpeg.data(), 1, jpeg.size(), fp);
+    fclose(fp);
+    return 0;
+}
@@ -0,0 +1,189 @@
+//
+// jpgt: lossless rotate / flip / crop of a jpeg file.
+//
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+#include "jpeg_transform.hpp"
+#include "../input_file.hpp"
+#include "../logger.hpp"
+
+zzwlib::logger  jpgt_logger("jpgt", zzwlib::loglevel::log_verbose_level);
+
+namespace {
+
+// op which undoes op
+zzwlib::jpeg::transform_op inverse(zzwlib::jpeg::transform_op op)
+{
+    switch (op) {
+    case zzwlib::jpeg::transform_op::rotate_90: return zzwlib::jpeg::transform_op::rotate_270;
+    case zzwlib::jpeg::transform_op::rotate_270: return zzwlib::jpeg::transform_op::rotate_90;
+    default: return op;
+    }
+}
+
+// every op and its inverse over synthetic MCU aligned frames, YCbCr 4:2:0 and
+// 4 component (CMYK) 1x1: the blocks have to come back bit for bit.
+// return: number of failed round trips
+int check_transforms()
+{
+    struct layout {
+        int comps;
+        int h_samp[4];
+        int v_samp[4];
+        int quant[4];
+    };
+    const layout layouts[] = {
+        {3, {2, 1, 1, 1}, {2, 1, 1, 1}, {0, 1, 1, 0}},
+        {4, {1, 1, 1, 1}, {1, 1, 1, 1}, {0, 1, 1, 0}},
+        {4, {2, 1, 1, 2}, {1, 1, 1, 1}, {0, 1, 1, 0}},
+    };
+    int failed = 0;
+    for (const layout &l : layouts) {
+        int max_h = *std::max_element(l.h_samp, l.h_samp + l.comps);
+        int max_v = *std::max_element(l.v_samp, l.v_samp + l.comps);
+        int mcus_x = 5;
+        int mcus_y = 3;
+
+        // random quantized blocks, mostly zero as real ones
+        zzwlib::jpeg::coefficient_frame frame;
+        frame.width = mcus_x * 8 * max_h;
+        frame.height = mcus_y * 8 * max_v;
+        frame.comps = l.comps;
+        uint16_t quant[2][64];
+        for (int k = 0; k < 64; k++) {
+            quant[0][k] = (uint16_t)(1 + k);
+            quant[1][k] = (uint16_t)(2 + k);
+        }
+        frame.quant[0] = quant[0];
+        frame.quant[1] = quant[1];
+        std::vector<int16_t> blocks[4];
+        for (int c = 0; c < l.comps; c++) {
+            int blocks_x = mcus_x * l.h_samp[c];
+            blocks[c].resize((size_t)blocks_x * mcus_y * l.v_samp[c] * 64);
+            for (size_t i = 0; i < blocks[c].size(); i++) {
+                blocks[c][i] = (i % 64 == 0 || rand() % 4 == 0) ? (int16_t)(rand() % 201 - 100) : 0;
+            }
+            zzwlib::jpeg::coefficient_component &comp = frame.comp[c];
+            comp.id = c + 1;
+            comp.h_samp = l.h_samp[c];
+            comp.v_samp = l.v_samp[c];
+            comp.quant = l.quant[c];
+            comp.coefs = blocks[c].data();
+            comp.blocks_x = blocks_x;
+        }
+        zzwlib::jpeg::jpeg_encoder encoder;
+        std::vector<uint8_t> source;
+        if (encoder.encode_coefficients(frame, source) != 0) {
+            failed++;
+            continue;
+        }
+
+        zzwlib::jpeg::jpeg_transformer transformer;
+        zzwlib::jpeg::jpeg_decoder decoder;
+        std::vector<uint8_t> there;
+        std::vector<uint8_t> back;
+        for (int i = 0; i <= (int)zzwlib::jpeg::transform_op::rotate_270; i++) {
+            auto op = (zzwlib::jpeg::transform_op)i;
+            bool ok = transformer.transform(source.data(), (int)source.size(), op, there) == 0
+                      && transformer.transform(there.data(), (int)there.size(), inverse(op), back) == 0
+                      && decoder.read_coefficients(back.data(), (int)back.size()) == 0
+                      && decoder.components() == l.comps
+                      && decoder.frame_width() == frame.width && decoder.frame_height() == frame.height;
+            for (int c = 0; ok && c < l.comps; c++) {
+                int blocks_x = frame.comp[c].blocks_x;
+                int blocks_y = mcus_y * l.v_samp[c];
+                ok = decoder.coef_blocks_x(c) >= blocks_x && decoder.coef_blocks_y(c) >= blocks_y;
+                for (int by = 0; ok && by < blocks_y; by++) {
+                    ok = memcmp(decoder.coefficients(c) + (size_t)by * decoder.coef_blocks_x(c) * 64,
+                                blocks[c].data() + (size_t)by * blocks_x * 64, blocks_x * 64 * sizeof(int16_t)) == 0;
+                }
+            }
+            if (!ok) {
+                LOGE(jpgt_logger, "%d components: %s round trip failed", l.comps, zzwlib::jpeg::to_string(op));
+                failed++;
+            }
+        }
+    }
+    return failed;
+}
+
+} // namespace
+
+/*
+ * ./jpgt.elf in.jpg out.jpg op [x,y,w,h] [rounds]
+ *  op: none, flip_h, flip_v, transpose, transverse, rotate_90, rotate_180, rotate_270
+ *  x,y,w,h: crop of the transformed image, the origin is aligned to a MCU.
+ *  rounds > 1 transforms the image again and again to measure the speed.
+ * ./jpgt.elf -c
+ *  checks that every op and its inverse give back the blocks, 3 and 4 component images
+ */
+int main(int argc, char *argv[])
+{
+    if (argc == 2 && strcmp(argv[1], "-c") == 0) {
+        int failed = check_transforms();
+        LOGI(jpgt_logger, "%d round trips failed", failed);
+        return failed == 0 ? 0 : -1;
+    }
+    if (argc < 4) {
+        LOGE(jpgt_logger, "usage: %s in.jpg out.jpg op [x,y,w,h] [rounds], or %s -c", argv[0], argv[0]);
+        return -1;
+    }
+
+    zzwlib::jpeg::transform_op op = zzwlib::jpeg::transform_op::none;
+    bool found = false;
+    for (int i = 0; i <= (int)zzwlib::jpeg::transform_op::rotate_270; i++) {
+        if (strcmp(argv[3], zzwlib::jpeg::to_string((zzwlib::jpeg::transform_op)i)) == 0) {
+            op = (zzwlib::jpeg::transform_op)i;
+            found = true;
+        }
+    }
+    if (!found) {
+        LOGE(jpgt_logger, "unknown op %s", argv[3]);
+        return -1;
+    }
+
+    zzwlib::jpeg::jpeg_transformer transformer;
+    if (argc > 4) {
+        int x = 0, y = 0, w = 0, h = 0;
+        if (sscanf(argv[4], "%d,%d,%d,%d", &x, &y, &w, &h) != 4 || transformer.set_crop(x, y, w, h) != 0) {
+            LOGE(jpgt_logger, "crop %s, expect x,y,w,h", argv[4]);
+            return -1;
+        }
+    }
+    int rounds = argc > 5 ? std::max(1, atoi(argv[5])) : 1;
+
+    zzwlib::input_file file;
+    if (file.open(argv[1]) != 0) {
+        LOGE(jpgt_logger, "open file %s failed, %s", argv[1], strerror(errno));
+        return -1;
+    }
+
+    std::vector<uint8_t> jpeg;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        if (transformer.transform(file.data().data(), (int)file.size(), op, jpeg) != 0) {
+            LOGE(jpgt_logger, "transform failed");
+            return -1;
+        }
+    }
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    LOGI(jpgt_logger, "%s: %dx%d, %zu bytes, %.3f ms", zzwlib::jpeg::to_string(op),
+         transformer.width(), transformer.height(), jpeg.size(), sec * 1000.0 / rounds);
+
+    FILE *fp = fopen(argv[2], "wb");
+    if (fp == nullptr) {
+        LOGE(jpgt_logger, "open file %s failed", argv[2]);
+        return -1;
+    }
+    fwrite(jpeg.data(), 1, jpeg.size(), fp);
+    fclose(fp);
+    return 0;
+}
@@ -0,0 +1,735 @@
+#include <string.h>
+#include <cmath>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RGB_X86_SIMD 1
+#endif
+
+#include "rgb_convert.hpp"
+
+namespace zzwlib{
+    namespace jpeg {
+
+namespace {
+
+const int SCALE_BITS = 14;
+// the bias lane of the (B, 256) pair
+const int BIAS_MUL = 256;
+
+inline uint8_t clamp_u8(int v)
+{
+    return (uint8_t)(v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+inline void rgb_pixel_scalar(int r, int g, int b, const rgb_to_yuv_coefs &k,
+                             uint8_t &y, uint8_t &cb, uint8_t &cr)
+{
+    y  = clamp_u8((k.y[0] * r + k.y[1] * g + k.y[2] * b + k.y_bias * BIAS_MUL) >> SCALE_BITS);
+    cb = clamp_u8((k.cb[0] * r + k.cb[1] * g + k.cb[2] * b + k.c_bias * BIAS_MUL) >> SCALE_BITS);
+    cr = clamp_u8((k.cr[0] * r + k.cr[1] * g + k.cr[2] * b + k.c_bias * BIAS_MUL) >> SCALE_BITS);
+}
+
+template <int bpp>
+void rgb_row_scalar(const uint8_t *src, uint8_t *y, uint8_t *cb, uint8_t *cr,
+                    int width, const rgb_to_yuv_coefs &k)
+{
+    for (int x = 0; x < width; x++) {
+        const uint8_t *p = src + bpp * x;
+        rgb_pixel_scalar(p[2], p[1], p[0], k, y[x], cb[x], cr[x]);
+    }
+}
+
+// chroma of the sum of 4 pixels: the bias lane is 4 x 256, the shift 2 more
+inline void chroma_sum_scalar(int r, int g, int b, const rgb_to_yuv_coefs &k, uint8_t &cb, uint8_t &cr)
+{
+    cb = clamp_u8((k.cb[0] * r + k.cb[1] * g + k.cb[2] * b + k.c_bias * 4 * BIAS_MUL) >> (SCALE_BITS + 2));
+    cr = clamp_u8((k.cr[0] * r + k.cr[1] * g + k.cr[2] * b + k.c_bias * 4 * BIAS_MUL) >> (SCALE_BITS + 2));
+}
+
+inline uint8_t luma_scalar(const uint8_t *p, const rgb_to_yuv_coefs &k)
+{
+    return clamp_u8((k.y[0] * p[2] + k.y[1] * p[1] + k.y[2] * p[0] + k.y_bias * BIAS_MUL) >> SCALE_BITS);
+}
+
+// an odd last column counts twice
+template <int bpp>
+void rgb_row2_scalar(const uint8_t *src0, const uint8_t *src1, uint8_t *y0, uint8_t *y1,
+                     uint8_t *cb, uint8_t *cr, int width, const rgb_to_yuv_coefs &k)
+{
+    for (int x = 0; x < width; x += 2) {
+        const uint8_t *p0 = src0 + bpp * x;
+        const uint8_t *p1 = src1 + bpp * x;
+        int next = x + 1 < width ? bpp : 0;
+        y0[x] = luma_scalar(p0, k);
+        if (next) {
+            y0[x + 1] = luma_scalar(p0 + next, k);
+        }
+        if (y1) {
+            y1[x] = luma_scalar(p1, k);
+            if (next) {
+                y1[x + 1] = luma_scalar(p1 + next, k);
+            }
+        }
+        int r = p0[2] + p0[next + 2] + p1[2] + p1[next + 2];
+        int g = p0[1] + p0[next + 1] + p1[1] + p1[next + 1];
+        int b = p0[0] + p0[next] + p1[0] + p1[next];
+        if (cr) {
+            chroma_sum_scalar(r, g, b, k, cb[x / 2], cr[x / 2]);
+        } else {
+            chroma_sum_scalar(r, g, b, k, cb[x], cb[x + 1]);
+        }
+    }
+}
+
+#ifdef RGB_X86_SIMD
+
+#define SSE2_TARGET __attribute__((target("sse2")))
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+// (c0, c1) in every 32-bit lane
+inline SSE2_TARGET __m128i pair_const(int c0, int c1)
+{
+    return _mm_set1_epi32((int)(((uint32_t)(uint16_t)c1 << 16) | (uint16_t)c0));
+}
+
+// matrix rows as madd pairs: (R, G) and (B, 256)
+struct sse2_coefs {
+    __m128i rg[3];
+    __m128i b1[3];
+};
+
+inline SSE2_TARGET sse2_coefs load_coefs_sse2(const rgb_to_yuv_coefs &k)
+{
+    sse2_coefs c;
+    const int16_t *rows[3] = {k.y, k.cb, k.cr};
+    for (int i = 0; i < 3; i++) {
+        c.rg[i] = pair_const(rows[i][0], rows[i][1]);
+        c.b1[i] = pair_const(rows[i][2], i == 0 ? k.y_bias : k.c_bias);
+    }
+    return c;
+}
+
+// 3 x 16 interleaved bytes (48 bytes) into 3 planes of 16, by four rounds of
+// byte unpacks of the registers with each other (as OpenCV does without pshufb)
+inline SSE2_TARGET void deinterleave3_sse2(const uint8_t *src, __m128i &c0, __m128i &c1, __m128i &c2)
+{
+    __m128i t0 = _mm_loadu_si128((const __m128i *)src);
+    __m128i t1 = _mm_loadu_si128((const __m128i *)(src + 16));
+    __m128i t2 = _mm_loadu_si128((const __m128i *)(src + 32));
+    for (int round = 0; round < 3; round++) {
+        __m128i u0 = _mm_unpacklo_epi8(t0, _mm_unpackhi_epi64(t1, t1));
+        __m128i u1 = _mm_unpacklo_epi8(_mm_unpackhi_epi64(t0, t0), t2);
+        __m128i u2 = _mm_unpacklo_epi8(t1, _mm_unpackhi_epi64(t2, t2));
+        t0 = u0;
+        t1 = u1;
+        t2 = u2;
+    }
+    c0 = _mm_unpacklo_epi8(t0, _mm_unpackhi_epi64(t1, t1));
+    c1 = _mm_unpacklo_epi8(_mm_unpackhi_epi64(t0, t0), t2);
+    c2 = _mm_unpacklo_epi8(t1, _mm_unpackhi_epi64(t2, t2));
+}
+
+// one component of 8 pixels, 16-bit results
+inline SSE2_TARGET __m128i component_sse2(__m128i rg_lo, __m128i rg_hi, __m128i b1_lo, __m128i b1_hi,
+                                          __m128i k_rg, __m128i k_b1, int shift = SCALE_BITS)
+{
+    __m128i lo = _mm_add_epi32(_mm_madd_epi16(rg_lo, k_rg), _mm_madd_epi16(b1_lo, k_b1));
+    __m128i hi = _mm_add_epi32(_mm_madd_epi16(rg_hi, k_rg), _mm_madd_epi16(b1_hi, k_b1));
+    return _mm_packs_epi32(_mm_srai_epi32(lo, shift), _mm_srai_epi32(hi, shift));
+}
+
+// 8 pixels of 16-bit R, G, B to 16-bit Y, Cb, Cr
+inline SSE2_TARGET void convert8_sse2(__m128i r, __m128i g, __m128i b, const sse2_coefs &c, __m128i *out)
+{
+    const __m128i mul = _mm_set1_epi16(BIAS_MUL);
+    __m128i rg_lo = _mm_unpacklo_epi16(r, g);
+    __m128i rg_hi = _mm_unpackhi_epi16(r, g);
+    __m128i b1_lo = _mm_unpacklo_epi16(b, mul);
+    __m128i b1_hi = _mm_unpackhi_epi16(b, mul);
+    for (int i = 0; i < 3; i++) {
+        out[i] = component_sse2(rg_lo, rg_hi, b1_lo, b1_hi, c.rg[i], c.b1[i]);
+    }
+}
+
+// 16 pixels as 16-bit R, G, B (pixels 0-7 and 8-15) to the planes, packus clamps
+inline SSE2_TARGET void convert16_sse2(const __m128i *r, const __m128i *g, const __m128i *b,
+                                       const sse2_coefs &c, uint8_t *y, uint8_t *cb, uint8_t *cr)
+{
+    __m128i lo[3], hi[3];
+    convert8_sse2(r[0], g[0], b[0], c, lo);
+    convert8_sse2(r[1], g[1], b[1], c, hi);
+    _mm_storeu_si128((__m128i *)y, _mm_packus_epi16(lo[0], hi[0]));
+    _mm_storeu_si128((__m128i *)cb, _mm_packus_epi16(lo[1], hi[1]));
+    _mm_storeu_si128((__m128i *)cr, _mm_packus_epi16(lo[2], hi[2]));
+}
+
+SSE2_TARGET void bgr888_row_sse2(const uint8_t *src, uint8_t *y, uint8_t *cb, uint8_t *cr,
+                                 int width, const rgb_to_yuv_coefs &k)
+{
+    const __m128i zero = _mm_setzero_si128();
+    sse2_coefs c = load_coefs_sse2(k);
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m128i b8, g8, r8;
+        deinterleave3_sse2(src + 3 * x, b8, g8, r8);
+        __m128i r[2] = {_mm_unpacklo_epi8(r8, zero), _mm_unpackhi_epi8(r8, zero)};
+        __m128i g[2] = {_mm_unpacklo_epi8(g8, zero), _mm_unpackhi_epi8(g8, zero)};
+        __m128i b[2] = {_mm_unpacklo_epi8(b8, zero), _mm_unpackhi_epi8(b8, zero)};
+        convert16_sse2(r, g, b, c, y + x, cb + x, cr + x);
+    }
+    rgb_row_scalar<3>(src + 3 * x, y + x, cb + x, cr + x, width - x, k);
+}
+
+// one channel of 8 pixels of 4 bytes, shifted down by shift, as 16-bit
+inline SSE2_TARGET __m128i channel8_sse2(__m128i p0, __m128i p1, int shift)
+{
+    const __m128i mask = _mm_set1_epi32(0xff);
+    return _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, shift), mask),
+                           _mm_and_si128(_mm_srli_epi32(p1, shift), mask));
+}
+
+SSE2_TARGET void bgrx8888_row_sse2(const uint8_t *src, uint8_t *y, uint8_t *cb, uint8_t *cr,
+                                   int width, const rgb_to_yuv_coefs &k)
+{
+    sse2_coefs c = load_coefs_sse2(k);
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m128i p[4];
+        for (int i = 0; i < 4; i++) {
+            p[i] = _mm_loadu_si128((const __m128i *)(src + 4 * x + 16 * i));
+        }
+        __m128i r[2] = {channel8_sse2(p[0], p[1], 16), channel8_sse2(p[2], p[3], 16)};
+        __m128i g[2] = {channel8_sse2(p[0], p[1], 8), channel8_sse2(p[2], p[3], 8)};
+        __m128i b[2] = {channel8_sse2(p[0], p[1], 0), channel8_sse2(p[2], p[3], 0)};
+        convert16_sse2(r, g, b, c, y + x, cb + x, cr + x);
+    }
+    rgb_row_scalar<4>(src + 4 * x, y + x, cb + x, cr + x, width - x, k);
+}
+
+// 16 pixels as 16-bit R, G, B (pixels 0-7 and 8-15)
+template <int bpp>
+inline SSE2_TARGET void load16_sse2(const uint8_t *src, __m128i *r, __m128i *g, __m128i *b)
+{
+    if constexpr (bpp == 3) {
+        const __m128i zero = _mm_setzero_si128();
+        __m128i b8, g8, r8;
+        deinterleave3_sse2(src, b8, g8, r8);
+        r[0] = _mm_unpacklo_epi8(r8, zero);
+        r[1] = _mm_unpackhi_epi8(r8, zero);
+        g[0] = _mm_unpacklo_epi8(g8, zero);
+        g[1] = _mm_unpackhi_epi8(g8, zero);
+        b[0] = _mm_unpacklo_epi8(b8, zero);
+        b[1] = _mm_unpackhi_epi8(b8, zero);
+    } else {
+        __m128i p[4];
+        for (int i = 0; i < 4; i++) {
+            p[i] = _mm_loadu_si128((const __m128i *)(src + 16 * i));
+        }
+        r[0] = channel8_sse2(p[0], p[1], 16);
+        r[1] = channel8_sse2(p[2], p[3], 16);
+        g[0] = channel8_sse2(p[0], p[1], 8);
+        g[1] = channel8_sse2(p[2], p[3], 8);
+        b[0] = channel8_sse2(p[0], p[1], 0);
+        b[1] = channel8_sse2(p[2], p[3], 0);
+    }
+}
+
+// Y of 16 pixels
+inline SSE2_TARGET void luma16_sse2(const __m128i *r, const __m128i *g, const __m128i *b,
+                                    const sse2_coefs &c, uint8_t *y)
+{
+    const __m128i mul = _mm_set1_epi16(BIAS_MUL);
+    __m128i v[2];
+    for (int i = 0; i < 2; i++) {
+        v[i] = component_sse2(_mm_unpacklo_epi16(r[i], g[i]), _mm_unpackhi_epi16(r[i], g[i]),
+                              _mm_unpacklo_epi16(b[i], mul), _mm_unpackhi_epi16(b[i], mul), c.rg[0], c.b1[0]);
+    }
+    _mm_storeu_si128((__m128i *)y, _mm_packus_epi16(v[0], v[1]));
+}
+
+// 16 pixels of two rows to the 8 sums of their 2 x 2 blocks
+inline SSE2_TARGET __m128i sum2x2_sse2(const __m128i *v0, const __m128i *v1)
+{
+    const __m128i ones = _mm_set1_epi16(1);
+    return _mm_packs_epi32(_mm_madd_epi16(_mm_add_epi16(v0[0], v1[0]), ones),
+                           _mm_madd_epi16(_mm_add_epi16(v0[1], v1[1]), ones));
+}
+
+// Cb, Cr of 8 sums of 4 pixels, as chroma_sum_scalar
+inline SSE2_TARGET void chroma8_sse2(__m128i r, __m128i g, __m128i b, const sse2_coefs &c,
+                                     __m128i &cb, __m128i &cr)
+{
+    const __m128i mul = _mm_set1_epi16(4 * BIAS_MUL);
+    __m128i rg_lo = _mm_unpacklo_epi16(r, g);
+    __m128i rg_hi = _mm_unpackhi_epi16(r, g);
+    __m128i b1_lo = _mm_unpacklo_epi16(b, mul);
+    __m128i b1_hi = _mm_unpackhi_epi16(b, mul);
+    cb = component_sse2(rg_lo, rg_hi, b1_lo, b1_hi, c.rg[1], c.b1[1], SCALE_BITS + 2);
+    cr = component_sse2(rg_lo, rg_hi, b1_lo, b1_hi, c.rg[2], c.b1[2], SCALE_BITS + 2);
+}
+
+template <int bpp>
+SSE2_TARGET void rgb_row2_sse2(const uint8_t *src0, const uint8_t *src1, uint8_t *y0, uint8_t *y1,
+                               uint8_t *cb, uint8_t *cr, int width, const rgb_to_yuv_coefs &k)
+{
+    sse2_coefs c = load_coefs_sse2(k);
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m128i r0[2], g0[2], b0[2], r1[2], g1[2], b1[2];
+        load16_sse2<bpp>(src0 + bpp * x, r0, g0, b0);
+        load16_sse2<bpp>(src1 + bpp * x, r1, g1, b1);
+        luma16_sse2(r0, g0, b0, c, y0 + x);
+        if (y1) {
+            luma16_sse2(r1, g1, b1, c, y1 + x);
+        }
+        __m128i cb16, cr16;
+        chroma8_sse2(sum2x2_sse2(r0, r1), sum2x2_sse2(g0, g1), sum2x2_sse2(b0, b1), c, cb16, cr16);
+        __m128i cb8 = _mm_packus_epi16(cb16, cb16);
+        __m128i cr8 = _mm_packus_epi16(cr16, cr16);
+        if (cr) {
+            _mm_storel_epi64((__m128i *)(cb + x / 2), cb8);
+            _mm_storel_epi64((__m128i *)(cr + x / 2), cr8);
+        } else {
+            _mm_storeu_si128((__m128i *)(cb + x), _mm_unpacklo_epi8(cb8, cr8));
+        }
+    }
+    rgb_row2_scalar<bpp>(src0 + bpp * x, src1 + bpp * x, y0 + x, y1 ? y1 + x : nullptr,
+                         cr ? cb + x / 2 : cb + x, cr ? cr + x / 2 : nullptr, width - x, k);
+}
+
+inline AVX2_TARGET __m256i pair_const_avx2(int c0, int c1)
+{
+    return _mm256_set1_epi32((int)(((uint32_t)(uint16_t)c1 << 16) | (uint16_t)c0));
+}
+
+struct avx2_coefs {
+    __m256i rg[3];
+    __m256i b1[3];
+};
+
+inline AVX2_TARGET avx2_coefs load_coefs_avx2(const rgb_to_yuv_coefs &k)
+{
+    avx2_coefs c;
+    const int16_t *rows[3] = {k.y, k.cb, k.cr};
+    for (int i = 0; i < 3; i++) {
+        c.rg[i] = pair_const_avx2(rows[i][0], rows[i][1]);
+        c.b1[i] = pair_const_avx2(rows[i][2], i == 0 ? k.y_bias : k.c_bias);
+    }
+    return c;
+}
+
+// 16 pixels of 16-bit R, G, B (in order) to 16-bit Y, Cb, Cr (in order).
+// unpacklo / unpackhi split each 128-bit lane, packs puts the pixels back in order
+inline AVX2_TARGET void convert16_avx2(__m256i r, __m256i g, __m256i b, const avx2_coefs &c, __m256i *out)
+{
+    const __m256i mul = _mm256_set1_epi16(BIAS_MUL);
+    __m256i rg_lo = _mm256_unpacklo_epi16(r, g);
+    __m256i rg_hi = _mm256_unpackhi_epi16(r, g);
+    __m256i b1_lo = _mm256_unpacklo_epi16(b, mul);
+    __m256i b1_hi = _mm256_unpackhi_epi16(b, mul);
+    for (int i = 0; i < 3; i++) {
+        __m256i lo = _mm256_add_epi32(_mm256_madd_epi16(rg_lo, c.rg[i]), _mm256_madd_epi16(b1_lo, c.b1[i]));
+        __m256i hi = _mm256_add_epi32(_mm256_madd_epi16(rg_hi, c.rg[i]), _mm256_madd_epi16(b1_hi, c.b1[i]));
+        out[i] = _mm256_packs_epi32(_mm256_srai_epi32(lo, SCALE_BITS), _mm256_srai_epi32(hi, SCALE_BITS));
+    }
+}
+
+// pixels 0-15 and 16-31 of 16-bit values to 32 bytes in order, packus clamps
+inline AVX2_TARGET void store32_avx2(uint8_t *dst, __m256i v0, __m256i v1)
+{
+    _mm256_storeu_si256((__m256i *)dst, _mm256_permute4x64_epi64(_mm256_packus_epi16(v0, v1), 0xd8));
+}
+
+AVX2_TARGET void bgr888_row_avx2(const uint8_t *src, uint8_t *y, uint8_t *cb, uint8_t *cr,
+                                 int width, const rgb_to_yuv_coefs &k)
+{
+    avx2_coefs c = load_coefs_avx2(k);
+    int x = 0;
+    for (; x + 32 <= width; x += 32) {
+        __m256i out[2][3];
+        for (int half = 0; half < 2; half++) {
+            __m128i b8, g8, r8;
+            deinterleave3_sse2(src + 3 * (x + 16 * half), b8, g8, r8);
+            convert16_avx2(_mm256_cvtepu8_epi16(r8), _mm256_cvtepu8_epi16(g8), _mm256_cvtepu8_epi16(b8),
+                           c, out[half]);
+        }
+        store32_avx2(y + x, out[0][0], out[1][0]);
+        store32_avx2(cb + x, out[0][1], out[1][1]);
+        store32_avx2(cr + x, out[0][2], out[1][2]);
+    }
+    bgr888_row_sse2(src + 3 * x, y + x, cb + x, cr + x, width - x, k);
+}
+
+// one channel of 16 pixels of 4 bytes as 16-bit, in order
+inline AVX2_TARGET __m256i channel16_avx2(__m256i p0, __m256i p1, int shift)
+{
+    const __m256i mask = _mm256_set1_epi32(0xff);
+    __m256i packed = _mm256_packs_epi32(_mm256_and_si256(_mm256_srli_epi32(p0, shift), mask),
+                                        _mm256_and_si256(_mm256_srli_epi32(p1, shift), mask));
+    // 0-3, 8-11 | 4-7, 12-15
+    return _mm256_permute4x64_epi64(packed, 0xd8);
+}
+
+AVX2_TARGET void bgrx8888_row_avx2(const uint8_t *src, uint8_t *y, uint8_t *cb, uint8_t *cr,
+                                   int width, const rgb_to_yuv_coefs &k)
+{
+    avx2_coefs c = load_coefs_avx2(k);
+    int x = 0;
+    for (; x + 32 <= width; x += 32) {
+        __m256i out[2][3];
+        for (int half = 0; half < 2; half++) {
+            const uint8_t *p = src + 4 * (x + 16 * half);
+            __m256i p0 = _mm256_loadu_si256((const __m256i *)p);
+            __m256i p1 = _mm256_loadu_si256((const __m256i *)(p + 32));
+            convert16_avx2(channel16_avx2(p0, p1, 16), channel16_avx2(p0, p1, 8), channel16_avx2(p0, p1, 0),
+                           c, out[half]);
+        }
+        store32_avx2(y + x, out[0][0], out[1][0]);
+        store32_avx2(cb + x, out[0][1], out[1][1]);
+        store32_avx2(cr + x, out[0][2], out[1][2]);
+    }
+    bgrx8888_row_sse2(src + 4 * x, y + x, cb + x, cr + x, width - x, k);
+}
+
+// 16 pixels as 16-bit R, G, B, in order
+template <int bpp>
+inline AVX2_TARGET void load16_avx2(const uint8_t *src, __m256i &r, __m256i &g, __m256i &b)
+{
+    if constexpr (bpp == 3) {
+        __m128i b8, g8, r8;
+        deinterleave3_sse2(src, b8, g8, r8);
+        r = _mm256_cvtepu8_epi16(r8);
+        g = _mm256_cvtepu8_epi16(g8);
+        b = _mm256_cvtepu8_epi16(b8);
+    } else {
+        __m256i p0 = _mm256_loadu_si256((const __m256i *)src);
+        __m256i p1 = _mm256_loadu_si256((const __m256i *)(src + 32));
+        r = channel16_avx2(p0, p1, 16);
+        g = channel16_avx2(p0, p1, 8);
+        b = channel16_avx2(p0, p1, 0);
+    }
+}
+
+// one component of 16 pixels (in order), mul: the bias lane
+inline AVX2_TARGET __m256i component_avx2(__m256i r, __m256i g, __m256i b, __m256i k_rg, __m256i k_b1,
+                                          __m256i mul, int shift)
+{
+    __m256i lo = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(r, g), k_rg),
+                                  _mm256_madd_epi16(_mm256_unpacklo_epi16(b, mul), k_b1));
+    __m256i hi = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(r, g), k_rg),
+                                  _mm256_madd_epi16(_mm256_unpackhi_epi16(b, mul), k_b1));
+    return _mm256_packs_epi32(_mm256_srai_epi32(lo, shift), _mm256_srai_epi32(hi, shift));
+}
+
+// 32 pixels of two rows (two halves of 16) to the 16 sums of their 2 x 2 blocks, in order
+inline AVX2_TARGET __m256i sum2x2_avx2(const __m256i *v0, const __m256i *v1)
+{
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i s0 = _mm256_madd_epi16(_mm256_add_epi16(v0[0], v1[0]), ones);
+    __m256i s1 = _mm256_madd_epi16(_mm256_add_epi16(v0[1], v1[1]), ones);
+    return _mm256_permute4x64_epi64(_mm256_packs_epi32(s0, s1), 0xd8);
+}
+
+// 16 16-bit values to 16 bytes in order, packus clamps
+inline AVX2_TARGET __m128i pack16_avx2(__m256i v)
+{
+    return _mm_packus_epi16(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+}
+
+template <int bpp>
+AVX2_TARGET void rgb_row2_avx2(const uint8_t *src0, const uint8_t *src1, uint8_t *y0, uint8_t *y1,
+                               uint8_t *cb, uint8_t *cr, int width, const rgb_to_yuv_coefs &k)
+{
+    const __m256i y_mul = _mm256_set1_epi16(BIAS_MUL);
+    const __m256i c_mul = _mm256_set1_epi16(4 * BIAS_MUL);
+    avx2_coefs c = load_coefs_avx2(k);
+    int x = 0;
+    for (; x + 32 <= width; x += 32) {
+        __m256i r0[2], g0[2], b0[2], r1[2], g1[2], b1[2];
+        for (int half = 0; half < 2; half++) {
+            load16_avx2<bpp>(src0 + bpp * (x + 16 * half), r0[half], g0[half], b0[half]);
+            load16_avx2<bpp>(src1 + bpp * (x + 16 * half), r1[half], g1[half], b1[half]);
+        }
+        store32_avx2(y0 + x, component_avx2(r0[0], g0[0], b0[0], c.rg[0], c.b1[0], y_mul, SCALE_BITS),
+                     component_avx2(r0[1], g0[1], b0[1], c.rg[0], c.b1[0], y_mul, SCALE_BITS));
+        if (y1) {
+            store32_avx2(y1 + x, component_avx2(r1[0], g1[0], b1[0], c.rg[0], c.b1[0], y_mul, SCALE_BITS),
+                         component_avx2(r1[1], g1[1], b1[1], c.rg[0], c.b1[0], y_mul, SCALE_BITS));
+        }
+        __m256i r = sum2x2_avx2(r0, r1);
+        __m256i g = sum2x2_avx2(g0, g1);
+        __m256i b = sum2x2_avx2(b0, b1);
+        __m128i cb8 = pack16_avx2(component_avx2(r, g, b, c.rg[1], c.b1[1], c_mul, SCALE_BITS + 2));
+        __m128i cr8 = pack16_avx2(component_avx2(r, g, b, c.rg[2], c.b1[2], c_mul, SCALE_BITS + 2));
+        if (cr) {
+            _mm_storeu_si128((__m128i *)(cb + x / 2), cb8);
+            _mm_storeu_si128((__m128i *)(cr + x / 2), cr8);
+        } else {
+            _mm_storeu_si128((__m128i *)(cb + x), _mm_unpacklo_epi8(cb8, cr8));
+            _mm_storeu_si128((__m128i *)(cb + x + 16), _mm_unpackhi_epi8(cb8, cr8));
+        }
+    }
+    rgb_row2_sse2<bpp>(src0 + bpp * x, src1 + bpp * x, y0 + x, y1 ? y1 + x : nullptr,
+                       cr ? cb + x / 2 : cb + x, cr ? cr + x / 2 : nullptr, width - x, k);
+}
+
+#endif // RGB_X86_SIMD
+
+} // namespace
+
+const char *to_string(yuv_matrix matrix)
+{
+    switch (matrix) {
+    case yuv_matrix::bt601: return "bt601";
+    case yuv_matrix::bt709: return "bt709";
+    default: return "unknown";
+    }
+}
+
+const char *to_string(yuv_range range)
+{
+    switch (range) {
+    case yuv_range::full: return "full";
+    case yuv_range::limited: return "limited";
+    default: return "unknown";
+    }
+}
+
+const char *to_string(rgb_format format)
+{
+    switch (format) {
+    case rgb_format::bgr888: return "bgr888";
+    case rgb_format::bgrx8888: return "bgrx8888";
+    default: return "unknown";
+    }
+}
+
+const char *to_string(yuv_format format)
+{
+    switch (format) {
+    case yuv_format::yuv444p: return "yuv444p";
+    case yuv_format::i420: return "i420";
+    case yuv_format::nv12: return "nv12";
+    case yuv_format::yuv422p: return "yuv422p";
+    case yuv_format::nv16: return "nv16";
+    case yuv_format::yuyv: return "yuyv";
+    default: return "unknown";
+    }
+}
+
+rgb_to_yuv_coefs make_rgb_to_yuv_coefs(yuv_matrix matrix, yuv_range range)
+{
+    double kr = matrix == yuv_matrix::bt709 ? 0.2126 : 0.299;
+    double kb = matrix == yuv_matrix::bt709 ? 0.0722 : 0.114;
+    bool limited = range == yuv_range::limited;
+    double y_scale = limited ? 219.0 / 255.0 : 1.0;
+    double c_scale = limited ? 224.0 / 255.0 : 1.0;
+    const double one = (double)(1 << SCALE_BITS);
+    auto fix = [&](double v) { return (int)std::lround(v * one); };
+
+    rgb_to_yuv_coefs k;
+    // R, B rounded, G takes the rest: the rows sum to exactly 1 (Y) and 0 (Cb, Cr)
+    int y_sum = fix(y_scale);
+    k.y[0] = (int16_t)fix(kr * y_scale);
+    k.y[2] = (int16_t)fix(kb * y_scale);
+    k.y[1] = (int16_t)(y_sum - k.y[0] - k.y[2]);
+
+    k.cb[2] = (int16_t)fix(0.5 * c_scale);
+    k.cb[0] = (int16_t)fix(-kr / (2.0 - 2.0 * kb) * c_scale);
+    k.cb[1] = (int16_t)(-k.cb[0] - k.cb[2]);
+
+    k.cr[0] = (int16_t)fix(0.5 * c_scale);
+    k.cr[2] = (int16_t)fix(-kb / (2.0 - 2.0 * kr) * c_scale);
+    k.cr[1] = (int16_t)(-k.cr[0] - k.cr[2]);
+
+    int round = 1 << (SCALE_BITS - 1);
+    k.y_bias = (int16_t)((((limited ? 16 : 0) << SCALE_BITS) + round) / BIAS_MUL);
+    k.c_bias = (int16_t)(((128 << SCALE_BITS) + round) / BIAS_MUL);
+    return k;
+}
+
+rgb_row_kernel get_rgb_row_kernel(simd_level level, rgb_format format)
+{
+    if ((int)level > (int)detect_simd_level()) {
+        level = detect_simd_level();
+    }
+    bool bgr = format == rgb_format::bgr888;
+#ifdef RGB_X86_SIMD
+    if (level == simd_level::avx2) {
+        return bgr ? bgr888_row_avx2 : bgrx8888_row_avx2;
+    }
+    if (level == simd_level::sse2) {
+        return bgr ? bgr888_row_sse2 : bgrx8888_row_sse2;
+    }
+#endif
+    return bgr ? rgb_row_scalar<3> : rgb_row_scalar<4>;
+}
+
+rgb_row2_kernel get_rgb_row2_kernel(simd_level level, rgb_format format)
+{
+    if ((int)level > (int)detect_simd_level()) {
+        level = detect_simd_level();
+    }
+    bool bgr = format == rgb_format::bgr888;
+#ifdef RGB_X86_SIMD
+    if (level == simd_level::avx2) {
+        return bgr ? rgb_row2_avx2<3> : rgb_row2_avx2<4>;
+    }
+    if (level == simd_level::sse2) {
+        return bgr ? rgb_row2_sse2<3> : rgb_row2_sse2<4>;
+    }
+#endif
+    return bgr ? rgb_row2_scalar<3> : rgb_row2_scalar<4>;
+}
+
+yuv_output make_yuv_output(uint8_t *data, int width, int height, yuv_format format)
+{
+    int cw = (width + 1) / 2;
+    int ch = (height + 1) / 2;
+    size_t luma = (size_t)width * height;
+    yuv_output out;
+    out.planes[0] = data;
+    out.strides[0] = width;
+    switch (format) {
+    case yuv_format::yuv444p:
+        out.planes[1] = data + luma;
+        out.planes[2] = data + luma * 2;
+        out.strides[1] = out.strides[2] = width;
+        break;
+    case yuv_format::i420:
+        out.planes[1] = data + luma;
+        out.planes[2] = data + luma + (size_t)cw * ch;
+        out.strides[1] = out.strides[2] = cw;
+        break;
+    case yuv_format::yuv422p:
+        out.planes[1] = data + luma;
+        out.planes[2] = data + luma + (size_t)cw * height;
+        out.strides[1] = out.strides[2] = cw;
+        break;
+    case yuv_format::nv12:
+    case yuv_format::nv16:
+        out.planes[1] = data + luma;
+        out.strides[1] = cw * 2;
+        break;
+    case yuv_format::yuyv:
+        out.strides[0] = cw * 4;
+        break;
+    }
+    return out;
+}
+
+size_t yuv_output_size(int width, int height, yuv_format format)
+{
+    size_t cw = (width + 1) / 2;
+    size_t ch = (height + 1) / 2;
+    size_t luma = (size_t)width * height;
+    switch (format) {
+    case yuv_format::yuv444p: return luma * 3;
+    case yuv_format::i420:
+    case yuv_format::nv12: return luma + cw * ch * 2;
+    case yuv_format::yuv422p:
+    case yuv_format::nv16: return luma + cw * height * 2;
+    case yuv_format::yuyv: return cw * 4 * height;
+    }
+    return 0;
+}
+
+int yuv_plane_count(yuv_format format)
+{
+    switch (format) {
+    case yuv_format::nv12:
+    case yuv_format::nv16: return 2;
+    case yuv_format::yuyv: return 1;
+    default: return 3;
+    }
+}
+
+int yuv_plane_rows(yuv_format format, int plane, int rows)
+{
+    bool half = plane > 0 && (format == yuv_format::i420 || format == yuv_format::nv12);
+    return half ? (rows + 1) / 2 : rows;
+}
+
+void rgb_converter::convert_rows(const uint8_t *src, ptrdiff_t src_pitch, int width, int rows, const yuv_output &out,
+                                 zzwlib::thread_pool &pool, int threads) const
+{
+    // source row, Y and at most 2 bytes of chroma per pixel
+    int tile = zzwlib::tile_rows((size_t)width * (bytes_per_pixel(m_format) + 3), 2);
+    int planes = yuv_plane_count(m_output);
+    pool.parallel_for(0, rows, tile, [&](int first, int end) {
+        yuv_output tile_out;
+        for (int p = 0; p < planes; p++) {
+            tile_out.planes[p] = out.planes[p] + (size_t)yuv_plane_rows(m_output, p, first) * out.strides[p];
+            tile_out.strides[p] = out.strides[p];
+        }
+        std::vector<uint8_t> line;
+        convert_tile(src + first * src_pitch, src_pitch, width, end - first, tile_out, line);
+    }, threads);
+}
+
+void rgb_converter::convert_tile(const uint8_t *src, ptrdiff_t src_pitch, int width, int rows, const yuv_output &out,
+                                 std::vector<uint8_t> &line) const
+{
+    uint8_t *const *planes = out.planes;
+    const int *strides = out.strides;
+    switch (m_output) {
+    case yuv_format::yuv444p:
+        for (int row = 0; row < rows; row++) {
+            m_kernel(src + row * src_pitch,
+                     planes[0] + (size_t)row * strides[0],
+                     planes[1] + (size_t)row * strides[1],
+                     planes[2] + (size_t)row * strides[2], width, m_coefs);
+        }
+        break;
+    case yuv_format::i420:
+    case yuv_format::nv12:
+        // an odd last row is its own pair
+        for (int row = 0; row < rows; row += 2) {
+            bool pair = row + 1 < rows;
+            const uint8_t *src0 = src + row * src_pitch;
+            size_t c_row = (size_t)(row / 2);
+            m_row2_kernel(src0, pair ? src0 + src_pitch : src0,
+                          planes[0] + (size_t)row * strides[0],
+                          pair ? planes[0] + (size_t)(row + 1) * strides[0] : nullptr,
+                          planes[1] + c_row * strides[1],
+                          m_output == yuv_format::i420 ? planes[2] + c_row * strides[2] : nullptr,
+                          width, m_coefs);
+        }
+        break;
+    case yuv_format::yuv422p:
+    case yuv_format::nv16:
+        for (int row = 0; row < rows; row++) {
+            const uint8_t *src0 = src + row * src_pitch;
+            m_row2_kernel(src0, src0, planes[0] + (size_t)row * strides[0], nullptr,
+                          planes[1] + (size_t)row * strides[1],
+                          m_output == yuv_format::yuv422p ? planes[2] + (size_t)row * strides[2] : nullptr,
+                          width, m_coefs);
+        }
+        break;
+    case yuv_format::yuyv: {
+        int cw = (width + 1) / 2;
+        line.resize((size_t)width + cw * 2);
+        uint8_t *y = line.data();
+        uint8_t *cb = y + width;
+        uint8_t *cr = cb + cw;
+        for (int row = 0; row < rows; row++) {
+            const uint8_t *src0 = src + row * src_pitch;
+            m_row2_kernel(src0, src0, y, nullptr, cb, cr, width, m_coefs);
+            uint8_t *dst = planes[0] + (size_t)row * strides[0];
+            // an odd last pixel repeats its Y
+            for (int i = 0; i < cw; i++) {
+                dst[4 * i] = y[2 * i];
+                dst[4 * i + 1] = cb[i];
+                dst[4 * i + 2] = y[2 * i + 1 < width ? 2 * i + 1 : 2 * i];
+                dst[4 * i + 3] = cr[i];
+            }
+        }
+        break;
+    }
+    }
+}
+
+    } // namespace jpeg
+} // namespace zzwlib
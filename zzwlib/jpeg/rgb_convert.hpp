@@ -0,0 +1,162 @@
+
+//
+// RGB -> YCbCr conversion, the encoder side counterpart of color_convert.
+//
+// 14-bit fixed point matrices for BT.601 and BT.709, full range (JFIF, 0 - 255)
+// or limited range (Y 16 - 235, Cb / Cr 16 - 240):
+//   Y  = y_off +  Kr R + Kg G + Kb B
+//   Cb = 128   + (B - Y) / (2 - 2 Kb)
+//   Cr = 128   + (R - Y) / (2 - 2 Kr)
+// (scaled by 219 / 255 and 224 / 255 for limited range). the coefficients of Y
+// are rounded to sum to exactly 1 (219 / 255) and those of Cb / Cr to 0, so gray
+// stays gray: R = G = B gives Cb = Cr = 128.
+//
+// per pixel and component it is two pmaddwd of (R, G) and (B, 256) pairs, the
+// offset and rounding ride in the 256 lane; SSE2 kernels do 16 pixels per
+// iteration, AVX2 32. packed 24 bit pixels are split into planes with byte
+// unpacks (SSE2 has no pshufb). the SIMD kernels give the same results as the
+// scalar one, which is the reference.
+//
+// subsampled outputs (4:2:0, 4:2:2) are made in the same pass: the kernel takes
+// two source rows, writes their Y and sums the RGB of every 2x2 (2x1) pixels,
+// whose chroma is then the matrix applied to the sum (the matrix is linear, the
+// average of the chroma is the chroma of the average RGB). no full resolution
+// Cb / Cr is ever written; NV12 / NV16 chroma is stored interleaved by the
+// kernel, YUYV is packed from a line buffer.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#include "idct.hpp"
+#include "../thread_pool.hpp"
+
+namespace zzwlib{
+    namespace jpeg {
+
+enum class yuv_matrix : int {
+    bt601 = 0,      // SD, JFIF
+    bt709,          // HD
+};
+
+enum class yuv_range : int {
+    full = 0,       // 0 - 255
+    limited,        // Y 16 - 235, Cb / Cr 16 - 240
+};
+
+// source pixels, byte order in memory
+enum class rgb_format : int {
+    bgr888 = 0,     // B G R, 24 bit BMP
+    bgrx8888,       // B G R X, 32 bit BMP, X is ignored
+};
+
+// output layouts
+enum class yuv_format : int {
+    yuv444p = 0,    // Y, Cb, Cr planes at full size
+    i420,           // Y, Cb, Cr planes, chroma at half width and half height (rounded up)
+    nv12,           // Y plane, then one plane of Cb Cr pairs at half width and half height
+    yuv422p,        // Y, Cb, Cr planes, chroma at half width
+    nv16,           // Y plane, then one plane of Cb Cr pairs at half width
+    yuyv,           // packed Y0 Cb Y1 Cr, 4:2:2 (YUY2)
+};
+
+const char *to_string(yuv_matrix matrix);
+const char *to_string(yuv_range range);
+const char *to_string(rgb_format format);
+const char *to_string(yuv_format format);
+
+// bytes per source pixel
+inline int bytes_per_pixel(rgb_format format) { return format == rgb_format::bgr888 ? 3 : 4; }
+
+// 14-bit fixed point matrix, coefficients in R, G, B order.
+// bias: (offset << 14 + rounding) / 256, the kernels multiply it by 256.
+struct rgb_to_yuv_coefs {
+    int16_t y[3];
+    int16_t cb[3];
+    int16_t cr[3];
+    int16_t y_bias;
+    int16_t c_bias;
+};
+
+rgb_to_yuv_coefs make_rgb_to_yuv_coefs(yuv_matrix matrix, yuv_range range);
+
+// width pixels of src to full resolution y, cb, cr
+typedef void (*rgb_row_kernel)(const uint8_t *src, uint8_t *y, uint8_t *cb, uint8_t *cr,
+                               int width, const rgb_to_yuv_coefs &k);
+
+rgb_row_kernel get_rgb_row_kernel(simd_level level, rgb_format format);
+
+// horizontally subsampled chroma: Y of src0 -> y0 and src1 -> y1 (y1 nullptr:
+// src1 only adds to the chroma), one Cb, Cr per 2 x 2 pixels of src0 + src1;
+// src1 = src0 for 4:2:2. cr nullptr: Cb Cr pairs interleaved into cb (NV12).
+typedef void (*rgb_row2_kernel)(const uint8_t *src0, const uint8_t *src1, uint8_t *y0, uint8_t *y1,
+                                uint8_t *cb, uint8_t *cr, int width, const rgb_to_yuv_coefs &k);
+
+rgb_row2_kernel get_rgb_row2_kernel(simd_level level, rgb_format format);
+
+// where the planes of an output go; semi-planar formats use planes[0 - 1],
+// yuyv only planes[0]. strides are in bytes.
+struct yuv_output {
+    uint8_t *planes[3] = {nullptr, nullptr, nullptr};
+    int strides[3] = {0, 0, 0};
+};
+
+// tightly packed output in one buffer (e.g. a .yuv file), planes back to back
+yuv_output make_yuv_output(uint8_t *data, int width, int height, yuv_format format);
+
+// bytes of a tightly packed output
+size_t yuv_output_size(int width, int height, yuv_format format);
+
+// # of planes of an output: 3 planar, 2 semi-planar, 1 packed
+int yuv_plane_count(yuv_format format);
+
+// rows of a plane for rows luma rows (4:2:0 chroma: half, rounded up)
+int yuv_plane_rows(yuv_format format, int plane, int rows);
+
+class rgb_converter final {
+public:
+    explicit rgb_converter(yuv_matrix matrix = yuv_matrix::bt601,
+                           yuv_range range = yuv_range::full,
+                           rgb_format format = rgb_format::bgr888,
+                           yuv_format output = yuv_format::yuv444p,
+                           simd_level level = detect_simd_level()) :
+        m_coefs(make_rgb_to_yuv_coefs(matrix, range)),
+        m_format(format),
+        m_output(output),
+        m_kernel(get_rgb_row_kernel(level, format)),
+        m_row2_kernel(get_rgb_row2_kernel(level, format)) {}
+
+    rgb_format format() const { return m_format; }
+    yuv_format output() const { return m_output; }
+
+    // convert rows x width pixels, src row 0 goes to output row 0 (and chroma row 0).
+    // src: first row, src_pitch: bytes from one row to the next (negative for
+    // bottom-up images, src is then the last row in memory).
+    // for i420 / nv12 rows are taken in pairs: converting a frame in bands,
+    // every band but the last has to have an even # of rows.
+    void convert_rows(const uint8_t *src, ptrdiff_t src_pitch, int width, int rows, const yuv_output &out) {
+        convert_tile(src, src_pitch, width, rows, out, m_line);
+    }
+
+    // the same in tiles of rows on pool, on up to threads threads (0: all of them).
+    // tiles are sized to L2 and have an even # of rows.
+    void convert_rows(const uint8_t *src, ptrdiff_t src_pitch, int width, int rows, const yuv_output &out,
+                      zzwlib::thread_pool &pool, int threads = 0) const;
+
+private:
+    void convert_tile(const uint8_t *src, ptrdiff_t src_pitch, int width, int rows, const yuv_output &out,
+                      std::vector<uint8_t> &line) const;
+
+    rgb_to_yuv_coefs m_coefs;
+    rgb_format m_format;
+    yuv_format m_output;
+    rgb_row_kernel m_kernel;
+    rgb_row2_kernel m_row2_kernel;
+    std::vector<uint8_t> m_line;     // yuyv: Y, Cb, Cr of a row before packing
+};
+
+    } // namespace jpeg
+} // namespace zzwlib
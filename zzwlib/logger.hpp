@@ -43,6 +43,8 @@ public:
 
     loglevel get_loglevel() {return loglevel_;}
 
+    void set_loglevel(loglevel level) {loglevel_ = level;}
+
     const char * get_tag() {return tag_.c_str();}
 
     static int write_log(FILE* fp, const char *fmt_str, ...) {
@@ -0,0 +1,90 @@
+
+//
+// cpu cycles and retired instructions of the calling thread (and of the threads
+// it starts while counting), from the linux perf_event_open syscall.
+//
+// user space only, so it works with the default perf_event_paranoid of 2.
+// where perf events are not available (containers, seccomp, no PMU in the vm)
+// available() is false and the counts stay 0: callers print n/a instead.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+namespace zzwlib {
+
+class perf_counters final {
+public:
+    enum counter : int {
+        cycles = 0,
+        instructions,
+        count,
+    };
+
+    perf_counters() {
+        static const uint64_t configs[count] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS};
+        for (int i = 0; i < count; i++) {
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = configs[i];
+            attr.disabled = 1;
+            attr.inherit = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            m_fd[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        }
+    }
+
+    ~perf_counters() {
+        for (int i = 0; i < count; i++) {
+            if (m_fd[i] >= 0) {
+                close(m_fd[i]);
+            }
+        }
+    }
+
+    perf_counters(const perf_counters&) = delete;
+    perf_counters& operator=(const perf_counters&) = delete;
+
+    bool available() const { return m_fd[cycles] >= 0 && m_fd[instructions] >= 0; }
+
+    // zero the counters and count from here
+    void start() {
+        for (int i = 0; i < count; i++) {
+            if (m_fd[i] >= 0) {
+                ioctl(m_fd[i], PERF_EVENT_IOC_RESET, 0);
+                ioctl(m_fd[i], PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+    }
+
+    void stop() {
+        for (int i = 0; i < count; i++) {
+            m_value[i] = 0;
+            if (m_fd[i] >= 0) {
+                ioctl(m_fd[i], PERF_EVENT_IOC_DISABLE, 0);
+                uint64_t value = 0;
+                if (read(m_fd[i], &value, sizeof(value)) == (ssize_t)sizeof(value)) {
+                    m_value[i] = value;
+                }
+            }
+        }
+    }
+
+    // counts between the last start() and stop()
+    uint64_t value(counter c) const { return m_value[c]; }
+
+private:
+    int m_fd[count];
+    uint64_t m_value[count] = {0, 0};
+};
+
+};
@@ -0,0 +1,221 @@
+
+//
+// poolbench: thread_pool against a std::thread per task.
+//
+//   spawn     many small independent tasks: a task_group, or a thread each
+//   for       parallel_for over a float array at several grains, or a thread per chunk
+//   fib       fork join recursion (fib with a sequential cutoff): nested task_groups,
+//             or a thread per fork down to a depth which keeps the thread count sane
+//   stripes   few big uneven tasks (as restart interval stripes), both ways
+// each case runs rounds times after a warm up; reported is the median.
+//
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <atomic>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+
+#include "thread_pool.hpp"
+#include "logger.hpp"
+
+zzwlib::logger  poolbench_logger("poolbench", zzwlib::loglevel::log_verbose_level);
+
+namespace {
+
+// median time of rounds runs of fn after one warm up, in ms
+double median_ms(int rounds, const std::function<void()> &fn)
+{
+    fn();
+    std::vector<double> times;
+    for (int r = 0; r < rounds; r++) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+    std::sort(times.begin(), times.end());
+    return times[times.size() / 2];
+}
+
+// some arithmetic the compiler can not drop, about 1 ns per iteration
+uint32_t busy(uint32_t seed, int iterations)
+{
+    for (int i = 0; i < iterations; i++) {
+        seed = seed * 1664525u + 1013904223u;
+    }
+    return seed;
+}
+
+std::atomic<uint32_t> g_sink{0};
+
+void report(const char *name, double pool_ms, double thread_ms)
+{
+    LOGI(poolbench_logger, "%-28s pool %9.3f ms   thread per task %9.3f ms   %6.1fx",
+         name, pool_ms, thread_ms, thread_ms / pool_ms);
+}
+
+void bench_spawn(zzwlib::thread_pool &pool, int rounds, int tasks, int work)
+{
+    double pool_ms = median_ms(rounds, [&]() {
+        zzwlib::task_group group(pool);
+        for (int i = 0; i < tasks; i++) {
+            group.run([i, work]() { g_sink += busy(i, work); });
+        }
+        group.wait();
+    });
+    double thread_ms = median_ms(rounds, [&]() {
+        std::vector<std::thread> threads;
+        for (int i = 0; i < tasks; i++) {
+            threads.emplace_back([i, work]() { g_sink += busy(i, work); });
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+    });
+    char name[64];
+    snprintf(name, sizeof(name), "spawn %d x %d", tasks, work);
+    report(name, pool_ms, thread_ms);
+}
+
+void bench_for(zzwlib::thread_pool &pool, int rounds, const std::vector<float> &data, int grain)
+{
+    int n = (int)data.size();
+    auto chunk = [&](int lo, int hi) {
+        double sum = 0;
+        for (int i = lo; i < hi; i++) {
+            sum += sqrtf(data[i]);
+        }
+        g_sink += (uint32_t)sum;
+    };
+    double pool_ms = median_ms(rounds, [&]() { pool.parallel_for(0, n, grain, chunk); });
+    double thread_ms = median_ms(rounds, [&]() {
+        std::vector<std::thread> threads;
+        for (int lo = 0; lo < n; lo += grain) {
+            threads.emplace_back(chunk, lo, std::min(lo + grain, n));
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+    });
+    char name[64];
+    snprintf(name, sizeof(name), "for %d, grain %d", n, grain);
+    report(name, pool_ms, thread_ms);
+}
+
+const int fib_cutoff = 16;
+
+long fib_seq(int n)
+{
+    return n < 2 ? n : fib_seq(n - 1) + fib_seq(n - 2);
+}
+
+long fib_pool(zzwlib::thread_pool &pool, int n)
+{
+    if (n < fib_cutoff) {
+        return fib_seq(n);
+    }
+    long a = 0;
+    zzwlib::task_group group(pool);
+    group.run([&]() { a = fib_pool(pool, n - 1); });
+    long b = fib_pool(pool, n - 2);
+    group.wait();
+    return a + b;
+}
+
+// a thread per fork down to depth, 2^depth threads at most
+long fib_threads(int n, int depth)
+{
+    if (n < fib_cutoff || depth == 0) {
+        return fib_seq(n);
+    }
+    long a = 0;
+    std::thread thread([&]() { a = fib_threads(n - 1, depth - 1); });
+    long b = fib_threads(n - 2, depth - 1);
+    thread.join();
+    return a + b;
+}
+
+void bench_fib(zzwlib::thread_pool &pool, int rounds, int n)
+{
+    double pool_ms = median_ms(rounds, [&]() { g_sink += (uint32_t)fib_pool(pool, n); });
+    double thread_ms = median_ms(rounds, [&]() { g_sink += (uint32_t)fib_threads(n, 10); });
+    char name[64];
+    snprintf(name, sizeof(name), "fib %d, cutoff %d", n, fib_cutoff);
+    report(name, pool_ms, thread_ms);
+}
+
+void bench_stripes(zzwlib::thread_pool &pool, int rounds, int stripes, int work)
+{
+    // stripe i costs (1 + i % 4) units: uneven, as stripes of a real image
+    auto stripe = [work](int i) { g_sink += busy(i, work * (1 + i % 4)); };
+    double pool_ms = median_ms(rounds, [&]() {
+        pool.parallel_for(0, stripes, 1, [&](int lo, int hi) {
+            for (int i = lo; i < hi; i++) {
+                stripe(i);
+            }
+        });
+    });
+    double thread_ms = median_ms(rounds, [&]() {
+        std::vector<std::thread> threads;
+        for (int i = 0; i < stripes; i++) {
+            threads.emplace_back(stripe, i);
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+    });
+    char name[64];
+    snprintf(name, sizeof(name), "stripes %d x %d", stripes, work);
+    report(name, pool_ms, thread_ms);
+}
+
+} // namespace
+
+/*
+ * ./poolbench.elf [-r rounds] [-t workers] [-p]
+ *  -t workers: worker threads of the pool, 0 (default): one per cpu besides the caller
+ *  -p: pin the workers to cpus
+ */
+int main(int argc, char *argv[])
+{
+    int rounds = 5;
+    int workers = 0;
+    bool pin = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            rounds = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            workers = std::max(0, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "-p") == 0) {
+            pin = true;
+        } else {
+            LOGE(poolbench_logger, "usage: %s [-r rounds] [-t workers] [-p]", argv[0]);
+            return -1;
+        }
+    }
+
+    zzwlib::thread_pool pool(workers, pin);
+    LOGI(poolbench_logger, "%d workers + the caller%s, %d rounds, median times",
+         pool.workers(), pool.pinned() ? ", pinned" : "", rounds);
+
+    bench_spawn(pool, rounds, 1000, 100);
+    bench_spawn(pool, rounds, 1000, 10000);
+
+    std::vector<float> data(1 << 24);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = (float)(i & 1023);
+    }
+    for (int grain : {1 << 12, 1 << 16, 1 << 20}) {
+        bench_for(pool, rounds, data, grain);
+    }
+
+    bench_fib(pool, rounds, 30);
+    bench_stripes(pool, rounds, 64, 200000);
+    return 0;
+}
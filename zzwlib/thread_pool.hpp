@@ -0,0 +1,461 @@
+
+//
+// work stealing task scheduler.
+//
+// every worker owns a Chase-Lev deque of tasks: it pushes and pops its own
+// tasks at the bottom (the most recent one, still in cache) without a lock,
+// and when it runs dry it steals from the top of the others (the oldest ones,
+// the biggest pieces of work) with a single CAS. tasks from threads outside
+// the pool go to an injection queue which the workers drain when they find
+// nothing else. idle workers spin a little, then sleep until a task comes.
+//
+// task_group runs tasks and waits for them; the waiting thread runs tasks of
+// the pool meanwhile, so groups nest (a task may wait for a group of its own)
+// and a pool without workers still makes progress. cancel() skips the tasks of
+// a group which have not started yet.
+//
+// parallel_for splits a range into chunks of grain and runs them on a group:
+// helpers take the next chunk in turn, the calling thread takes chunks too.
+//
+// shared() is one pool per process for the libraries (image codecs, colour
+// converters), so they do not each start threads and oversubscribe the cores.
+//
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace zzwlib {
+
+// bytes of the L2 cache of a core, 1 MB if the system does not tell
+inline size_t l2_cache_size() {
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    long size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (size > 0) {
+        return (size_t)size;
+    }
+#endif
+    return 1024 * 1024;
+}
+
+// rows of a tile whose working set (bytes_per_row per row, in and out) fits in
+// half of L2, a multiple of align (e.g. 2 for 4:2:0 chroma), at least align
+inline int tile_rows(size_t bytes_per_row, int align) {
+    size_t rows = l2_cache_size() / 2 / std::max<size_t>(bytes_per_row, 1);
+    rows -= rows % align;
+    return (int)std::max<size_t>(rows, align);
+}
+
+// Chase-Lev work stealing deque of pointers (Chase, Lev 2005, with the memory
+// orders of Le et al. 2013; seq_cst accesses stand in for its fences).
+// one owner thread pushes and pops at the bottom, any thread steals at the top.
+// the ring doubles when it is full; the old rings are kept as long as the deque
+// lives since a thief may still read one.
+template <typename T>
+class ws_deque final {
+public:
+    explicit ws_deque(int log_size = 8) {
+        m_rings.push_back(std::make_unique<ring>(log_size));
+        m_ring.store(m_rings.back().get(), std::memory_order_relaxed);
+    }
+
+    ws_deque(const ws_deque&) = delete;
+    ws_deque& operator=(const ws_deque&) = delete;
+
+    // owner only
+    void push(T *item) {
+        int64_t b = m_bottom.load(std::memory_order_relaxed);
+        int64_t t = m_top.load(std::memory_order_acquire);
+        ring *r = m_ring.load(std::memory_order_relaxed);
+        if (b - t > r->mask) {
+            r = grow(r, t, b);
+        }
+        r->put(b, item);
+        m_bottom.store(b + 1, std::memory_order_release);
+    }
+
+    // owner only. return: the newest item, nullptr if empty
+    T *pop() {
+        int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+        ring *r = m_ring.load(std::memory_order_relaxed);
+        m_bottom.store(b, std::memory_order_seq_cst);
+        int64_t t = m_top.load(std::memory_order_seq_cst);
+        if (t > b) {
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        T *item = r->get(b);
+        if (t == b) {
+            // the last item, the thieves may race for it
+            if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                item = nullptr;
+            }
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    // any thread. return: the oldest item, nullptr if empty or another thread got it first
+    T *steal() {
+        int64_t t = m_top.load(std::memory_order_seq_cst);
+        int64_t b = m_bottom.load(std::memory_order_seq_cst);
+        if (t >= b) {
+            return nullptr;
+        }
+        ring *r = m_ring.load(std::memory_order_acquire);
+        T *item = r->get(t);
+        if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        return item;
+    }
+
+private:
+    struct ring {
+        explicit ring(int log_size) :
+            mask(((int64_t)1 << log_size) - 1),
+            log(log_size),
+            slots(new std::atomic<T *>[(size_t)1 << log_size]) {}
+
+        T *get(int64_t i) const { return slots[i & mask].load(std::memory_order_relaxed); }
+        void put(int64_t i, T *item) { slots[i & mask].store(item, std::memory_order_relaxed); }
+
+        int64_t mask;
+        int log;
+        std::unique_ptr<std::atomic<T *>[]> slots;
+    };
+
+    ring *grow(ring *r, int64_t t, int64_t b) {
+        auto bigger = std::make_unique<ring>(r->log + 1);
+        for (int64_t i = t; i < b; i++) {
+            bigger->put(i, r->get(i));
+        }
+        ring *next = bigger.get();
+        m_rings.push_back(std::move(bigger));
+        m_ring.store(next, std::memory_order_release);
+        return next;
+    }
+
+    alignas(64) std::atomic<int64_t> m_top{0};
+    alignas(64) std::atomic<int64_t> m_bottom{0};
+    std::atomic<ring *> m_ring{nullptr};
+    std::vector<std::unique_ptr<ring>> m_rings;     // owner only
+};
+
+class task_group;
+
+class thread_pool final {
+public:
+    // workers: # of worker threads, 0: one per cpu besides the calling thread.
+    // pin: bind worker i to the (i + 1)th cpu the process may run on (wrapping
+    // around), the first one is left to the calling thread.
+    explicit thread_pool(int workers = 0, bool pin = false) {
+        if (workers <= 0) {
+            workers = std::max(0, (int)std::thread::hardware_concurrency() - 1);
+        }
+        if (pin) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+                for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                    if (CPU_ISSET(cpu, &set)) {
+                        m_cpus.push_back(cpu);
+                    }
+                }
+            }
+        }
+        for (int i = 0; i < workers; i++) {
+            m_deques.push_back(std::make_unique<ws_deque<task>>());
+        }
+        for (int i = 0; i < workers; i++) {
+            m_threads.emplace_back(&thread_pool::worker_loop, this, i);
+        }
+    }
+
+    // the tasks already submitted are run first
+    ~thread_pool() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_cv.notify_all();
+        for (auto &thread : m_threads) {
+            thread.join();
+        }
+        // without workers nobody ran the injected tasks which nobody waited for
+        for (task *t : m_inject) {
+            delete t;
+        }
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    static thread_pool &shared() {
+        static thread_pool pool;
+        return pool;
+    }
+
+    int workers() const { return (int)m_threads.size(); }
+
+    // threads a parallel_for can use: the workers and the caller
+    int concurrency() const { return workers() + 1; }
+
+    // true if the workers are bound to cpus
+    bool pinned() const { return !m_cpus.empty(); }
+
+    // run task on a worker, nobody waits for it; without workers it is run right here
+    void submit(std::function<void()> fn) {
+        if (m_threads.empty()) {
+            fn();
+            return;
+        }
+        push(new task{std::move(fn), nullptr});
+    }
+
+    // fn(lo, hi) over [begin, end) in chunks of grain, on up to max_threads
+    // threads (0: all of them) including the calling one. returns when every
+    // chunk is done.
+    template <typename F>
+    void parallel_for(int begin, int end, int grain, F &&fn, int max_threads = 0);
+
+    // run one task of the pool if there is one: the own deque first when called
+    // on a worker, then the other deques, then the injection queue.
+    // return: true if a task was run
+    bool run_one() {
+        task *t = find_task(worker_index());
+        if (t == nullptr) {
+            return false;
+        }
+        execute(t);
+        return true;
+    }
+
+private:
+    friend class task_group;
+
+    struct task {
+        std::function<void()> fn;
+        task_group *group;
+    };
+
+    // index of the calling thread among the workers of this pool, -1 outside it
+    int worker_index() const {
+        return t_pool == this ? t_index : -1;
+    }
+
+    void push(task *t) {
+        // counted first: a worker which sees m_pending 0 never misses a task
+        m_pending.fetch_add(1);
+        int self = worker_index();
+        if (self >= 0) {
+            m_deques[self]->push(t);
+        } else {
+            std::lock_guard<std::mutex> lock(m_inject_mutex);
+            m_inject.push_back(t);
+        }
+        // pairs with m_sleeping++ before the check of m_pending in worker_loop
+        if (m_sleeping.load() > 0) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_cv.notify_one();
+        }
+    }
+
+    task *find_task(int self) {
+        int n = (int)m_deques.size();
+        if (self >= 0) {
+            if (task *t = m_deques[self]->pop()) {
+                return t;
+            }
+        }
+        if (n > 0) {
+            // victims from a random start, so thieves do not all line up at one deque
+            t_seed ^= t_seed << 13;
+            t_seed ^= t_seed >> 17;
+            t_seed ^= t_seed << 5;
+            int start = (int)(t_seed % (uint32_t)n);
+            for (int k = 0; k < n; k++) {
+                int victim = (start + k) % n;
+                if (victim == self) {
+                    continue;
+                }
+                if (task *t = m_deques[victim]->steal()) {
+                    return t;
+                }
+            }
+        }
+        std::lock_guard<std::mutex> lock(m_inject_mutex);
+        if (m_inject.empty()) {
+            return nullptr;
+        }
+        task *t = m_inject.front();
+        m_inject.pop_front();
+        return t;
+    }
+
+    inline void execute(task *t);
+
+    void worker_loop(int index) {
+        t_pool = this;
+        t_index = index;
+        t_seed = 0x9e3779b9u * (uint32_t)(index + 1);
+        if (!m_cpus.empty()) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(m_cpus[(index + 1) % m_cpus.size()], &set);
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        }
+        while (true) {
+            task *t = find_task(index);
+            // a short spin before sleeping: fork join tasks come in bursts
+            for (int spin = 0; t == nullptr && spin < 64 && m_pending.load() > 0; spin++) {
+                std::this_thread::yield();
+                t = find_task(index);
+            }
+            if (t != nullptr) {
+                execute(t);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_sleeping.fetch_add(1);
+            m_cv.wait(lock, [&]() { return m_stop || m_pending.load() > 0; });
+            m_sleeping.fetch_sub(1);
+            if (m_stop && m_pending.load() == 0) {
+                break;
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<ws_deque<task>>> m_deques;
+    std::vector<std::thread> m_threads;
+    std::vector<int> m_cpus;                // pinning: cpus of the process
+    std::mutex m_inject_mutex;
+    std::deque<task *> m_inject;            // tasks from outside the pool
+    std::atomic<int> m_pending{0};          // tasks not taken yet (or about to be pushed)
+    std::atomic<int> m_sleeping{0};
+    std::mutex m_mutex;                     // sleeping workers
+    std::condition_variable m_cv;
+    bool m_stop = false;
+
+    static inline thread_local const thread_pool *t_pool = nullptr;
+    static inline thread_local int t_index = -1;
+    static inline thread_local uint32_t t_seed = 0x2545f491u;
+};
+
+class task_group final {
+public:
+    explicit task_group(thread_pool &pool = thread_pool::shared()) : m_pool(pool) {}
+
+    ~task_group() {
+        wait();
+    }
+
+    task_group(const task_group&) = delete;
+    task_group& operator=(const task_group&) = delete;
+
+    // fn is run on the pool, unless the group is cancelled before it starts
+    void run(std::function<void()> fn) {
+        m_pending.fetch_add(1);
+        m_pool.push(new thread_pool::task{std::move(fn), this});
+    }
+
+    // run tasks of the pool until every task of the group is done (or skipped).
+    // the group can be used again afterwards.
+    // return: 0, -1 if the group was cancelled
+    int wait() {
+        while (true) {
+            if (m_pending.load() > 0 && m_pool.run_one()) {
+                continue;
+            }
+            // the last task_done() has released the lock once this sees 0
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (m_pending.load() == 0) {
+                break;
+            }
+            // the rest is running elsewhere, it may push more work to help with
+            m_cv.wait_for(lock, std::chrono::milliseconds(1));
+        }
+        return m_cancelled.exchange(false) ? -1 : 0;
+    }
+
+    // skip the tasks which have not started; running ones can poll cancelled()
+    void cancel() { m_cancelled.store(true); }
+
+    bool cancelled() const { return m_cancelled.load(std::memory_order_relaxed); }
+
+private:
+    friend class thread_pool;
+
+    void task_done() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_pending.fetch_sub(1) == 1) {
+            m_cv.notify_all();
+        }
+    }
+
+    thread_pool &m_pool;
+    std::atomic<int> m_pending{0};
+    std::atomic<bool> m_cancelled{false};
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+};
+
+inline void thread_pool::execute(task *t)
+{
+    m_pending.fetch_sub(1);
+    task_group *group = t->group;
+    if (group == nullptr || !group->cancelled()) {
+        t->fn();
+    }
+    delete t;
+    if (group != nullptr) {
+        group->task_done();
+    }
+}
+
+template <typename F>
+void thread_pool::parallel_for(int begin, int end, int grain, F &&fn, int max_threads)
+{
+    grain = std::max(grain, 1);
+    int chunks = end > begin ? (end - begin + grain - 1) / grain : 0;
+    int threads = max_threads > 0 ? std::min(max_threads, concurrency()) : concurrency();
+    threads = std::min(threads, chunks);
+    if (threads <= 1) {
+        for (int lo = begin; lo < end; lo += grain) {
+            fn(lo, std::min(lo + grain, end));
+        }
+        return;
+    }
+
+    // dynamic chunks: a helper which is stolen late finds less (or nothing) left
+    std::atomic<int> next{0};
+    auto body = [&]() {
+        for (int chunk = next++; chunk < chunks; chunk = next++) {
+            int lo = begin + chunk * grain;
+            fn(lo, std::min(lo + grain, end));
+        }
+    };
+    task_group group(*this);
+    for (int t = 1; t < threads; t++) {
+        group.run(body);
+    }
+    body();
+    group.wait();
+}
+
+};